@@ -0,0 +1,320 @@
+// ==============================================================================
+/**
+ * alloc.h
+ *
+ * Extensions to the standard allocation interface, provided by bf-alloc,
+ * sf-alloc, and the hybrid allocator except where noted.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_ALLOC_H)
+#define _ALLOC_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stddef.h>
+#include <stdint.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block that sits alone on its cache line(s):  it starts on a line
+ * boundary, and no other block shares its first or last line.  Use it for
+ * objects written by different threads, such as per-thread counters and queue
+ * ends, to keep them from _false sharing_.  Free the block with `free()`.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* malloc_cacheline (size_t size);
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the extent of the heap:  the number of bytes of address space that
+ * the allocator has carved for blocks, whether they are allocated or free.
+ * Compared with the bytes a program holds, it measures fragmentation.
+ *
+ * \return The heap extent, in bytes.
+ */
+size_t alloc_heap_extent (void);
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * A function called for each block visited by a heap walk.  It may read the
+ * block, but must not allocate or free.
+ *
+ * \param block     The block.
+ * \param size      The number of bytes that the block may hold.
+ * \param allocated Whether the block is allocated (1) or free (0).
+ * \param arg       The argument given to the walk.
+ */
+typedef void (*alloc_walk_f) (void* block, size_t size, int allocated, void* arg);
+
+/**
+ * Visit every block of the heap, allocated or free.  bf-alloc visits blocks
+ * region by region in address order, including its movable blocks from
+ * `halloc()` where they lie at the time, and sf-alloc page by page.  Neither
+ * visits blocks that are mapped apart, such as sf-alloc's large blocks, or
+ * headerless blocks from `malloc_ephemeral()`.  With `THREAD_SAFE`, bf-alloc
+ * yields its lock now and then during a walk, though not among movable blocks,
+ * and sf-alloc visits each thread's pages in turn, holding that thread out of
+ * them meanwhile (or, where the kernel lacks `membarrier()`, visits only the
+ * calling thread's pages).
+ *
+ * \param callback The function to call for each block.
+ * \param arg      The argument to pass to `callback`.
+ */
+void alloc_heap_walk (alloc_walk_f callback, void* arg);
+
+/**
+ * Visit each allocated block that starts within a range of addresses, as
+ * `alloc_heap_walk()` would.
+ *
+ * \param base     The start of the range.
+ * \param size     The size of the range, in bytes.
+ * \param callback The function to call for each block.
+ * \param arg      The argument to pass to `callback`.
+ * \return The number of blocks visited.
+ */
+size_t malloc_iterate (uintptr_t base, size_t size, alloc_walk_f callback, void* arg);
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a short-lived block from the calling thread's ephemeral nursery, by
+ * bumping a pointer.  Free the block with `free()`, from any thread, or free
+ * all of the thread's ephemeral blocks at once with `ephemeral_scope_exit()`.
+ * Provided by bf-alloc only.
+ *
+ * \param size The number of bytes to allocate, at most 16 KB.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* malloc_ephemeral (size_t size);
+
+/**
+ * Free every block that the calling thread has allocated with
+ * `malloc_ephemeral()`.  Those blocks must not be used, or passed to `free()`,
+ * afterwards.  Provided by bf-alloc only.
+ */
+void ephemeral_scope_exit (void);
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * A handle to a movable block:  one that the allocator may move to compact
+ * the heap, and that the program finds through its handle.  These functions
+ * are provided by bf-alloc only, when not built with `PERSISTENT_HEAP`.
+ */
+typedef struct alloc_handle alloc_handle_s;
+
+/**
+ * Allocate a movable block.  Use it through `hlock()`, and free it with
+ * `hfree()`, never `free()`.
+ *
+ * \param size The number of bytes to allocate.
+ * \return The block's handle, if successful; `NULL` if unsuccessful.
+ */
+alloc_handle_s* halloc (size_t size);
+
+/**
+ * Lock a movable block in place, and return where it is.  Locks nest, and the
+ * block does not move until each is undone by `hunlock()`.  A pointer into
+ * the block must not be used, or kept, once it is unlocked.
+ *
+ * \param handle The block's handle.
+ * \return A pointer to the block.
+ */
+void* hlock (alloc_handle_s* handle);
+
+/**
+ * Undo a call to `hlock()`, letting the block move once it has no locks.
+ *
+ * \param handle The block's handle.
+ */
+void hunlock (alloc_handle_s* handle);
+
+/**
+ * Free a movable block, locked or not, and its handle.
+ *
+ * \param handle The block's handle, or `NULL`.
+ */
+void hfree (alloc_handle_s* handle);
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the root block of a persistent heap:  the block from which a program
+ * finds the rest of its data after a restart.  Provided by bf-alloc built
+ * with `PERSISTENT_HEAP` only.
+ *
+ * \return The root block, or `NULL` if none has been set.
+ */
+void* alloc_root (void);
+
+/**
+ * Set the root block of a persistent heap.  Provided by bf-alloc built with
+ * `PERSISTENT_HEAP` only.
+ *
+ * \param ptr The new root block, or `NULL` for none.
+ */
+void alloc_set_root (void* ptr);
+
+/**
+ * Make a persistent heap durable, as of now, without closing it.  Provided by
+ * bf-alloc built with `PERSISTENT_HEAP` only.
+ *
+ * \return 0 if successful; -1 if the heap could not be synced.
+ */
+int alloc_sync (void);
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * A heap in shared memory, which cooperating processes each attach to, at an
+ * address of their own, and hand off blocks within by their offsets.  These
+ * functions are provided by bf-alloc built with `SHARED_HEAP` only.
+ */
+typedef struct shm_heap shm_heap_s;
+
+/**
+ * Create a shared heap:  a named POSIX shared memory object, which persists
+ * until `shm_unlink()`, or, without a name, a memfd shared with forked
+ * children.
+ *
+ * \param name The name of the heap, such as "/workers", or `NULL`.
+ * \param size The size of the heap, in bytes.
+ * \return The heap, if successful; `NULL` if unsuccessful.
+ */
+shm_heap_s* shm_heap_create (const char* name, size_t size);
+
+/**
+ * Attach to a named shared heap.
+ *
+ * \param name The name of the heap.
+ * \return The heap, if successful; `NULL` if unsuccessful.
+ */
+shm_heap_s* shm_heap_attach (const char* name);
+
+/**
+ * Detach from a shared heap.
+ *
+ * \param heap The shared heap.
+ */
+void shm_heap_detach (shm_heap_s* heap);
+
+/**
+ * Allocate a block from a shared heap.
+ *
+ * \param heap The shared heap.
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* shm_malloc (shm_heap_s* heap, size_t size);
+
+/**
+ * Free a block of a shared heap, from any attached process.
+ *
+ * \param heap The shared heap.
+ * \param ptr  A pointer to the block to be deallocated.
+ */
+void shm_free (shm_heap_s* heap, void* ptr);
+
+/**
+ * Convert a block of a shared heap to its offset, the same in every process.
+ *
+ * \param heap The shared heap.
+ * \param ptr  A pointer to a block, or `NULL`.
+ * \return The block's offset, or 0 for `NULL`.
+ */
+size_t shm_offset (shm_heap_s* heap, void* ptr);
+
+/**
+ * Convert an offset in a shared heap to a pointer in this process.
+ *
+ * \param heap   The shared heap.
+ * \param offset An offset returned by `shm_offset()`.
+ * \return A pointer to the block, or `NULL` for offset 0.
+ */
+void* shm_pointer (shm_heap_s* heap, size_t offset);
+
+/**
+ * Return the root block of a shared heap.
+ *
+ * \param heap The shared heap.
+ * \return The root block, or `NULL` if none has been set.
+ */
+void* shm_root (shm_heap_s* heap);
+
+/**
+ * Set the root block of a shared heap.
+ *
+ * \param heap The shared heap.
+ * \param ptr  The new root block, or `NULL` for none.
+ */
+void shm_set_root (shm_heap_s* heap, void* ptr);
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The tiers of the hybrid allocator, libhybrid, and the statistics that it
+ * keeps for each.  These are provided by libhybrid only.
+ */
+typedef enum alloc_tier {
+  ALLOC_TIER_SMALL,   // size classes, up to 2 KB
+  ALLOC_TIER_MEDIUM,  // best fit, up to 256 KB
+  ALLOC_TIER_HUGE,    // a mapping per block
+  ALLOC_TIERS
+} alloc_tier_t;
+
+typedef struct alloc_tier_stats {
+
+  /** The number of blocks allocated and freed by the tier. */
+  size_t allocs;
+  size_t frees;
+
+  /** The tier's heap extent, or for the huge tier, the bytes mapped. */
+  size_t extent;
+
+} alloc_tier_stats_s;
+
+/**
+ * Report the statistics of one tier of the hybrid allocator.
+ *
+ * \param tier  The tier.
+ * \param stats Where to store its statistics.
+ */
+void alloc_tier_stats (alloc_tier_t tier, alloc_tier_stats_s* stats);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _ALLOC_H
+// ==============================================================================
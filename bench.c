@@ -0,0 +1,1820 @@
+// ==============================================================================
+/**
+ * bench.c
+ *
+ * Microbenchmarks for the heap allocators.  Each workload is selected by name
+ * on the command line and exercises whichever allocator is in use, so the
+ * same binary is run once per allocator via `LD_PRELOAD`, e.g.:
+ *
+ *   LD_PRELOAD=./libbf.so ./bench freelist 100000
+ *
+ * With `BENCH_COUNTERS` set in the environment, the timed phases of the
+ * workloads also read hardware performance counters (cycles, instructions,
+ * L1D, LLC and dTLB misses, and branch misses) through `perf_event_open()`,
+ * and report each per operation.  Counters that the CPU or the container does
+ * not provide are reported as n/a.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "alloc.h"
+
+// the allocator is chosen at run time, so its extensions may be missing
+#pragma weak alloc_heap_extent
+#pragma weak malloc_ephemeral
+#pragma weak ephemeral_scope_exit
+#pragma weak alloc_root
+#pragma weak alloc_set_root
+#pragma weak shm_heap_create
+#pragma weak shm_heap_attach
+#pragma weak shm_heap_detach
+#pragma weak shm_malloc
+#pragma weak shm_free
+#pragma weak shm_offset
+#pragma weak shm_pointer
+#pragma weak alloc_tier_stats
+#pragma weak alloc_heap_walk
+#pragma weak malloc_iterate
+#pragma weak halloc
+#pragma weak hlock
+#pragma weak hunlock
+#pragma weak hfree
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS
+
+/** The number of timed operations per workload. */
+#define TIMED_OPS 2000
+
+/** The size of the buffer swept to evict the caches, larger than any LLC. */
+#define FLUSH_BYTES (64 * 1024 * 1024)
+
+/** The block size used by the cold free list workload. */
+#define COLD_BLOCK_SIZE 400
+
+/** The number of buffers a simulated request allocates before it ends. */
+#define REQUEST_BUFFERS 64
+
+/** The number of seconds that the decay workload idles after its burst. */
+#define DECAY_SECONDS 3
+
+/**
+ * The time, in milliseconds, that the pressure workload idles for the
+ * allocator to sample its cgroup.
+ */
+#define PRESSURE_IDLE_MS 300
+
+/**
+ * The number of buffers held by the calloc workload, and the time that it
+ * pauses between them, as for work on each buffer.
+ */
+#define CALLOC_WINDOW   8
+#define CALLOC_PAUSE_NS 50000
+
+/** The number of blocks held live by the mixed workload. */
+#define MIXED_WINDOW 4096
+
+/** The number of held blocks that the heap walk workload looks up. */
+#define WALK_SAMPLES 200
+
+/** The number of memtest rounds whose blocks the scaled memtest holds. */
+#define MEM_WINDOW 50000
+
+/**
+ * The growth over the baseline allowed before a footprint workload fails:
+ * little for the heap extent, which is deterministic, and more for the peak
+ * RSS, which also depends on the C library and kernel.
+ */
+#define MEM_EXTENT_TOLERANCE 0.01
+#define MEM_RSS_TOLERANCE    0.10
+
+/** The number of hardware performance counters read around each phase. */
+#define COUNTERS 6
+
+/** The most phases of a workload whose counts are held for its report. */
+#define MAX_PHASES 4
+
+/** The number of distinct call sites in a trace. */
+#define TRACE_SITES 16
+
+/** Trace sites below this one allocate short-lived temporaries. */
+#define TRACE_TEMP_SITES 8
+
+/** The number of temporaries held across requests in a generated trace. */
+#define TRACE_TEMP_WINDOW 32
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Return the current time in nanoseconds. */
+static uint64_t now_ns () {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+} // now_ns ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** The hardware performance counters read around each timed phase. */
+static const struct {
+
+  /** The counter's name in the report. */
+  const char* name;
+
+  /** The counter's type and configuration for `perf_event_open()`. */
+  uint32_t    type;
+  uint64_t    config;
+
+} counters[COUNTERS] = {
+  { "cycles",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "L1D-misses",   PERF_TYPE_HW_CACHE,
+    PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+    PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+  { "LLC-misses",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "dTLB-misses",  PERF_TYPE_HW_CACHE,
+    PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+    PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+  { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/**
+ * The file descriptors of the open counters, -1 for those that could not be
+ * opened, once `counters_open()` has run.
+ */
+static int counter_fds[COUNTERS];
+static int counters_opened = 0;
+
+/** The counts of a phase, held until they are reported after the workload's results. */
+typedef struct phase_record {
+
+  /** The name of the phase, and its number of operations. */
+  const char* name;
+  long        ops;
+
+  /** The count of each counter, or -1 if it could not be read. */
+  double      counts[COUNTERS];
+
+} phase_record_s;
+
+static phase_record_s phases[MAX_PHASES];
+static int            phase_count = 0;
+
+/** Open the counters, if `BENCH_COUNTERS` asks for them, counting this thread in user space. */
+static void counters_open () {
+
+  counters_opened = 1;
+  int wanted = getenv("BENCH_COUNTERS") != NULL;
+  int any    = 0;
+  for (int i = 0; i < COUNTERS; i += 1) {
+    counter_fds[i] = -1;
+    if (!wanted) {
+      continue;
+    }
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = counters[i].type;
+    attr.config         = counters[i].config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    counter_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    any = any || counter_fds[i] >= 0;
+  }
+  if (wanted && !any) {
+    fprintf(stderr, "counters: no hardware counters are available here\n");
+  }
+
+} // counters_open ()
+
+/** Reset and start the counters, at the start of a timed phase. */
+static void phase_begin () {
+
+  if (!counters_opened) {
+    counters_open();
+  }
+  for (int i = 0; i < COUNTERS; i += 1) {
+    if (counter_fds[i] >= 0) {
+      ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+} // phase_begin ()
+
+/**
+ * Stop the counters at the end of a timed phase, and hold their counts, scaled
+ * up for any time that they were multiplexed off of the CPU, for the report.
+ *
+ * \param phase The name of the phase.
+ * \param ops   The number of operations in the phase.
+ */
+static void phase_end (const char* phase, long ops) {
+
+  if (phase_count == MAX_PHASES) {
+    return;
+  }
+  phase_record_s* record = &phases[phase_count];
+  record->name = phase;
+  record->ops  = ops;
+  int any = 0;
+  for (int i = 0; i < COUNTERS; i += 1) {
+    uint64_t values[3];  // the count, and the times enabled and running
+    record->counts[i] = -1;
+    if (counter_fds[i] < 0) {
+      continue;
+    }
+    ioctl(counter_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    any = 1;
+    if (read(counter_fds[i], values, sizeof(values)) == sizeof(values) && values[2] != 0) {
+      record->counts[i] = (double)values[0] * values[1] / values[2];
+    }
+  }
+  phase_count += any;
+
+} // phase_end ()
+
+/** Report the counts per operation of the phases since the last report. */
+static void phases_report () {
+
+  for (int phase = 0; phase < phase_count; phase += 1) {
+    printf("  %s, per op:", phases[phase].name);
+    for (int i = 0; i < COUNTERS; i += 1) {
+      if (phases[phase].counts[i] < 0) {
+	printf(" %s n/a", counters[i].name);
+      } else {
+	printf(" %s %.2f", counters[i].name, phases[phase].counts[i] / phases[phase].ops);
+      }
+    }
+    printf("\n");
+  }
+  phase_count = 0;
+
+} // phases_report ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate an array that is not taken from the allocator being measured.
+ *
+ * \param bytes The size of the array.
+ * \return      A pointer to the zeroed array.
+ */
+static void* bench_array (size_t bytes) {
+
+  void* array = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (array == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  return array;
+
+} // bench_array ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Build a heap with `free_blocks` free blocks of assorted sizes interleaved
+ * with live ones, then time best-fit allocations against it.  Sizes are kept
+ * above the fastbin limit so that every request searches the free index.
+ *
+ * \param free_blocks The number of free blocks to leave in the heap.
+ */
+static void bench_freelist (long free_blocks) {
+
+  void** blocks = bench_array(2 * free_blocks * sizeof(void*));
+  srandom(1);
+  for (long i = 0; i < 2 * free_blocks; i += 1) {
+    blocks[i] = malloc(272 + random() % 1024);
+  }
+  for (long i = 0; i < 2 * free_blocks; i += 2) {
+    free(blocks[i]);
+  }
+
+  phase_begin();
+  uint64_t start = now_ns();
+  for (int op = 0; op < TIMED_OPS; op += 1) {
+    void* block = malloc(272 + random() % 1024);
+    free(block);
+  }
+  uint64_t elapsed = now_ns() - start;
+  phase_end("malloc/free", TIMED_OPS);
+
+  printf("freelist: %ld free blocks, %.1f ns per malloc/free\n",
+	 free_blocks, (double)elapsed / TIMED_OPS);
+  phases_report();
+
+} // bench_freelist ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Evict the caches by writing a buffer much larger than the last level. */
+static void flush_caches () {
+
+  static volatile char* buffer = NULL;
+  if (buffer == NULL) {
+    buffer = bench_array(FLUSH_BYTES);
+  }
+  for (size_t i = 0; i < FLUSH_BYTES; i += 64) {
+    buffer[i] += 1;
+  }
+
+} // flush_caches ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Free `free_blocks` equally sized blocks in shuffled order, so that the free
+ * list hops across the heap, then measure with cold caches (a) a search that
+ * walks the whole list without finding a fit, and (b) popping every block.
+ *
+ * \param free_blocks The number of blocks on the free list.
+ */
+static void bench_coldlist (long free_blocks) {
+
+  void** blocks = bench_array(free_blocks * sizeof(void*));
+  srandom(1);
+  for (long i = 0; i < free_blocks; i += 1) {
+    blocks[i] = malloc(COLD_BLOCK_SIZE);
+  }
+  for (long i = free_blocks - 1; i > 0; i -= 1) {
+    long  j   = random() % (i + 1);
+    void* tmp = blocks[i];
+    blocks[i] = blocks[j];
+    blocks[j] = tmp;
+  }
+  for (long i = 0; i < free_blocks; i += 1) {
+    free(blocks[i]);
+  }
+
+  // (a) A request just too big for any free block walks the whole list.
+  flush_caches();
+  phase_begin();
+  uint64_t start = now_ns();
+  void* miss = malloc(COLD_BLOCK_SIZE + 1);
+  uint64_t walk = now_ns() - start;
+  phase_end("node walked", free_blocks);
+  free(miss);
+
+  // (b) Requests of the freed size pop the list one block at a time.
+  flush_caches();
+  phase_begin();
+  start = now_ns();
+  for (long i = 0; i < free_blocks; i += 1) {
+    blocks[i] = malloc(COLD_BLOCK_SIZE);
+  }
+  uint64_t pop = now_ns() - start;
+  phase_end("pop", free_blocks);
+
+  printf("coldlist: %ld free blocks, %.1f ns per node walked, %.1f ns per pop\n",
+	 free_blocks, (double)walk / free_blocks, (double)pop / free_blocks);
+  phases_report();
+
+} // bench_coldlist ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `count` same-sized objects and repeatedly update the first word of
+ * each.  When the objects sit at the same offset in every page, all of those
+ * words compete for the same few cache sets.
+ *
+ * \param count The number of objects.
+ * \param size  The size of each object.
+ */
+static void bench_conflict (long count, size_t size) {
+
+  volatile long** objects = bench_array(count * sizeof(long*));
+  for (long i = 0; i < count; i += 1) {
+    objects[i] = malloc(size);
+    *objects[i] = 0;
+  }
+
+  long rounds = 100000;
+  phase_begin();
+  uint64_t start = now_ns();
+  for (long round = 0; round < rounds; round += 1) {
+    for (long i = 0; i < count; i += 1) {
+      *objects[i] += 1;
+    }
+  }
+  uint64_t elapsed = now_ns() - start;
+  phase_end("access", rounds * count);
+
+  printf("conflict: %ld objects of %zu bytes, %.2f ns per access\n",
+	 count, size, (double)elapsed / (rounds * count));
+  phases_report();
+
+} // bench_conflict ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate the buffers of many simulated requests, each of which is freed when
+ * its request ends, first with `malloc()` and `free()`, then with
+ * `malloc_ephemeral()` and `ephemeral_scope_exit()`.
+ *
+ * \param size The size of each buffer.
+ */
+static void bench_ephemeral (size_t size) {
+
+  if (malloc_ephemeral == NULL) {
+    fprintf(stderr, "ephemeral: the allocator has no ephemeral nursery\n");
+    exit(1);
+  }
+
+  long   requests = 100000;
+  char** buffers  = bench_array(REQUEST_BUFFERS * sizeof(char*));
+
+  phase_begin();
+  uint64_t start = now_ns();
+  for (long request = 0; request < requests; request += 1) {
+    for (int i = 0; i < REQUEST_BUFFERS; i += 1) {
+      buffers[i]    = malloc(size);
+      buffers[i][0] = i;
+    }
+    for (int i = 0; i < REQUEST_BUFFERS; i += 1) {
+      free(buffers[i]);
+    }
+  }
+  uint64_t heap = now_ns() - start;
+  phase_end("malloc/free", requests * REQUEST_BUFFERS);
+
+  phase_begin();
+  start = now_ns();
+  for (long request = 0; request < requests; request += 1) {
+    for (int i = 0; i < REQUEST_BUFFERS; i += 1) {
+      buffers[i]    = malloc_ephemeral(size);
+      buffers[i][0] = i;
+    }
+    ephemeral_scope_exit();
+  }
+  uint64_t ephemeral = now_ns() - start;
+  phase_end("ephemeral", requests * REQUEST_BUFFERS);
+
+  printf("ephemeral: %zu-byte buffers, %.2f ns per malloc/free, %.2f ns per ephemeral\n",
+	 size, (double)heap / (requests * REQUEST_BUFFERS),
+	 (double)ephemeral / (requests * REQUEST_BUFFERS));
+  phases_report();
+
+} // bench_ephemeral ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a spike of `count` small objects, free them in random order, then
+ * allocate the same number of bytes in larger objects.  Report the heap extent
+ * after each phase, to show whether the pages of the spike are reused.
+ *
+ * \param count The number of small objects.
+ */
+static void bench_spike (long count) {
+
+  if (alloc_heap_extent == NULL) {
+    fprintf(stderr, "spike: the allocator does not report its heap extent\n");
+    exit(1);
+  }
+
+  long   large_count = count / 16;
+  void** blocks      = bench_array(count * sizeof(void*));
+  for (long i = 0; i < count; i += 1) {
+    blocks[i] = malloc(32);
+  }
+  size_t spike = alloc_heap_extent();
+
+  srand(1);
+  for (long i = count - 1; i > 0; i -= 1) {
+    long  j   = rand() % (i + 1);
+    void* tmp = blocks[i];
+    blocks[i] = blocks[j];
+    blocks[j] = tmp;
+  }
+  for (long i = 0; i < count; i += 1) {
+    free(blocks[i]);
+  }
+  size_t drained = alloc_heap_extent();
+
+  for (long i = 0; i < large_count; i += 1) {
+    blocks[i] = malloc(512);
+  }
+  size_t after = alloc_heap_extent();
+
+  printf("spike: %ld x 32 B then %ld x 512 B, extent %zu KB at the spike, "
+	 "%zu KB drained, %zu KB after\n",
+	 count, large_count, spike / 1024, drained / 1024, after / 1024);
+
+} // bench_spike ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the resident memory of this process, in KB.
+ */
+static size_t resident_kb () {
+
+  FILE* statm    = fopen("/proc/self/statm", "r");
+  long  size     = 0;
+  long  resident = 0;
+  if (statm == NULL || fscanf(statm, "%ld %ld", &size, &resident) != 2) {
+    fprintf(stderr, "decay: could not read /proc/self/statm\n");
+    exit(1);
+  }
+  fclose(statm);
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+
+} // resident_kb ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and touch `count` blocks of `size` bytes, free them all, then keep
+ * allocating and freeing one small block for `DECAY_SECONDS`, as an idle
+ * program would.  Report the resident memory after the burst, after freeing
+ * it, and after idling, with the time per idle operation and the slowest one,
+ * to show whether freed memory is returned to the OS, and at what cost.
+ *
+ * \param count The number of blocks in the burst.
+ * \param size  The size of each block.
+ */
+static void bench_decay (long count, size_t size) {
+
+  void** blocks = bench_array(count * sizeof(void*));
+  for (long i = 0; i < count; i += 1) {
+    blocks[i] = malloc(size);
+    memset(blocks[i], 1, size);
+  }
+  size_t burst = resident_kb();
+
+  for (long i = 0; i < count; i += 1) {
+    free(blocks[i]);
+  }
+  size_t freed = resident_kb();
+
+  long     ops     = 0;
+  uint64_t slowest = 0;
+  uint64_t start   = now_ns();
+  uint64_t end     = start + DECAY_SECONDS * 1000000000ull;
+  uint64_t last    = start;
+  while (last < end) {
+    void* block = malloc(32);
+    *(volatile char*)block = 0;
+    free(block);
+    ops += 1;
+    uint64_t now = now_ns();
+    if (now - last > slowest) {
+      slowest = now - last;
+    }
+    last = now;
+  }
+  size_t idle = resident_kb();
+
+  printf("decay: %ld x %zu B, resident %zu KB after the burst, %zu KB freed, "
+	 "%zu KB after %d s idle (%.1f ns/op, slowest %.1f us)\n",
+	 count, size, burst, freed, idle, DECAY_SECONDS,
+	 (double)(last - start) / ops, slowest / 1000.0);
+
+} // bench_decay ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write a file of the fake cgroup directory that the pressure workload drives.
+ *
+ * \param dir  The directory.
+ * \param name The name of the file.
+ * \param text The new contents of the file.
+ */
+static void write_cgroup_file (const char* dir, const char* name, const char* text) {
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE* file = fopen(path, "w");
+  if (file == NULL || fputs(text, file) == EOF || fclose(file) != 0) {
+    fprintf(stderr, "pressure: could not write %s\n", path);
+    exit(1);
+  }
+
+} // write_cgroup_file ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and free one small block repeatedly for `PRESSURE_IDLE_MS`, long
+ * enough for the allocator to sample its cgroup.
+ */
+static void pressure_idle () {
+
+  uint64_t end = now_ns() + PRESSURE_IDLE_MS * 1000000ull;
+  while (now_ns() < end) {
+    void* block = malloc(32);
+    *(volatile char*)block = 0;
+    free(block);
+  }
+
+} // pressure_idle ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Drive the allocator's memory pressure monitor through a fake cgroup
+ * directory, named by `ALLOC_CGROUP`:  free a burst of `count` blocks of
+ * `size` bytes while the cgroup is calm, then raise `memory.current` to its
+ * `memory.max` and free another burst.  Report the resident memory after each
+ * step, to show whether freed memory is returned to the OS under pressure.
+ * Then free every other block of a third burst, and report how far the heap
+ * grows to serve smaller blocks, to show whether they are served from the
+ * holes.
+ *
+ * \param count The number of blocks in each burst.
+ * \param size  The size of each block.
+ */
+static void bench_pressure (long count, size_t size) {
+
+  const char* dir = getenv("ALLOC_CGROUP");
+  if (dir == NULL) {
+    fprintf(stderr, "pressure: set ALLOC_CGROUP to a fake cgroup directory\n");
+    exit(1);
+  }
+  write_cgroup_file(dir, "memory.max", "1073741824\n");
+  write_cgroup_file(dir, "memory.current", "0\n");
+  write_cgroup_file(dir, "memory.pressure",
+		    "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+		    "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+
+  // the first burst is freed while calm, and the second under pressure
+  void** blocks  = bench_array(count * sizeof(void*));
+  size_t freed[2];
+  size_t trimmed = 0;
+  for (int round = 0; round < 2; round += 1) {
+    for (long i = 0; i < count; i += 1) {
+      blocks[i] = malloc(size);
+      memset(blocks[i], 1, size);
+    }
+    for (long i = 0; i < count; i += 1) {
+      free(blocks[i]);
+    }
+    pressure_idle();
+    freed[round] = resident_kb();
+
+    if (round == 0) {
+      write_cgroup_file(dir, "memory.current", "1073741824\n");
+      pressure_idle();
+      trimmed = resident_kb();
+    }
+  }
+
+  // still under pressure, free every other block of a third burst, and see how
+  // far the heap grows to serve half as many blocks of a quarter the size
+  long grown = 0;
+  if (alloc_heap_extent != NULL) {
+    for (long i = 0; i < count; i += 1) {
+      blocks[i] = malloc(size);
+    }
+    for (long i = 0; i < count; i += 2) {
+      free(blocks[i]);
+    }
+    size_t before = alloc_heap_extent();
+    for (long i = 0; i < count; i += 2) {
+      blocks[i] = malloc(size / 4);
+      memset(blocks[i], 1, size / 4);
+    }
+    grown = (long)alloc_heap_extent() - (long)before;
+    for (long i = 0; i < count; i += 1) {
+      free(blocks[i]);
+    }
+  }
+
+  printf("pressure: %ld x %zu B, resident %zu KB freed while calm, "
+	 "%zu KB once under pressure, %zu KB freed under pressure, "
+	 "heap grown %ld KB for %ld x %zu B among the holes\n",
+	 count, size, freed[0], trimmed, freed[1], grown / 1024, count / 2, size / 4);
+
+} // bench_pressure ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Replace the oldest of a window of `CALLOC_WINDOW` zeroed buffers of `size`
+ * bytes `rounds` times, filling each new buffer a little as a program would,
+ * then pausing for `CALLOC_PAUSE_NS`.  Report the time per `calloc()` alone, to
+ * show whether the zeroing of reused blocks has been taken off the caller.
+ *
+ * \param rounds The number of buffers replaced.
+ * \param size   The size of each buffer.
+ */
+static void bench_calloc (long rounds, size_t size) {
+
+  unsigned char* buffers[CALLOC_WINDOW] = { NULL };
+  uint64_t       calloc_ns = 0;
+  long           nonzero   = 0;
+  for (long i = 0; i < rounds; i += 1) {
+
+    unsigned char** slot = &buffers[i % CALLOC_WINDOW];
+    free(*slot);
+    uint64_t start = now_ns();
+    *slot = calloc(1, size);
+    calloc_ns += now_ns() - start;
+
+    // check a sample of the buffer, then dirty all of it
+    for (size_t j = 0; j < size; j += 4096) {
+      nonzero += ((*slot)[j] != 0);
+    }
+    memset(*slot, 0xa5, size);
+
+    uint64_t pause_end = now_ns() + CALLOC_PAUSE_NS;
+    while (now_ns() < pause_end) {
+    }
+
+  }
+  for (int i = 0; i < CALLOC_WINDOW; i += 1) {
+    free(buffers[i]);
+  }
+
+  printf("calloc: %ld x %zu B, %.1f us per calloc(), %ld nonzero bytes seen\n",
+	 rounds, size, (double)calloc_ns / rounds / 1000.0, nonzero);
+
+} // bench_calloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Replace randomly chosen blocks of a live window with new ones of mixed sizes:
+ * mostly small, some medium (2 KB to 64 KB), and a few huge (256 KB to 1 MB).
+ * Report the time per replacement and the heap extent against the bytes held
+ * in small and medium blocks, and, under the hybrid allocator, its tiers.
+ *
+ * \param ops The number of replacements.
+ */
+static void bench_mixed (long ops) {
+
+  void** blocks = bench_array(MIXED_WINDOW * sizeof(void*));
+  size_t* sizes = bench_array(MIXED_WINDOW * sizeof(size_t));
+  size_t  held  = 0;
+
+  srand(1);
+  phase_begin();
+  uint64_t start = now_ns();
+  for (long i = 0; i < ops; i += 1) {
+    int    slot = rand() % MIXED_WINDOW;
+    int    kind = rand() % 100;
+    size_t size = kind < 80 ? 16 + rand() % 496
+                : kind < 98 ? 2048 + rand() % (62 * 1024)
+                : 256 * 1024 + rand() % (768 * 1024);
+    free(blocks[slot]);
+    if (sizes[slot] < 256 * 1024) {
+      held -= sizes[slot];
+    }
+    blocks[slot] = malloc(size);
+    sizes[slot]  = size;
+    if (size < 256 * 1024) {
+      held += size;
+    }
+    *(char*)blocks[slot] = 1;
+  }
+  uint64_t elapsed = now_ns() - start;
+  phase_end("replacement", ops);
+
+  printf("mixed: %ld replacements, %.1f ns each", ops, (double)elapsed / ops);
+  if (alloc_heap_extent != NULL) {
+    printf(", extent %zu KB for %zu KB held", alloc_heap_extent() / 1024, held / 1024);
+  }
+  printf("\n");
+  phases_report();
+
+  if (alloc_tier_stats != NULL) {
+    const char* names[ALLOC_TIERS] = { "small", "medium", "huge" };
+    for (int tier = 0; tier < ALLOC_TIERS; tier += 1) {
+      alloc_tier_stats_s stats;
+      alloc_tier_stats(tier, &stats);
+      printf("  %-6s %9zu allocs %9zu frees %8zu KB\n",
+             names[tier], stats.allocs, stats.frees, stats.extent / 1024);
+    }
+  }
+
+} // bench_mixed ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** The blocks, and bytes, that a heap walk has visited. */
+static long   walk_allocated = 0;
+static long   walk_free      = 0;
+static size_t walk_bytes     = 0;
+
+/** Count a block visited by a heap walk. */
+static void walk_count (void* block, size_t size, int allocated, void* arg) {
+
+  if (allocated) {
+    walk_allocated += 1;
+    walk_bytes     += size;
+  } else {
+    walk_free += 1;
+  }
+
+} // walk_count ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `count` blocks of assorted sizes and free every third one, then
+ * time a walk of the whole heap.  Check with `malloc_iterate()` that a sample of
+ * the blocks still held are found as allocated blocks of at least their sizes;
+ * each such check walks up to the block.
+ *
+ * \param count The number of blocks.
+ */
+static void bench_walk (long count) {
+
+  if (alloc_heap_walk == NULL) {
+    fprintf(stderr, "walk: the allocator cannot walk its heap\n");
+    exit(1);
+  }
+
+  void**  blocks = bench_array(count * sizeof(void*));
+  size_t* sizes  = bench_array(count * sizeof(size_t));
+  srand(1);
+  for (long i = 0; i < count; i += 1) {
+    sizes[i]  = 16 + rand() % 1024;
+    blocks[i] = malloc(sizes[i]);
+  }
+  for (long i = 0; i < count; i += 3) {
+    free(blocks[i]);
+    blocks[i] = NULL;
+  }
+
+  phase_begin();
+  uint64_t start = now_ns();
+  alloc_heap_walk(walk_count, NULL);
+  uint64_t elapsed = now_ns() - start;
+  phase_end("block visited", walk_allocated + walk_free);
+
+  long visited = walk_allocated + walk_free;
+  long missing = 0;
+  long stride  = count / WALK_SAMPLES + 1;
+  for (long i = 1; i < count; i += stride) {
+    if (blocks[i] == NULL) {
+      continue;
+    }
+    walk_allocated = 0;
+    walk_bytes     = 0;
+    if (malloc_iterate((uintptr_t)blocks[i], 1, walk_count, NULL) != 1 ||
+	walk_allocated != 1 || walk_bytes < sizes[i]) {
+      missing += 1;
+    }
+  }
+
+  printf("walk: %ld blocks visited (%ld free), %.1f ns per block, %ld sampled blocks missed\n",
+	 visited, walk_free, (double)elapsed / visited, missing);
+  phases_report();
+
+} // bench_walk ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and free `count` blocks of assorted sizes, from small to ones large
+ * enough to be mapped apart, with `errno` set to a sentinel, and fail if any
+ * successful call changes it, as C requires.  Run it with stderr on a pipe, so
+ * that the debugging variant's tracing is exercised where `fsync()` fails.
+ *
+ * \param count The number of blocks.
+ */
+static void bench_errno (long count) {
+
+  long changed = 0;
+  for (long i = 0; i < count; i += 1) {
+    size_t size  = (size_t)16 << (i % 14);
+    errno        = EDOM;
+    void*  block = malloc(size);
+    changed     += (block != NULL && errno != EDOM);
+    errno        = EDOM;
+    free(block);
+    changed     += (errno != EDOM);
+  }
+
+  printf("errno: %ld malloc()/free() pairs, %ld calls changed errno\n", count, changed);
+  if (changed != 0) {
+    exit(1);
+  }
+
+} // bench_errno ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Fill `count` movable blocks of `size` bytes, each with its index, then free
+ * seven of every eight, with every 64th in the first eighth locked in place
+ * meanwhile.  Unlock those, then replace kept blocks with new ones `count`
+ * times, as a busy program would, while the compactor works.  Report the heap
+ * extent and resident memory after the fill, the frees and the churn, with the
+ * time per churn operation and the slowest one, and check that the blocks kept
+ * still hold their indices.
+ *
+ * \param count The number of blocks.
+ * \param size  The size of each block.
+ */
+static void bench_compact (long count, size_t size) {
+
+  if (halloc == NULL) {
+    fprintf(stderr, "compact: the allocator has no movable blocks\n");
+    exit(1);
+  }
+
+  alloc_handle_s** handles = bench_array(count * sizeof(alloc_handle_s*));
+  for (long i = 0; i < count; i += 1) {
+    handles[i] = halloc(size);
+    if (handles[i] == NULL) {
+      fprintf(stderr, "compact: halloc() failed after %ld blocks\n", i);
+      exit(1);
+    }
+    memset(hlock(handles[i]), (unsigned char)i, size);
+    hunlock(handles[i]);
+  }
+  size_t filled_extent = alloc_heap_extent();
+  size_t filled        = resident_kb();
+
+  for (long i = 0; i < count; i += 1) {
+    if (i % 8 != 0) {
+      hfree(handles[i]);
+      handles[i] = NULL;
+    } else if (i < count / 8 && i % 64 == 0) {
+      hlock(handles[i]);
+    }
+  }
+  size_t freed_extent = alloc_heap_extent();
+  size_t freed        = resident_kb();
+  for (long i = 0; i < count / 8; i += 64) {
+    hunlock(handles[i]);
+  }
+
+  uint64_t slowest = 0;
+  uint64_t start   = now_ns();
+  uint64_t last    = start;
+  for (long i = 0; i < count; i += 1) {
+    long kept = (i * 7919 % (count / 8)) * 8;
+    hfree(handles[kept]);
+    handles[kept] = halloc(size);
+    memset(hlock(handles[kept]), (unsigned char)kept, size);
+    hunlock(handles[kept]);
+    uint64_t now = now_ns();
+    if (now - last > slowest) {
+      slowest = now - last;
+    }
+    last = now;
+  }
+  size_t churned_extent = alloc_heap_extent();
+  size_t churned        = resident_kb();
+
+  long bad = 0;
+  for (long i = 0; i < count; i += 8) {
+    unsigned char* block = hlock(handles[i]);
+    bad += (block[0] != (unsigned char)i || block[size - 1] != (unsigned char)i);
+    hunlock(handles[i]);
+    hfree(handles[i]);
+  }
+
+  printf("compact: %ld x %zu B, extent/resident %zu/%zu KB filled, %zu/%zu KB freed, "
+	 "%zu/%zu KB after churn (%.1f ns/op, slowest %.1f us), %ld blocks corrupt\n",
+	 count, size, filled_extent / 1024, filled, freed_extent / 1024, freed,
+	 churned_extent / 1024, churned, (double)(last - start) / count, slowest / 1000.0, bad);
+
+} // bench_compact ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The bytes held by a footprint workload, and the peaks of those and of the
+ * heap extent.
+ */
+static size_t mem_held        = 0;
+static size_t mem_peak_held   = 0;
+static size_t mem_peak_extent = 0;
+
+/** Note a change in the bytes held, and sample the heap extent. */
+static void mem_note (size_t freed, size_t allocated) {
+
+  mem_held += allocated - freed;
+  if (mem_held > mem_peak_held) {
+    mem_peak_held = mem_held;
+  }
+  size_t extent = alloc_heap_extent();
+  if (extent > mem_peak_extent) {
+    mem_peak_extent = extent;
+  }
+
+} // mem_note ()
+
+/** Allocate, free, and reallocate for a footprint workload, noting the bytes held. */
+static void* mem_malloc (size_t size) {
+
+  void* block = malloc(size);
+  memset(block, 1, size);
+  mem_note(0, size);
+  return block;
+
+} // mem_malloc ()
+
+static void mem_free (void* block, size_t size) {
+
+  free(block);
+  mem_note(size, 0);
+
+} // mem_free ()
+
+static void* mem_realloc (void* block, size_t old_size, size_t size) {
+
+  block = realloc(block, size);
+  if (size > old_size) {
+    memset((char*)block + old_size, 1, size - old_size);
+  }
+  mem_note(old_size, size);
+  return block;
+
+} // mem_realloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Repeat memtest.c's scenario, holding the blocks that it leaves allocated for
+ * the last `MEM_WINDOW` rounds.
+ */
+static void mem_memtest () {
+
+  void** held = bench_array(3 * MEM_WINDOW * sizeof(void*));
+  size_t held_sizes[3] = { 30, 23, 22 };
+  for (long round = 0; round < 4 * MEM_WINDOW; round += 1) {
+
+    void** slot = &held[3 * (round % MEM_WINDOW)];
+    if (round >= MEM_WINDOW) {
+      for (int i = 0; i < 3; i += 1) {
+	mem_free(slot[i], held_sizes[i]);
+      }
+    }
+
+    char* x = mem_malloc(24);
+    char* y = mem_malloc(19);
+    char* z = mem_malloc(32);
+    char* a = mem_realloc(x, 24, 20);
+    char* b = mem_realloc(a, 20, 30);
+    char* c = mem_malloc(19);
+    mem_free(c, 19);
+    mem_free(y, 19);
+    mem_free(z, 32);
+    slot[0] = b;
+    slot[1] = mem_malloc(23);
+    slot[2] = mem_malloc(22);
+
+  }
+
+} // mem_memtest ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Fragment the heap:  in each of several rounds, allocate many small blocks,
+ * free every other one, allocate medium blocks too large for the holes, then
+ * free the rest of the round's small blocks.  The medium blocks are held to the
+ * end, pinning the holes between them.
+ */
+static void mem_frag () {
+
+  long    small_count  = 20000;
+  long    medium_count = 5000;
+  int     rounds       = 4;
+  void**  small        = bench_array(small_count * sizeof(void*));
+  size_t* small_sizes  = bench_array(small_count * sizeof(size_t));
+  void**  medium       = bench_array(rounds * medium_count * sizeof(void*));
+  size_t* medium_sizes = bench_array(rounds * medium_count * sizeof(size_t));
+
+  srand(1);
+  for (int round = 0; round < rounds; round += 1) {
+    for (long i = 0; i < small_count; i += 1) {
+      small_sizes[i] = 16 + rand() % 496;
+      small[i]       = mem_malloc(small_sizes[i]);
+    }
+    for (long i = 0; i < small_count; i += 2) {
+      mem_free(small[i], small_sizes[i]);
+    }
+    for (long i = round * medium_count; i < (round + 1) * medium_count; i += 1) {
+      medium_sizes[i] = 600 + rand() % 1400;
+      medium[i]       = mem_malloc(medium_sizes[i]);
+    }
+    for (long i = 1; i < small_count; i += 2) {
+      mem_free(small[i], small_sizes[i]);
+    }
+  }
+
+} // mem_frag ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Grow many buffers by half again at a time, in turn, so that each must move
+ * past the others' growth, up to 64 KB.
+ */
+static void mem_realloc_growth () {
+
+  long    count   = 2000;
+  void**  buffers = bench_array(count * sizeof(void*));
+  size_t* sizes   = bench_array(count * sizeof(size_t));
+  for (long i = 0; i < count; i += 1) {
+    sizes[i]   = 16;
+    buffers[i] = mem_malloc(sizes[i]);
+  }
+  while (sizes[0] < 64 * 1024) {
+    for (long i = 0; i < count; i += 1) {
+      size_t size = sizes[i] + sizes[i] / 2;
+      buffers[i]  = mem_realloc(buffers[i], sizes[i], size);
+      sizes[i]    = size;
+    }
+  }
+
+} // mem_realloc_growth ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Run a deterministic footprint workload, and print its record:  the label, the
+ * workload, its peak RSS and peak heap extent in KB, and its fragmentation,
+ * the peak extent over the peak bytes held.  Given a baseline file of such
+ * records, compare with the one for the same label and workload, and fail if
+ * the footprint has grown beyond the tolerances.
+ *
+ * \param workload The workload:  memtest, frag, or realloc.
+ * \param label    The label of the record, such as the allocator's name.
+ * \param baseline The baseline file, or `NULL`.
+ */
+static void bench_mem (const char* workload, const char* label, const char* baseline) {
+
+  if (alloc_heap_extent == NULL) {
+    fprintf(stderr, "mem: the allocator does not report its heap extent\n");
+    exit(1);
+  }
+
+  if (strcmp(workload, "memtest") == 0) {
+    mem_memtest();
+  } else if (strcmp(workload, "frag") == 0) {
+    mem_frag();
+  } else if (strcmp(workload, "realloc") == 0) {
+    mem_realloc_growth();
+  } else {
+    fprintf(stderr, "mem: unknown workload %s\n", workload);
+    exit(1);
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  long   rss    = usage.ru_maxrss;
+  size_t extent = mem_peak_extent / 1024;
+  double frag   = (double)mem_peak_extent / mem_peak_held;
+  printf("%s %s %ld %zu %.2f\n", label, workload, rss, extent, frag);
+  if (baseline == NULL) {
+    return;
+  }
+
+  FILE* records = fopen(baseline, "r");
+  if (records == NULL) {
+    perror(baseline);
+    exit(1);
+  }
+  char   base_label[64];
+  char   base_workload[64];
+  long   base_rss;
+  size_t base_extent;
+  double base_frag;
+  while (fscanf(records, "%63s %63s %ld %zu %lf", base_label, base_workload,
+		&base_rss, &base_extent, &base_frag) == 5) {
+    if (strcmp(base_label, label) != 0 || strcmp(base_workload, workload) != 0) {
+      continue;
+    }
+    fclose(records);
+    int regressed = 0;
+    if (rss > base_rss * (1 + MEM_RSS_TOLERANCE)) {
+      fprintf(stderr, "mem: %s %s: peak RSS %ld KB exceeds the baseline's %ld KB\n",
+	      label, workload, rss, base_rss);
+      regressed = 1;
+    }
+    if (extent > base_extent * (1 + MEM_EXTENT_TOLERANCE)) {
+      fprintf(stderr, "mem: %s %s: peak extent %zu KB exceeds the baseline's %zu KB\n",
+	      label, workload, extent, base_extent);
+      regressed = 1;
+    }
+    // the baseline's fragmentation was rounded to hundredths when recorded
+    if (frag > base_frag * (1 + MEM_EXTENT_TOLERANCE) + 0.005) {
+      fprintf(stderr, "mem: %s %s: fragmentation %.2fx exceeds the baseline's %.2fx\n",
+	      label, workload, frag, base_frag);
+      regressed = 1;
+    }
+    if (regressed) {
+      exit(1);
+    }
+    return;
+  }
+
+  fprintf(stderr, "mem: %s has no record for %s %s\n", baseline, label, workload);
+  exit(1);
+
+} // bench_mem ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Generate a deterministic allocation trace on standard output, modeled on a
+ * server that answers requests with a few temporaries while filling a cache of
+ * long-lived entries, evicting an entry at random once the cache is full.
+ * Each line is either `a <id> <size> <site>` or `f <id>`.
+ *
+ * \param requests The number of requests to trace.
+ */
+static void bench_gentrace (long requests) {
+
+  long  cache_capacity = requests / 8 + 1;
+  long* cache          = bench_array(cache_capacity * sizeof(long));
+  long  cache_count    = 0;
+  long  temps[TRACE_TEMP_WINDOW];
+  long  temp_count     = 0;
+  long  next_id        = 0;
+
+  srand(1);
+  for (long request = 0; request < requests; request += 1) {
+
+    // allocate a burst of temporaries, retiring the oldest beyond the window
+    int burst = 2 + rand() % 6;
+    for (int i = 0; i < burst; i += 1) {
+      if (temp_count == TRACE_TEMP_WINDOW) {
+	printf("f %ld\n", temps[0]);
+	memmove(&temps[0], &temps[1], (TRACE_TEMP_WINDOW - 1) * sizeof(long));
+	temp_count -= 1;
+      }
+      temps[temp_count++] = next_id;
+      printf("a %ld %d %d\n", next_id++, 16 + rand() % 512, rand() % TRACE_TEMP_SITES);
+    }
+
+    // fill the cache with one entry, evicting another if the cache is full
+    if (cache_count == cache_capacity) {
+      long victim = rand() % cache_count;
+      printf("f %ld\n", cache[victim]);
+      cache[victim] = cache[--cache_count];
+    }
+    cache[cache_count++] = next_id;
+    printf("a %ld %d %d\n", next_id++, 64 + rand() % 1024,
+	   TRACE_TEMP_SITES + rand() % (TRACE_SITES - TRACE_TEMP_SITES));
+
+  }
+
+} // bench_gentrace ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate on behalf of one of the trace's sites.  Each site has its own copy,
+ * so that each calls `malloc()` from a distinct return address.
+ */
+#define TRACE_SITE(n)							\
+  static __attribute__((noinline)) void* trace_site_##n (size_t size) {	\
+    void* block = malloc(size);						\
+    __asm__ volatile ("" : : "r" (block) : "memory");			\
+    return block;							\
+  }
+TRACE_SITE(0)  TRACE_SITE(1)  TRACE_SITE(2)  TRACE_SITE(3)
+TRACE_SITE(4)  TRACE_SITE(5)  TRACE_SITE(6)  TRACE_SITE(7)
+TRACE_SITE(8)  TRACE_SITE(9)  TRACE_SITE(10) TRACE_SITE(11)
+TRACE_SITE(12) TRACE_SITE(13) TRACE_SITE(14) TRACE_SITE(15)
+
+/** The trace's sites, by number. */
+static void* (*trace_sites[TRACE_SITES]) (size_t) = {
+  trace_site_0,  trace_site_1,  trace_site_2,  trace_site_3,
+  trace_site_4,  trace_site_5,  trace_site_6,  trace_site_7,
+  trace_site_8,  trace_site_9,  trace_site_10, trace_site_11,
+  trace_site_12, trace_site_13, trace_site_14, trace_site_15
+};
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Replay a trace written by `gentrace`, then report the peak bytes held by the
+ * trace, the peak heap extent, and their ratio, the fragmentation.
+ *
+ * \param path The trace file.
+ */
+static void bench_replay (const char* path) {
+
+  if (alloc_heap_extent == NULL) {
+    fprintf(stderr, "replay: the allocator does not report its heap extent\n");
+    exit(1);
+  }
+
+  FILE* trace = fopen(path, "r");
+  if (trace == NULL) {
+    perror(path);
+    exit(1);
+  }
+
+  // read the whole trace before replaying, so that parsing allocates nothing
+  long   capacity = 1 << 23;
+  long   count    = 0;
+  char*  ops      = bench_array(capacity * sizeof(char));
+  long*  ids      = bench_array(capacity * sizeof(long));
+  int*   sizes    = bench_array(capacity * sizeof(int));
+  int*   sites    = bench_array(capacity * sizeof(int));
+  long   max_id   = 0;
+  char   op;
+  while (count < capacity && fscanf(trace, " %c %ld", &op, &ids[count]) == 2) {
+    ops[count] = op;
+    if (op == 'a' && fscanf(trace, "%d %d", &sizes[count], &sites[count]) != 2) {
+      break;
+    }
+    if (ids[count] > max_id) {
+      max_id = ids[count];
+    }
+    count += 1;
+  }
+  fclose(trace);
+
+  void** blocks = bench_array((max_id + 1) * sizeof(void*));
+  int*   held   = bench_array((max_id + 1) * sizeof(int));
+  size_t live   = 0;
+  size_t peak_live   = 0;
+  size_t peak_extent = 0;
+  for (long i = 0; i < count; i += 1) {
+    long id = ids[i];
+    if (ops[i] == 'a') {
+      blocks[id] = trace_sites[sites[i] % TRACE_SITES](sizes[i]);
+      held[id]   = sizes[i];
+      live      += sizes[i];
+      if (live > peak_live) {
+	peak_live = live;
+      }
+    } else {
+      free(blocks[id]);
+      live -= held[id];
+    }
+    size_t extent = alloc_heap_extent();
+    if (extent > peak_extent) {
+      peak_extent = extent;
+    }
+  }
+
+  printf("replay: %ld ops, peak live %zu KB, peak extent %zu KB, fragmentation %.2fx\n",
+	 count, peak_live / 1024, peak_extent / 1024, (double)peak_extent / peak_live);
+
+} // bench_replay ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** A node of the linked list kept in a persistent heap. */
+typedef struct persist_node {
+
+  /** The next node, or `NULL` at the end of the list. */
+  struct persist_node* next;
+
+  /** The node's number, from which its payload is derived. */
+  long                 number;
+
+  /** The payload, of varying length. */
+  unsigned char        payload[];
+
+} persist_node_s;
+
+/** The length of a node's payload. */
+#define PERSIST_PAYLOAD(number) (32 + (number) % 256)
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Exit unless the allocator keeps a persistent heap. */
+static void persist_required () {
+
+  if (alloc_root == NULL) {
+    fprintf(stderr, "persist: the allocator does not keep a persistent heap\n");
+    exit(1);
+  }
+
+} // persist_required ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Compare two times, for `qsort()`. */
+static int compare_times (const void* a, const void* b) {
+
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+
+} // compare_times ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The child of the startup workload:  time the program's first allocation,
+ * before anything else has been done, and write the time to a pipe.
+ *
+ * \param fd The pipe to write to.
+ */
+static void bench_startup_child (int fd) {
+
+  uint64_t start = now_ns();
+  void*    block = malloc(64);
+  uint64_t first = now_ns() - start;
+  free(block);
+  if (write(fd, &first, sizeof(first)) != sizeof(first)) {
+    exit(1);
+  }
+
+} // bench_startup_child ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Start this program `runs` times, under whichever allocator is preloaded,
+ * each time only to time its first allocation.  Report the median time from
+ * `fork()` to the child's exit, and the median time of its first allocation.
+ *
+ * \param self This program's path.
+ * \param runs The number of runs.
+ */
+static void bench_startup (const char* self, long runs) {
+
+  uint64_t* startups = bench_array(runs * sizeof(uint64_t));
+  uint64_t* firsts   = bench_array(runs * sizeof(uint64_t));
+  for (long i = 0; i < runs; i += 1) {
+
+    int fds[2];
+    if (pipe(fds) == -1) {
+      perror("startup: pipe");
+      exit(1);
+    }
+    char fd_arg[16];
+    snprintf(fd_arg, sizeof(fd_arg), "%d", fds[1]);
+
+    uint64_t start = now_ns();
+    pid_t    pid   = fork();
+    if (pid == 0) {
+      close(fds[0]);
+      execl(self, self, "startup-child", fd_arg, (char*)NULL);
+      _exit(127);
+    }
+    close(fds[1]);
+    int status;
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 ||
+	!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+	read(fds[0], &firsts[i], sizeof(firsts[i])) != sizeof(firsts[i])) {
+      fprintf(stderr, "startup: run %ld failed\n", i);
+      exit(1);
+    }
+    startups[i] = now_ns() - start;
+    close(fds[0]);
+
+  }
+
+  qsort(startups, runs, sizeof(uint64_t), compare_times);
+  qsort(firsts, runs, sizeof(uint64_t), compare_times);
+  printf("startup: %ld runs, median %.1f us to start and exit, "
+	 "first allocation %.1f us\n",
+	 runs, startups[runs / 2] / 1000.0, firsts[runs / 2] / 1000.0);
+
+} // bench_startup ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Build a list of `count` nodes in the persistent heap, rooted at its root
+ * block.  The build time is what a restart costs without persistence.
+ *
+ * \param count The number of nodes.
+ * \param crash Whether to exit without closing the heap cleanly.
+ */
+static void bench_persist_build (long count, int crash) {
+
+  persist_required();
+  uint64_t        start = now_ns();
+  persist_node_s* head  = NULL;
+  for (long number = count - 1; number >= 0; number -= 1) {
+    persist_node_s* node = malloc(sizeof(persist_node_s) + PERSIST_PAYLOAD(number));
+    node->next   = head;
+    node->number = number;
+    memset(node->payload, (unsigned char)number, PERSIST_PAYLOAD(number));
+    head         = node;
+  }
+  alloc_set_root(head);
+  uint64_t elapsed = now_ns() - start;
+
+  printf("persist-build: %ld nodes in %.2f ms%s\n",
+	 count, elapsed / 1e6, crash ? ", exiting uncleanly" : "");
+  fflush(stdout);
+  if (crash) {
+    _exit(0);
+  }
+
+} // bench_persist_build ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Reopen the persistent heap, and check every node of the list built by
+ * `persist-build`.  Report the time to reach the root, which includes mapping
+ * the heap and, after an unclean exit, recovering it.  Then allocate and free
+ * some blocks, to check that the recovered heap still works.
+ */
+static void bench_persist_check () {
+
+  persist_required();
+  uint64_t        start   = now_ns();
+  persist_node_s* node    = alloc_root();
+  uint64_t        reopen  = now_ns() - start;
+  long            count   = 0;
+  long            corrupt = 0;
+  for (; node != NULL; node = node->next) {
+    if (node->number != count ||
+	node->payload[PERSIST_PAYLOAD(count) - 1] != (unsigned char)count) {
+      corrupt += 1;
+    }
+    count += 1;
+  }
+  uint64_t checked = now_ns() - start;
+
+  for (int i = 0; i < 1000; i += 1) {
+    free(malloc(16 + i));
+  }
+
+  printf("persist-check: root in %.3f ms, %ld nodes (%ld corrupt) checked in %.2f ms\n",
+	 reopen / 1e6, count, corrupt, checked / 1e6);
+
+} // bench_persist_check ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Hand `count` messages from this process to a forked child, which attaches to
+ * the same shared heap by name.  First, copy each message through a pipe.
+ * Then, write each message into a shared heap block, and send only its offset;
+ * the child checks the message and frees its block.
+ *
+ * \param count The number of messages.
+ * \param size  The size of each message.
+ */
+static void bench_shm (long count, size_t size) {
+
+  if (shm_heap_create == NULL) {
+    fprintf(stderr, "shm: the allocator has no shared heaps\n");
+    exit(1);
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "/bf-bench-%d", (int)getpid());
+  shm_heap_s* heap = shm_heap_create(name, 64 * 1024 * 1024 + count * (size + 64));
+  if (heap == NULL) {
+    perror("shm_heap_create");
+    exit(1);
+  }
+  unsigned char* message = bench_array(size);
+
+  for (int zero_copy = 0; zero_copy <= 1; zero_copy += 1) {
+
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+      perror("pipe");
+      exit(1);
+    }
+    uint64_t start = now_ns();
+    pid_t    child = fork();
+    if (child == 0) {
+
+      // the child checks the first and last byte of each message
+      close(pipe_fds[1]);
+      shm_heap_s* attached = shm_heap_attach(name);
+      long        bad      = 0;
+      for (long i = 0; i < count; i += 1) {
+	unsigned char* received = message;
+	size_t         offset;
+	if (zero_copy) {
+	  if (read(pipe_fds[0], &offset, sizeof(offset)) != sizeof(offset)) {
+	    _exit(2);
+	  }
+	  received = shm_pointer(attached, offset);
+	} else {
+	  for (size_t got = 0; got < size; ) {
+	    ssize_t n = read(pipe_fds[0], message + got, size - got);
+	    if (n <= 0) {
+	      _exit(2);
+	    }
+	    got += n;
+	  }
+	}
+	bad += (received[0] != (unsigned char)i || received[size - 1] != (unsigned char)i);
+	if (zero_copy) {
+	  shm_free(attached, received);
+	}
+      }
+      shm_heap_detach(attached);
+      _exit(bad == 0 ? 0 : 1);
+
+    }
+
+    close(pipe_fds[0]);
+    for (long i = 0; i < count; i += 1) {
+      unsigned char* sent = zero_copy ? shm_malloc(heap, size) : message;
+      memset(sent, (unsigned char)i, size);
+      if (zero_copy) {
+	size_t offset = shm_offset(heap, sent);
+	if (write(pipe_fds[1], &offset, sizeof(offset)) != sizeof(offset)) {
+	  exit(1);
+	}
+      } else if (write(pipe_fds[1], sent, size) != (ssize_t)size) {
+	exit(1);
+      }
+    }
+    close(pipe_fds[1]);
+    int status;
+    waitpid(child, &status, 0);
+    uint64_t elapsed = now_ns() - start;
+
+    printf("shm: %ld %zu-byte messages %s, %.0f ns per message%s\n",
+	   count, size, zero_copy ? "by offset" : "copied", (double)elapsed / count,
+	   WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "" : " (FAILED)");
+
+  }
+
+  shm_heap_detach(heap);
+  shm_unlink(name);
+
+} // bench_shm ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The entry point.  Run the named workload.
+ */
+int main (int argc, char** argv) {
+
+  if (argc < 2) {
+    fprintf(stderr, "USAGE: %s <workload> [args]\n", argv[0]);
+    fprintf(stderr, "  freelist <# free blocks>\n");
+    fprintf(stderr, "  coldlist <# free blocks>\n");
+    fprintf(stderr, "  conflict <# objects> <object size>\n");
+    fprintf(stderr, "  ephemeral <buffer size>\n");
+    fprintf(stderr, "  spike <# small objects>\n");
+    fprintf(stderr, "  decay <# blocks> <block size>\n");
+    fprintf(stderr, "  pressure <# blocks> <block size>\n");
+    fprintf(stderr, "  mixed <# replacements>\n");
+    fprintf(stderr, "  calloc <# buffers> <buffer size>\n");
+    fprintf(stderr, "  mem <memtest|frag|realloc> <label> [<baseline file>]\n");
+    fprintf(stderr, "  gentrace <# requests>\n");
+    fprintf(stderr, "  persist-build <# nodes> [crash]\n");
+    fprintf(stderr, "  persist-check\n");
+    fprintf(stderr, "  shm <# messages> <message size>\n");
+    fprintf(stderr, "  replay <trace file>\n");
+    fprintf(stderr, "  walk <# blocks>\n");
+    fprintf(stderr, "  errno <# blocks>\n");
+    fprintf(stderr, "  compact <# blocks> <block size>\n");
+    fprintf(stderr, "  startup <# runs>\n");
+    fprintf(stderr, "Set BENCH_COUNTERS to report hardware counters per operation.\n");
+    return 1;
+  }
+
+  if (strcmp(argv[1], "freelist") == 0 && argc == 3) {
+    bench_freelist(atol(argv[2]));
+  } else if (strcmp(argv[1], "coldlist") == 0 && argc == 3) {
+    bench_coldlist(atol(argv[2]));
+  } else if (strcmp(argv[1], "conflict") == 0 && argc == 4) {
+    bench_conflict(atol(argv[2]), atol(argv[3]));
+  } else if (strcmp(argv[1], "ephemeral") == 0 && argc == 3) {
+    bench_ephemeral(atol(argv[2]));
+  } else if (strcmp(argv[1], "persist-build") == 0 && (argc == 3 || argc == 4)) {
+    bench_persist_build(atol(argv[2]), argc == 4 && strcmp(argv[3], "crash") == 0);
+  } else if (strcmp(argv[1], "persist-check") == 0 && argc == 2) {
+    bench_persist_check();
+  } else if (strcmp(argv[1], "shm") == 0 && argc == 4) {
+    bench_shm(atol(argv[2]), atol(argv[3]));
+  } else if (strcmp(argv[1], "spike") == 0 && argc == 3) {
+    bench_spike(atol(argv[2]));
+  } else if (strcmp(argv[1], "decay") == 0 && argc == 4) {
+    bench_decay(atol(argv[2]), atol(argv[3]));
+  } else if (strcmp(argv[1], "pressure") == 0 && argc == 4) {
+    bench_pressure(atol(argv[2]), atol(argv[3]));
+  } else if (strcmp(argv[1], "calloc") == 0 && argc == 4) {
+    bench_calloc(atol(argv[2]), atol(argv[3]));
+  } else if (strcmp(argv[1], "mixed") == 0 && argc == 3) {
+    bench_mixed(atol(argv[2]));
+  } else if (strcmp(argv[1], "mem") == 0 && (argc == 4 || argc == 5)) {
+    bench_mem(argv[2], argv[3], argc == 5 ? argv[4] : NULL);
+  } else if (strcmp(argv[1], "gentrace") == 0 && argc == 3) {
+    bench_gentrace(atol(argv[2]));
+  } else if (strcmp(argv[1], "replay") == 0 && argc == 3) {
+    bench_replay(argv[2]);
+  } else if (strcmp(argv[1], "walk") == 0 && argc == 3) {
+    bench_walk(atol(argv[2]));
+  } else if (strcmp(argv[1], "errno") == 0 && argc == 3) {
+    bench_errno(atol(argv[2]));
+  } else if (strcmp(argv[1], "compact") == 0 && argc == 4) {
+    bench_compact(atol(argv[2]), atol(argv[3]));
+  } else if (strcmp(argv[1], "startup") == 0 && argc == 3) {
+    bench_startup(argv[0], atol(argv[2]));
+  } else if (strcmp(argv[1], "startup-child") == 0 && argc == 3) {
+    bench_startup_child(atoi(argv[2]));
+  } else {
+    fprintf(stderr, "%s: unknown workload or arguments\n", argv[0]);
+    return 1;
+  }
+
+  return 0;
+
+} // main ()
+// ==============================================================================
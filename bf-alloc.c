@@ -6,6 +6,117 @@
  * from which to allocate the best fitting free block.  If the list does not
  * contain any blocks of sufficient size, it uses _pointer bumping_ to expand
  * the heap.
+ *
+ * Small blocks are cached in front of the free list on _fastbins_:  singly
+ * linked LIFO lists, one per 16-byte size step, that `free()` pushes onto and
+ * `malloc()` pops from without searching.
+ *
+ * When built with `SOA_FREE_INDEX`, the free list is replaced by a dense,
+ * separately mapped _structure-of-arrays_ table of free block sizes and
+ * headers, which the best-fit search scans with SIMD kernels chosen at run
+ * time for the CPU.
+ *
+ * When built with `CACHE_COLORING`, large bump allocations start at rotating
+ * cache-line offsets (_colors_), so that same-sized objects do not all land in
+ * the same cache sets.
+ *
+ * When built with `THREAD_SAFE`, a single lock serializes all use of the heap.
+ *
+ * When built with `COMPRESSED_LINKS`, headers hold their links and sizes as
+ * 32-bit offsets and counts in double-words, halving them to 16 bytes.
+ *
+ * When built with `SITE_SEGREGATION`, each allocation's call site is hashed,
+ * and sampled frees teach the allocator how long each site's blocks live.
+ * Blocks from sites that are predicted to be short-lived are placed in a
+ * separate _nursery_ region at the top of the heap, which is reset as soon as
+ * it empties, keeping temporaries from pinning holes among long-lived blocks.
+ *
+ * When built with `DECAY`, free blocks of two pages or more are stamped with
+ * the time that they were freed, and every few hundred calls a bounded pass
+ * returns to the OS the whole pages of those that have stayed free for
+ * `DECAY_MS`, oldest first, so that memory freed in a burst does not stay
+ * resident while the program idles.
+ *
+ * When built with `MEMORY_PRESSURE`, the allocator samples the memory limit,
+ * usage and PSI stall figures of its cgroup (see pressure.h) every
+ * `PRESSURE_INTERVAL_MS`.  On entering pressure it empties the fastbins and
+ * returns the whole pages of every free block to the OS, and while pressure
+ * lasts, it returns those of each large block as it is freed.
+ *
+ * When built with `PREZERO` (and `THREAD_SAFE`), freed blocks of
+ * `PREZERO_MIN_SIZE` or more are handed to a helper thread, which zeroes them
+ * outside the heap lock and keeps them on a separate list of _known-zero_
+ * blocks.  `calloc()` takes from that list first, and skips its `memset()` for
+ * any block that is known to be zero, as are those bumped from fresh heap
+ * space.  `malloc()` takes from it only when nothing else fits.
+ *
+ * The heap is initialized by a library constructor, so `malloc()` and `free()`
+ * do not check for it.  Requests made before the constructor runs, as by the
+ * dynamic loader and the C library while they start up, find the heap empty
+ * and are served from a small static _bootstrap arena_ without mapping the
+ * heap.  Blocks there are never reused, and freeing them does nothing.
+ *
+ * Each header follows the end of the block before it, rounded up to a double
+ * word, or else a _padding header_ covers the gap between them, so that
+ * `alloc_heap_walk()` and `malloc_iterate()` can walk the heap from header to
+ * header in address order.
+ *
+ * `malloc_ephemeral()` serves short-lived buffers from per-thread _ephemeral
+ * chunks_ carved from a region mapped apart from the heap on its first call.  Blocks there have no headers and
+ * are bumped from the chunk without any list work.  Each chunk counts its live
+ * blocks, and is reused once they are all freed or once its thread calls
+ * `ephemeral_scope_exit()`.
+ *
+ * `halloc()` serves _movable_ blocks, which the program reaches through
+ * handles, from a region of their own, mapped apart from the heap on the first
+ * call.  Ordinary
+ * blocks never move, so live ones pin the holes between them; movable ones
+ * may, so free space among them is reclaimed by an incremental _compactor_.
+ * Once enough of the region is garbage, each `halloc()` and `hfree()` slides
+ * a bounded slice of blocks down toward the region's start, skipping any that
+ * `hlock()` holds in place, whose holes before them `halloc()` fills first.
+ * At the end of a pass the bump pointer drops, and the steps that follow
+ * return the pages above it to the OS.  (Not with `PERSISTENT_HEAP`, whose
+ * handles would not persist.)
+ *
+ * When built with `PERSISTENT_HEAP`, the heap is mapped from the file named by
+ * the `BF_HEAP_FILE` environment variable, so that its blocks outlive the
+ * process.  The first page is a _superblock_ recording the allocator's state as
+ * offsets into the heap, and links are always compressed offsets, so the heap
+ * may be mapped again, at any address, to resume in milliseconds.  The
+ * consistency protocol is:
+ *
+ *   1. Opening a heap marks the superblock _dirty_ and syncs it to the file
+ *      before any block is allocated or freed.
+ *   2. A clean shutdown (process exit, or the library's unloading) saves the
+ *      state into the superblock, syncs the heap, then marks the superblock
+ *      _clean_ and syncs it again.  Any later allocation marks it dirty anew.
+ *   3. Reopening a clean heap loads the saved state as-is.  Reopening a dirty
+ *      heap rebuilds the state by walking every header in address order, from
+ *      the superblock up to the first header that is missing or torn.  For
+ *      that walk, bump allocation pads blocks with _padding headers_, not
+ *      with anonymous gaps.  Blocks that were allocated stay allocated.
+ *   4. `alloc_sync()` makes the heap durable without closing it.  After a
+ *      system crash, writes since the last sync may be lost.
+ *   5. One process at a time owns a heap file, holding an exclusive lock on
+ *      it.  Another process that names the same file gets an anonymous heap,
+ *      as does a child process forked from the owner, whose private copy of
+ *      the heap does not persist.
+ *
+ * `malloc()` and `free()` are compiled in lean, checking and debugging
+ * variants, of which an `ifunc` resolver binds one when the library is loaded,
+ * as named by the `ALLOC_DISPATCH` environment variable (see dispatch.h).  So
+ * are the SIMD kernels of `SOA_FREE_INDEX`, by the CPU's features.  Only the
+ * checking and debugging variants call `check()`, every so many calls, on a
+ * bounded slice of the heap.
+ *
+ * When built with `SHARED_HEAP`, the `shm_heap_*()` functions manage separate
+ * heaps in `MAP_SHARED` memory (a POSIX shared memory object or a memfd) that
+ * cooperating processes attach to.  Each process may map a shared heap at its
+ * own address, so its links are offsets from the heap's start, and processes
+ * hand off blocks as offsets.  A robust, process-shared lock serializes use,
+ * and each update publishes with a single final store, so a process that dies
+ * holding the lock leaks at most the block it was moving.
  **/
 // ==============================================================================
 
@@ -14,6 +125,7 @@
 // ==============================================================================
 // INCLUDES
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -23,7 +135,46 @@
 #include <unistd.h>
 #include <sys/mman.h>
 
+#if defined (SOA_FREE_INDEX)
+#include <immintrin.h>
+#endif
+
+#if defined (THREAD_SAFE)
+#include <pthread.h>
+#endif
+
+#if defined (PREZERO)
+#include <signal.h>
+#endif
+
+#if defined (PERSISTENT_HEAP)
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#endif
+
+#if defined (DECAY) || defined (MEMORY_PRESSURE)
+#include <time.h>
+#endif
+
+#if defined (SHARED_HEAP)
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#endif
+
+#include "alloc.h"
+#include "dispatch.h"
 #include "safeio.h"
+
+#if defined (MEMORY_PRESSURE)
+#include "pressure.h"
+#endif
+
+#if defined (HYBRID_MEDIUM_TIER)
+#include "hybrid.h"
+#endif
 // ==============================================================================
 
 
@@ -31,311 +182,4245 @@
 // ==============================================================================
 // TYPES AND STRUCTURES
 
+#if defined (PERSISTENT_HEAP)
+// the persistent heap may be mapped at another address, so link by offsets
+#if !defined (COMPRESSED_LINKS)
+#define COMPRESSED_LINKS
+#endif
+// the free index table and the nursery are not within the heap file
+#if defined (SOA_FREE_INDEX) || defined (SITE_SEGREGATION)
+#error "PERSISTENT_HEAP cannot be combined with SOA_FREE_INDEX or SITE_SEGREGATION"
+#endif
+// the file's pages are not released by madvise(), so there is nothing to decay
+#if defined (DECAY) || defined (MEMORY_PRESSURE)
+#error "PERSISTENT_HEAP cannot be combined with DECAY or MEMORY_PRESSURE"
+#endif
+// space past the end of a reopened heap is not known to be zero
+#if defined (PREZERO)
+#error "PERSISTENT_HEAP cannot be combined with PREZERO"
+#endif
+#endif
+
+// the zeroing thread shares the heap lock
+#if defined (PREZERO) && !defined (THREAD_SAFE)
+#error "PREZERO requires THREAD_SAFE"
+#endif
+
+#if defined (COMPRESSED_LINKS)
+/** A link to a header, as an offset from the start of the heap (0 if none). */
+typedef uint32_t       link_t;
+
+/** A block size, in units of `LINK_GRANULARITY` bytes. */
+typedef uint32_t       block_size_t;
+#else
+/** A link to a header. */
+typedef struct header* link_t;
+
+/** A block size, in bytes. */
+typedef size_t         block_size_t;
+#endif
+
 /** The header for each allocated object. */
 typedef struct header {
 
   /** Pointer to the next header in the list. */
-  struct header* next;
+  link_t         next;
+
+  union {
+
+    /** Pointer to the previous header in the list. */
+    link_t       prev;
+
+    /** The slot of a free block in the free index table, which is not listed. */
+    uint32_t     slot;
+
+  };
+
+  /** The usable size of the block (exclusive of the header itself). */
+  block_size_t   size;
+
+  /** Is the block allocated or free? */
+  bool           allocated : 1;
+
+  /** Was the block allocated by `malloc_cacheline()`? */
+  bool           cacheline : 1;
+
+  /** Does this header only cover padding, and not head a block? */
+  bool           padding   : 1;
+
+#if defined (DECAY) || defined (MEMORY_PRESSURE)
+  /** Have the whole pages of this free block been returned to the OS? */
+  bool           purged    : 1;
+#endif
+
+#if defined (PREZERO)
+  /** Is the whole block known to be zero? */
+  bool           zeroed    : 1;
+#endif
+
+#if defined (SITE_SEGREGATION)
+  /** Is the block in the nursery? */
+  bool           nursery   : 1;
+
+  /** Is the block's lifetime being sampled? */
+  bool           sampled   : 1;
+
+  /** The site table entry of the block's call site, if sampled. */
+  uint16_t       site;
+
+  /** The allocation clock when the block was allocated, if sampled. */
+  uint32_t       birth;
+#endif
+
+} __attribute__((aligned(16))) header_s;
+
+#if defined (SITE_SEGREGATION)
+/** What has been learned about the blocks allocated at one call site. */
+typedef struct site_entry {
+
+  /** The call site (return address) that owns this entry. */
+  void*          site;
+
+  /** The number of lifetimes sampled. */
+  uint32_t       samples;
+
+  /** The moving average lifetime, in allocations. */
+  uint32_t       lifetime;
+
+} site_entry_s;
+#endif
+
+#if defined (SOA_FREE_INDEX)
+/**
+ * A best-fit search kernel over the free index table.  Given `count` block
+ * sizes, return the slot of the smallest size that is at least `size`, or
+ * `count` if none is.
+ */
+typedef size_t (*soa_search_f) (const uint64_t* sizes, size_t count, size_t size);
+#endif
+
+#if defined (PERSISTENT_HEAP)
+/** The first page of a persistent heap, recording the state of the heap. */
+typedef struct superblock {
+
+  /** Identifies a heap file. */
+  uint64_t       magic;
+
+  /** The layout of the heap, which must match that of the library. */
+  uint32_t       version;
+  uint32_t       header_size;
+  uint64_t       heap_size;
+
+  /** Was the heap closed cleanly, so that the saved state is current? */
+  uint32_t       state;
+
+  /** The address at which the heap was last mapped. */
+  uint64_t       base;
+
+  /**
+   * The saved state:  the bump pointer, as an offset, and the lists.  The
+   * fastbins are folded into the free list before saving.
+   */
+  uint64_t       free_offset;
+  link_t         free_list_head;
+  link_t         allocated_list_head;
+  link_t         cacheline_list_head;
+  uint32_t       next_color;
+
+  /** The application's root block, from which it finds the rest. */
+  link_t         root;
+
+} superblock_s;
+#endif
+
+#if defined (SHARED_HEAP)
+/** The start of a shared heap, which is also its handle in each process. */
+struct shm_heap {
+
+  /** Identifies an initialized shared heap. */
+  uint64_t        magic;
+
+  /** The size of the whole shared heap, in bytes. */
+  uint64_t        size;
+
+  /** The robust, process-shared lock that serializes use of the heap. */
+  pthread_mutex_t lock;
+
+  /** The offset of the next available byte. */
+  uint64_t        free_offset;
+
+  /** The offset of the header at the head of the free list (0 if none). */
+  uint64_t        free_list;
+
+  /** The offset of the root block (0 if none). */
+  uint64_t        root;
+
+};
+
+/** The header of each block in a shared heap, linked by offsets. */
+typedef struct shm_header {
+
+  /** The offset of the next header in the free list (0 if none). */
+  uint64_t       next;
+
+  /** The usable size of the block. */
+  uint64_t       size;
+
+  /** Is the block allocated or free? */
+  uint64_t       allocated;
+
+  /** Keep the block double-word aligned. */
+  uint64_t       unused;
+
+} shm_header_s;
+#endif
+
+/**
+ * The header of an ephemeral chunk, alone on the chunk's first cache line, so
+ * that frees from other threads do not contend with the owner's blocks.
+ */
+typedef struct ephemeral_chunk {
+
+  /** The next chunk owned by the same thread. */
+  struct ephemeral_chunk* next;
+
+  /**
+   * Once the chunk is retired, the number of its live blocks.  Before that, the
+   * negated number of its blocks freed by other threads.
+   */
+  int64_t                 live;
+
+  /** Has the owner stopped allocating from this chunk? */
+  bool                    retired;
+
+} ephemeral_chunk_s;
+
+#if !defined (PERSISTENT_HEAP)
+/**
+ * A handle to a movable block, through which the program finds the block
+ * wherever the compactor has moved it.
+ */
+struct alloc_handle {
+
+  union {
+
+    /** The block, while the handle is in use. */
+    void*                block;
+
+    /** The next unused handle, while it is not. */
+    struct alloc_handle* next_unused;
+
+  };
+
+  /** The number of `hlock()` calls not yet undone; a locked block stays put. */
+  size_t                 locks;
+
+};
+
+/**
+ * The header of a movable block.  Blocks are laid end to end in the movable
+ * region, so the compactor walks them from header to header.
+ */
+typedef struct movable_header {
+
+  /** The block's handle, or `NULL` if the block is free. */
+  alloc_handle_s* handle;
+
+  /** The number of bytes that the block holds, a multiple of 16. */
+  size_t          size;
+
+} movable_header_s;
+
+/**
+ * A hole that a compaction pass left before a locked block, listed apart from
+ * the region, so that the listing survives the next pass moving blocks over it.
+ */
+typedef struct movable_hole {
+
+  /** The hole's free header, and its size, with the header. */
+  intptr_t addr;
+  size_t   size;
+
+  /** The pass that left it. */
+  uint64_t pass;
+
+} movable_hole_s;
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The system's page size. */
+#define PAGE_SIZE sysconf(_SC_PAGESIZE)
+
+/**
+ * Macros to easily calculate the number of bytes for larger scales (e.g., kilo,
+ * mega, gigabytes).
+ */
+#define KB(size)  ((size_t)size * 1024)
+#define MB(size)  (KB(size) * 1024)
+#define GB(size)  (MB(size) * 1024)
+
+/** The virtual address space reserved for the heap. */
+#if !defined (HEAP_SIZE)
+#define HEAP_SIZE GB(2)
+#endif
+
+/** Given a pointer to a header, obtain a `void*` pointer to the block itself. */
+#define HEADER_TO_BLOCK(hp) ((void*)((intptr_t)hp + sizeof(header_s)))
+
+/** Given a pointer to a block, obtain a `header_s*` pointer to its header. */
+#define BLOCK_TO_HEADER(bp) ((header_s*)((intptr_t)bp - sizeof(header_s)))
+
+/** The size of a cache line. */
+#define CACHE_LINE_SIZE 64
+
+/** The number of cache-line colors through which bump allocations rotate. */
+#if !defined (CACHE_COLORS)
+#define CACHE_COLORS 8
+#endif
+
+/** The smallest bump allocation that is given a color. */
+#if !defined (CACHE_COLOR_MIN_SIZE)
+#define CACHE_COLOR_MIN_SIZE 1024
+#endif
+
+/**
+ * Hint to the processor that the line holding `addr` will soon be read
+ * (`rw` = 0) or written (`rw` = 1).  Disabled with `-DNO_PREFETCH`.
+ */
+#if defined (NO_PREFETCH)
+#define PREFETCH(addr, rw)
+#else
+#define PREFETCH(addr, rw) __builtin_prefetch((const void*)(addr), (rw))
+#endif
+
+/**
+ * The granularity of compressed links and sizes.  Every header, and so every
+ * block, is double-word aligned, so 32-bit offsets in these units span 64 GB.
+ */
+#define LINK_GRANULARITY 16
+
+/**
+ * Read and write the links and size of a header.  With `COMPRESSED_LINKS`, a
+ * link is stored as a 32-bit offset from `start_addr` and a size as a 32-bit
+ * count, both in units of `LINK_GRANULARITY`, halving the header to 16 bytes.
+ * Offsets are stored plus one, leaving 0 for `NULL`.
+ */
+#if defined (COMPRESSED_LINKS)
+#define LINK(hp)           ((link_t)((hp) == NULL ? 0 :			\
+				     ((intptr_t)(hp) - start_addr) / LINK_GRANULARITY + 1))
+#define UNLINK(l)          ((l) == 0 ? NULL :					\
+			    (header_s*)(start_addr + ((intptr_t)(l) - 1) * LINK_GRANULARITY))
+#define GET_SIZE(hp)       ((size_t)(hp)->size * LINK_GRANULARITY)
+#define SET_SIZE(hp, s)    ((hp)->size = (block_size_t)(ROUND_UP_16(s) / LINK_GRANULARITY))
+#else
+#define LINK(hp)           (hp)
+#define UNLINK(l)          (l)
+#define GET_SIZE(hp)       ((hp)->size)
+#define SET_SIZE(hp, s)    ((hp)->size = (s))
+#endif
+#define GET_NEXT(hp)       UNLINK((hp)->next)
+#define GET_PREV(hp)       UNLINK((hp)->prev)
+#define SET_NEXT(hp, p)    ((hp)->next = LINK(p))
+#define SET_PREV(hp, p)    ((hp)->prev = LINK(p))
+
+#if defined (COMPRESSED_LINKS)
+_Static_assert(HEAP_SIZE / LINK_GRANULARITY < UINT32_MAX,
+	       "compressed links cannot span the heap");
+#endif
+
+/** The virtual address space at the top of the heap set aside for the nursery. */
+#if !defined (NURSERY_SIZE)
+#define NURSERY_SIZE MB(256)
+#endif
+
+/** The number of entries in the call site table (a power of 2). */
+#define SITE_TABLE_SIZE 1024
+
+/** Sample the lifetime of one in this many allocations. */
+#define SITE_SAMPLE_RATE 16
+
+/** The number of samples a site needs before its blocks are placed by lifetime. */
+#define SITE_MIN_SAMPLES 4
+
+/** Sites whose blocks live fewer than this many allocations are short-lived. */
+#if !defined (SHORT_LIFETIME)
+#define SHORT_LIFETIME 4096
+#endif
+
+/** Hash a call site to its entry in the site table. */
+#define SITE_HASH(site) ((((uintptr_t)(site) >> 2) * 0x9e3779b97f4a7c15ULL) >> 54)
+
+#if defined (PERSISTENT_HEAP)
+/** The environment variable naming the heap file. */
+#define HEAP_FILE_ENV "BF_HEAP_FILE"
+
+/** Identifies a heap file ("bf-heap" and a version byte). */
+#define SUPERBLOCK_MAGIC   0x0170616568666200ULL
+#define SUPERBLOCK_VERSION 1
+
+/** The space at the start of the heap taken by the superblock. */
+#define SUPERBLOCK_SIZE    PAGE_SIZE
+
+/** The superblock's states. */
+#define HEAP_DIRTY 0
+#define HEAP_CLEAN 1
+
+/** Mark the superblock dirty, if it was closed cleanly, before changing the heap. */
+#define PERSIST_TOUCH() if (superblock->state == HEAP_CLEAN) persist_touch()
+#else
+#define PERSIST_TOUCH()
+#endif
+
+#if defined (SHARED_HEAP)
+/** Identifies an initialized shared heap ("bf-shm" and a version byte). */
+#define SHM_MAGIC 0x01006d68732d6662ULL
+
+/** The offset of the first block in a shared heap. */
+#define SHM_FIRST_OFFSET ROUND_UP_LINE(sizeof(shm_heap_s))
+
+/** Convert between a shared heap's offsets and this process's pointers. */
+#define SHM_POINTER(heap, offset) ((void*)((intptr_t)(heap) + (offset)))
+#define SHM_OFFSET(heap, ptr)     ((uint64_t)((intptr_t)(ptr) - (intptr_t)(heap)))
+#endif
+
+/** The size, and alignment, of each ephemeral chunk. */
+#define EPHEMERAL_CHUNK_SIZE KB(64)
+
+/** The virtual address space mapped for ephemeral chunks on first use. */
+#if !defined (EPHEMERAL_REGION_SIZE)
+#define EPHEMERAL_REGION_SIZE MB(256)
+#endif
+
+/** The largest ephemeral block. */
+#define EPHEMERAL_MAX_SIZE (EPHEMERAL_CHUNK_SIZE / 4)
+
+/** Find the chunk that holds an ephemeral block. */
+#define EPHEMERAL_CHUNK(bp) ((ephemeral_chunk_s*)((intptr_t)(bp) & ~(intptr_t)(EPHEMERAL_CHUNK_SIZE - 1)))
+
+/** Is a block an ephemeral one? */
+#define IS_EPHEMERAL(bp) ((intptr_t)(bp) >= ephemeral_start_addr && (intptr_t)(bp) < ephemeral_end_addr)
+
+/**
+ * The size of the static bootstrap arena, which serves the requests made
+ * before the heap is initialized.
+ */
+#define BOOTSTRAP_SIZE KB(64)
+
+/** Is a block one from the bootstrap arena? */
+#define IS_BOOTSTRAP(bp) ((intptr_t)(bp) >= (intptr_t)bootstrap_arena &&	\
+			  (intptr_t)(bp) <  (intptr_t)bootstrap_arena + BOOTSTRAP_SIZE)
+
+/** Round a size up to the next multiple of 16 bytes (a double-word). */
+#define ROUND_UP_16(x) (((size_t)(x) + 15) & ~(size_t)15)
+
+/** Round a size or address up to the next multiple of the cache line size. */
+#define ROUND_UP_LINE(x) (((size_t)(x) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1))
+
+/** Take and release the heap lock, when there is one. */
+#if defined (THREAD_SAFE)
+#define LOCK()   pthread_mutex_lock(&heap_lock)
+#define UNLOCK() pthread_mutex_unlock(&heap_lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+/**
+ * The largest block size, in bytes, that is cached on a fastbin.  Override at
+ * compile time (e.g., `-DFASTBIN_MAX_SIZE=512`); set to 0 to disable fastbins.
+ */
+#if !defined (FASTBIN_MAX_SIZE)
+#define FASTBIN_MAX_SIZE 256
+#endif
+
+/**
+ * The most blocks that a single fastbin may hold.  Frees beyond this depth
+ * overflow onto the best-fit free list.
+ */
+#if !defined (FASTBIN_DEPTH)
+#define FASTBIN_DEPTH 64
+#endif
+
+/** The number of fastbins, one per 16-byte size step. */
+#define FASTBIN_COUNT (FASTBIN_MAX_SIZE / 16)
+
+/** Given a block size, obtain the index of its fastbin. */
+#define FASTBIN_INDEX(size) ((ROUND_UP_16(size) / 16) - 1)
+
+/** The initial number of entries in the free index table. */
+#define SOA_INITIAL_CAPACITY KB(4)
+
+/**
+ * The time, in milliseconds, after which the whole pages of a free block that
+ * has not been reused are returned to the OS, when built with `DECAY`.
+ */
+#if !defined (DECAY_MS)
+#define DECAY_MS 1000
+#endif
+
+/** The number of calls to `malloc()` and `free()` between checks of the clock. */
+#define DECAY_TICK_OPS 256
+
+/** The least time, in milliseconds, between scavenging passes. */
+#define DECAY_INTERVAL_MS (DECAY_MS / 32 + 1)
+
+/**
+ * The most free blocks examined, and the most bytes returned to the OS, by one
+ * scavenging pass, so that no call is delayed for long.
+ */
+#define DECAY_SCAN      64
+#define DECAY_PURGE_MAX MB(4)
+
+/**
+ * The smallest free block whose pages are returned to the OS, one sure to hold
+ * a whole page after its first word.
+ */
+#define PURGE_MIN_SIZE (2 * PAGE_SIZE)
+
+/** The time at which a free block was freed, kept in its first word. */
+#define DECAY_STAMP(hp) (*(uint64_t*)HEADER_TO_BLOCK(hp))
+
+/** Count a call, and now and then scavenge free blocks that have decayed. */
+#if defined (DECAY)
+#define DECAY_TICK() if (++decay_ops % DECAY_TICK_OPS == 0) decay_tick()
+#else
+#define DECAY_TICK()
+#endif
+
+/**
+ * The smallest freed block that is zeroed ahead of time, and the most bytes
+ * awaiting zeroing or kept zeroed, when built with `PREZERO`.
+ */
+#if !defined (PREZERO_MIN_SIZE)
+#define PREZERO_MIN_SIZE KB(16)
+#endif
+#if !defined (PREZERO_MAX_BYTES)
+#define PREZERO_MAX_BYTES MB(64)
+#endif
+
+/**
+ * The number of calls to `malloc()` and `free()` between checks of the clock,
+ * and the least time, in milliseconds, between samples of the cgroup's memory
+ * pressure, when built with `MEMORY_PRESSURE`.
+ */
+#define PRESSURE_TICK_OPS    256
+#define PRESSURE_INTERVAL_MS 100
+
+/** Count a call, and now and then sample the memory pressure. */
+#if defined (MEMORY_PRESSURE)
+#define PRESSURE_TICK() if (++pressure_ops % PRESSURE_TICK_OPS == 0) pressure_tick()
+#else
+#define PRESSURE_TICK()
+#endif
+
+/**
+ * The number of headers that a heap walk visits before it yields the heap lock
+ * to other threads for a moment.
+ */
+#if !defined (WALK_CHUNK)
+#define WALK_CHUNK 4096
+#endif
+
+/**
+ * The calls to `malloc()` and `free()` between heap checks in the checking
+ * variants, and the headers that each check examines, unless tuned with
+ * `ALLOC_CHECK_INTERVAL` and `ALLOC_CHECK_SLICE` (see dispatch.h).
+ */
+#define CHECK_INTERVAL 64
+#define CHECK_SLICE    64
+
+#if !defined (PERSISTENT_HEAP)
+/** The virtual address space mapped for movable blocks on first use. */
+#if !defined (MOVABLE_REGION_SIZE)
+#define MOVABLE_REGION_SIZE MB(256)
+#endif
+
+/** The most handles that may be in use at once. */
+#define HANDLE_TABLE_SIZE (1 << 20)
+
+/**
+ * The most bytes that a compaction step moves, and the most headers that it
+ * visits, before it returns to its caller.
+ */
+#define COMPACT_SLICE_BYTES   KB(64)
+#define COMPACT_SLICE_HEADERS 256
+
+/** The most bytes of the movable region that a step returns to the OS. */
+#define COMPACT_TRIM_BYTES KB(256)
+
+/**
+ * The free bytes in the movable region, beyond those that the last pass left,
+ * that start a compaction pass:  at least `COMPACT_MIN_GARBAGE`, and at least
+ * a quarter of the live bytes, so that a pass moves at most four bytes for
+ * each one freed.
+ */
+#define COMPACT_MIN_GARBAGE KB(64)
+
+/** The block of a movable header, and the header of a movable block. */
+#define MOVABLE_TO_BLOCK(hp)  ((void*)((intptr_t)(hp) + sizeof(movable_header_s)))
+#define BLOCK_TO_MOVABLE(bp)  ((movable_header_s*)((intptr_t)(bp) - sizeof(movable_header_s)))
+
+/** The most holes before locked blocks that are kept for `halloc()` to fill. */
+#define HOLE_TABLE_SIZE 64
+#endif
+// ==============================================================================
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The address of the next available byte in the heap region. */
+static intptr_t free_addr  = 0;
+
+/** The beginning of the heap. */
+static intptr_t start_addr = 0;
+
+/** The end of the heap. */
+static intptr_t end_addr   = 0;
+
+#if !defined (SOA_FREE_INDEX)
+/** The head of the free list. */
+static header_s* free_list_head = NULL;
+#endif
+
+#if defined (DECAY)
+#if defined (SOA_FREE_INDEX)
+/** The slot of the free index table at which the scavenger resumes. */
+static size_t    decay_slot   = 0;
+#else
+/**
+ * The tail of the free list, its longest free block, and the block nearest the
+ * head that the scavenger has passed.  Blocks are pushed at the head, so they
+ * are ordered by the time they were freed, and the scavenger works from the
+ * tail toward the head.
+ */
+static header_s* free_list_tail = NULL;
+static header_s* decay_cursor   = NULL;
+#endif
+
+/** The calls to `malloc()` and `free()` since the last check of the clock. */
+static unsigned int decay_ops  = 0;
+
+/** The time at which the next scavenging pass is due. */
+static uint64_t     decay_next = 0;
+#endif
+
+#if defined (PREZERO)
+/** The freed blocks awaiting zeroing, and the known-zero free blocks. */
+static header_s*      prezero_pending_head = NULL;
+static header_s*      prezero_list_head    = NULL;
+
+/** The bytes of the blocks awaiting zeroing, being zeroed, or known zero. */
+static size_t         prezero_bytes        = 0;
+
+/** Wake the zeroing thread when blocks await it. */
+static pthread_cond_t prezero_cond         = PTHREAD_COND_INITIALIZER;
+
+/** Has the zeroing thread been started in this process? */
+static bool           prezero_started      = false;
+#endif
+
+#if defined (MEMORY_PRESSURE)
+/** Is the cgroup under memory pressure, as last sampled? */
+static bool         under_pressure = false;
+
+/** The calls to `malloc()` and `free()` since the last check of the clock. */
+static unsigned int pressure_ops   = 0;
+
+/** The time at which the next sample is due. */
+static uint64_t     pressure_next  = 0;
+#endif
+
+/** The head of the allocated list. */
+static header_s* allocated_list_head = NULL;
+
+/** The calls between heap checks, and the headers that each check examines. */
+static size_t   check_interval = CHECK_INTERVAL;
+static size_t   check_slice    = CHECK_SLICE;
+
+/** The header at which the next heap check resumes, or 0 to start afresh. */
+static intptr_t check_addr     = 0;
+
+/** The calls since this thread's last heap check. */
+#if defined (THREAD_SAFE)
+static __thread size_t check_ops __attribute__((tls_model("initial-exec"))) = 0;
+#else
+static size_t check_ops = 0;
+#endif
+
+#if defined (CACHE_COLORING)
+/** The color to give the next large bump allocation. */
+static unsigned int next_color = 0;
+#endif
+
+#if defined (SITE_SEGREGATION)
+/** The allocation clock, counting every allocation. */
+static uint32_t alloc_clock = 0;
+
+/** The learned lifetimes of call sites. */
+static site_entry_s site_table[SITE_TABLE_SIZE];
+
+/** The beginning of the nursery. */
+static intptr_t nursery_start_addr = 0;
 
-  /** Pointer to the previous header in the list. */
-  struct header* prev;
+/** The address of the next available byte in the nursery. */
+static intptr_t nursery_free_addr  = 0;
+
+/** The head of the nursery's free list. */
+static header_s* nursery_list_head = NULL;
+
+/** The number of allocated blocks in the nursery. */
+static size_t nursery_live = 0;
+
+/** The number of times the nursery has been reset, ending walks across it. */
+static uint64_t nursery_resets = 0;
+#endif
+
+/** The boundaries of the region from which ephemeral chunks are carved. */
+static intptr_t ephemeral_start_addr = 0;
+static intptr_t ephemeral_end_addr   = 0;
+
+/** The next ephemeral chunk to carve. */
+static intptr_t ephemeral_free_addr  = 0;
+
+/** The ephemeral chunks owned by this thread. */
+static __thread ephemeral_chunk_s* my_chunks __attribute__((tls_model("initial-exec"))) = NULL;
+
+/** This thread's current ephemeral chunk. */
+static __thread ephemeral_chunk_s* my_chunk __attribute__((tls_model("initial-exec"))) = NULL;
+
+/** The next free byte, and the end, of this thread's current ephemeral chunk. */
+static __thread intptr_t my_bump  __attribute__((tls_model("initial-exec"))) = 0;
+static __thread intptr_t my_limit __attribute__((tls_model("initial-exec"))) = 0;
+
+/** The number of blocks in the current chunk that this thread has not freed. */
+static __thread int64_t  my_count __attribute__((tls_model("initial-exec"))) = 0;
+
+#if defined (THREAD_SAFE)
+/** The key whose destructor gives up an exiting thread's ephemeral chunks. */
+static pthread_key_t  ephemeral_key;
+static pthread_once_t ephemeral_key_once = PTHREAD_ONCE_INIT;
+
+/** The ephemeral chunks given up by exited threads, for others to adopt. */
+static ephemeral_chunk_s* orphan_chunks = NULL;
+#endif
+
+/** The head of the list of free blocks allocated by `malloc_cacheline()`. */
+static header_s* cacheline_list_head = NULL;
+
+#if !defined (PERSISTENT_HEAP)
+/** The boundaries of the region from which movable blocks are bumped. */
+static intptr_t movable_start_addr = 0;
+static intptr_t movable_end_addr   = 0;
+
+/** The next free byte of the movable region, and the highest ever touched. */
+static intptr_t movable_free_addr  = 0;
+static intptr_t movable_high_addr  = 0;
+
+/**
+ * The bytes of free movable blocks, with their headers, below
+ * `movable_free_addr`, and of those, the ones that the last compaction pass
+ * left behind, mostly before locked blocks.  Only the others count toward
+ * starting the next pass, so that blocks locked for long do not make every
+ * pass move the whole region for little gain.
+ */
+static size_t   movable_garbage    = 0;
+static size_t   movable_pinned     = 0;
+
+/**
+ * During a compaction pass, the blocks below `compact_dest` have been
+ * compacted, those from `compact_scan` up are yet to be, and the space between
+ * is free, without headers.
+ */
+static bool     compacting         = false;
+static intptr_t compact_dest       = 0;
+static intptr_t compact_scan       = 0;
+
+/**
+ * During a compaction pass, the largest space yet left before a locked block,
+ * not yet covered by a free block, which later blocks may be moved into.
+ */
+static intptr_t compact_hole       = 0;
+static intptr_t compact_hole_end   = 0;
+
+/**
+ * The largest holes left before locked blocks, which `halloc()` fills before it
+ * bumps, so that blocks locked for long do not push the region ever upward;
+ * and the number of passes begun, which tells the holes still valid.
+ */
+static movable_hole_s movable_holes[HOLE_TABLE_SIZE];
+static int            hole_count     = 0;
+static uint64_t       compact_passes = 0;
+
+/** The table of handles, mapped on first use, and the number ever used. */
+static alloc_handle_s* handle_table   = NULL;
+static size_t          handle_count   = 0;
+
+/** The handles freed for reuse. */
+static alloc_handle_s* unused_handles = NULL;
+#endif
+
+#if defined (PERSISTENT_HEAP)
+/**
+ * Stands in for the superblock until the heap is mapped.  It is never clean,
+ * so that allocating from the bootstrap arena touches nothing.
+ */
+static superblock_s  bootstrap_superblock = { .state = HEAP_DIRTY };
+
+/** The superblock at the start of the heap. */
+static superblock_s* superblock = &bootstrap_superblock;
+
+/** The heap file, or -1 if the heap is anonymous. */
+static int heap_fd = -1;
+#endif
+
+#if defined (THREAD_SAFE)
+/** The lock that serializes all use of the heap. */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/** The bootstrap arena, and the offset of its next free byte. */
+static uint8_t bootstrap_arena[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t  bootstrap_used = 0;
+
+#if FASTBIN_COUNT > 0
+/** The heads of the fastbins, one per 16-byte size step. */
+static header_s* fastbins[FASTBIN_COUNT] = { NULL };
+
+/** The number of blocks on each fastbin. */
+static unsigned int fastbin_lengths[FASTBIN_COUNT] = { 0 };
+
+/** The total number of blocks across all fastbins. */
+static unsigned int fastbin_blocks = 0;
+#endif
+
+#if defined (SOA_FREE_INDEX)
+/** The sizes of the free blocks, densely packed for the search kernels. */
+static uint64_t* soa_sizes = NULL;
+
+/** The headers of the free blocks, parallel to `soa_sizes`. */
+static header_s** soa_headers = NULL;
+
+/** The number of free blocks in the table. */
+static size_t soa_count = 0;
+
+/** The number of entries for which the table has space. */
+static size_t soa_capacity = 0;
+#endif
+// ==============================================================================
+
+
+
+
+
+// ==============================================================================
+/**
+ * Add a header to the head of the allocated list and mark it allocated.
+ *
+ * \param header_ptr The header of the block being allocated.
+ */
+static void allocated_list_push (header_s* header_ptr) {
+
+  // make next for header_ptr be the current LL head, and header_ptr the LL head
+  SET_NEXT(header_ptr, allocated_list_head);
+  // make prev for header_ptr NULL since it's the beginning
+  SET_PREV(header_ptr, NULL);
+  // if there was a block as the LL head, then make it's prev header_ptr
+  if (allocated_list_head != NULL) {
+    SET_PREV(allocated_list_head, header_ptr);
+  }
+  allocated_list_head = header_ptr;
+  // set to true that the block has been allocated
+  header_ptr->allocated = true;
+
+} // allocated_list_push ()
+// ==============================================================================
+
+
+
+#if !defined (SOA_FREE_INDEX)
+// ==============================================================================
+/**
+ * Add a header to the head of the free list and mark it free.
+ *
+ * \param header_ptr The header of the block being freed.
+ */
+static void free_list_push (header_s* header_ptr) {
+
+  // make next the current head of free LL
+  SET_NEXT(header_ptr, free_list_head);
+  // make prev of freed header NULL
+  SET_PREV(header_ptr, NULL);
+  // if freed header is not the only pointer in LL, make prev pointer of next the freed header
+  if (free_list_head != NULL) {
+    SET_PREV(free_list_head, header_ptr);
+  }
+#if defined (DECAY)
+  else {
+    free_list_tail = header_ptr;
+  }
+#endif
+  // make freed header the new head of free LL
+  free_list_head   = header_ptr;
+  // set the freed header to NOT allocated
+  header_ptr->allocated = false;
+
+} // free_list_push ()
+// ==============================================================================
+
+
+
+
+
+
+// ==============================================================================
+/**
+ * Search the free list for the _best fit_ for a request, and unlink it.
+ *
+ * \param size The number of bytes requested.
+ * \return The header of the best fitting free block, if one exists; `NULL`
+ *         otherwise.
+ */
+static header_s* free_list_take_best (size_t size) {
+
+  // going to loop through the free blocks on free LL
+  // create a pointer and point it to free LL head
+  // create a pointer to store best fit, initially set to NULL
+  header_s* current = free_list_head;
+  header_s* best    = NULL;
+
+  // start looping thru free LL until we reach the end
+  while (current != NULL) {
+
+    // start fetching the next block's header while this one is examined
+    header_s* next = GET_NEXT(current);
+    PREFETCH(next, 0);
+
+    // if there is an allocated block on free LL, raise an error
+    if (current->allocated) {
+      ERROR("Allocated block on free list", (intptr_t)current);
+    }
+
+    // if there is no best block and current block is => requested size,
+    // or if current block is closer to requested size than best block
+    // then make current block the best block
+    if ( (best == NULL && size <= GET_SIZE(current)) ||
+	 (best != NULL && size <= GET_SIZE(current) && GET_SIZE(current) < GET_SIZE(best)) ) {
+      best = current;
+    }
+
+    // if best block is the exact requested size, then break the loop
+    // because we've found our prefect fit
+    if (best != NULL && GET_SIZE(best) == size) {
+      break;
+    }
+
+    // move down LL to check next block in free LL
+    current = next;
+    
+  }
+
+  // if we found a best block, remove it from the free LL by moving pointers
+  if (best != NULL) {
+
+    // if prev of best is NULL then it is the head of free LL
+    // so make next of best the new head of free LL
+    // else have prev of best skip over best with its next pointer
+    if (GET_PREV(best) == NULL) {
+      free_list_head   = GET_NEXT(best);
+    } else {
+      SET_NEXT(GET_PREV(best), GET_NEXT(best));
+    }
+    // if best is not the end of the free LL
+    // then make the next of best skip over best with its prev pointer
+    if (GET_NEXT(best) != NULL) {
+      SET_PREV(GET_NEXT(best), GET_PREV(best));
+    }
+#if defined (DECAY)
+    else {
+      free_list_tail = GET_PREV(best);
+    }
+    // the blocks after the scavenger's cursor have all been passed
+    if (best == decay_cursor) {
+      decay_cursor = GET_NEXT(best);
+    }
+#endif
+
+  }
+
+  return best;
+
+} // free_list_take_best ()
+// ==============================================================================
+#endif /* !SOA_FREE_INDEX */
+
+
+
+#if defined (SOA_FREE_INDEX)
+// ==============================================================================
+/**
+ * The portable search kernel:  a scalar scan of the free index table.
+ */
+static size_t soa_search_scalar (const uint64_t* sizes, size_t count, size_t size) {
+
+  size_t   best      = count;
+  uint64_t best_size = UINT64_MAX;
+  for (size_t i = 0; i < count; i += 1) {
+    if (size <= sizes[i] && sizes[i] < best_size) {
+      best      = i;
+      best_size = sizes[i];
+      if (best_size == size) {
+	break;
+      }
+    }
+  }
+  return best;
+
+} // soa_search_scalar ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Reduce the per-lane minimum sizes (and their slots) left by a vector kernel
+ * to a single best slot, then finish the search over the tail of the table
+ * that did not fill a whole vector.
+ */
+static size_t soa_search_finish (const uint64_t* sizes, size_t count, size_t size,
+				 const int64_t* lane_sizes, const int64_t* lane_slots,
+				 int lanes, size_t scanned) {
+
+  size_t  best      = count;
+  int64_t best_size = INT64_MAX;
+  for (int lane = 0; lane < lanes; lane += 1) {
+    if (lane_sizes[lane] < best_size ||
+	(lane_sizes[lane] == best_size && (size_t)lane_slots[lane] < best)) {
+      best      = lane_slots[lane];
+      best_size = lane_sizes[lane];
+    }
+  }
+  if (best_size == (int64_t)size) {
+    return best;
+  }
+
+  size_t tail = soa_search_scalar(sizes + scanned, count - scanned, size);
+  if (scanned + tail < count && (int64_t)sizes[scanned + tail] < best_size) {
+    best = scanned + tail;
+  }
+  return best;
+
+} // soa_search_finish ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The SSE4.2 search kernel, comparing two sizes at a time.  Free blocks are
+ * bounded by the heap, and `soa_take_best()` fails any request of 2^63 bytes
+ * or more before searching, so every size is below 2^63 and signed 64-bit
+ * comparisons order them correctly.
+ */
+__attribute__((target("sse4.2")))
+static size_t soa_search_sse4 (const uint64_t* sizes, size_t count, size_t size) {
+
+  const __m128i wanted  = _mm_set1_epi64x(size);
+  const __m128i too_big = _mm_set1_epi64x(INT64_MAX);
+  const __m128i step    = _mm_set1_epi64x(2);
+  const __m128i limit   = _mm_set1_epi64x(size - 1);
+  __m128i best_sizes    = too_big;
+  __m128i best_slots    = _mm_set1_epi64x(count);
+  __m128i slots         = _mm_set_epi64x(1, 0);
+
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+
+    // sizes that are too small become INT64_MAX, so they never win
+    __m128i current = _mm_loadu_si128((const __m128i*)(sizes + i));
+    __m128i fits    = _mm_cmpgt_epi64(current, limit);
+    __m128i cand    = _mm_blendv_epi8(too_big, current, fits);
+    __m128i better  = _mm_cmpgt_epi64(best_sizes, cand);
+    best_sizes      = _mm_blendv_epi8(best_sizes, cand,  better);
+    best_slots      = _mm_blendv_epi8(best_slots, slots, better);
+    slots           = _mm_add_epi64(slots, step);
+
+    // an exact fit cannot be beaten, so stop at the first one
+    if (_mm_movemask_epi8(_mm_cmpeq_epi64(current, wanted)) != 0) {
+      i += 2;
+      break;
+    }
+
+  }
+
+  int64_t lane_sizes[2];
+  int64_t lane_slots[2];
+  _mm_storeu_si128((__m128i*)lane_sizes, best_sizes);
+  _mm_storeu_si128((__m128i*)lane_slots, best_slots);
+  return soa_search_finish(sizes, count, size, lane_sizes, lane_slots, 2, i);
+
+} // soa_search_sse4 ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The AVX2 search kernel, comparing four sizes at a time, with signed 64-bit
+ * comparisons as the SSE4.2 kernel does.
+ */
+__attribute__((target("avx2")))
+static size_t soa_search_avx2 (const uint64_t* sizes, size_t count, size_t size) {
+
+  const __m256i wanted  = _mm256_set1_epi64x(size);
+  const __m256i too_big = _mm256_set1_epi64x(INT64_MAX);
+  const __m256i step    = _mm256_set1_epi64x(4);
+  const __m256i limit   = _mm256_set1_epi64x(size - 1);
+  __m256i best_sizes    = too_big;
+  __m256i best_slots    = _mm256_set1_epi64x(count);
+  __m256i slots         = _mm256_set_epi64x(3, 2, 1, 0);
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+
+    // sizes that are too small become INT64_MAX, so they never win
+    __m256i current = _mm256_loadu_si256((const __m256i*)(sizes + i));
+    __m256i fits    = _mm256_cmpgt_epi64(current, limit);
+    __m256i cand    = _mm256_blendv_epi8(too_big, current, fits);
+    __m256i better  = _mm256_cmpgt_epi64(best_sizes, cand);
+    best_sizes      = _mm256_blendv_epi8(best_sizes, cand,  better);
+    best_slots      = _mm256_blendv_epi8(best_slots, slots, better);
+    slots           = _mm256_add_epi64(slots, step);
+
+    // an exact fit cannot be beaten, so stop at the first one
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(current, wanted)) != 0) {
+      i += 4;
+      break;
+    }
+
+  }
+
+  int64_t lane_sizes[4];
+  int64_t lane_slots[4];
+  _mm256_storeu_si256((__m256i*)lane_sizes, best_sizes);
+  _mm256_storeu_si256((__m256i*)lane_slots, best_slots);
+  return soa_search_finish(sizes, count, size, lane_sizes, lane_slots, 4, i);
+
+} // soa_search_avx2 ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Choose the search kernel for this CPU, when the library is loaded.  A kernel
+ * may be forced with the `BF_SOA_KERNEL` environment variable (`avx2`, `sse4`,
+ * or `scalar`), which is mostly useful for benchmarking.
+ *
+ * \return The kernel.
+ */
+static soa_search_f soa_search_resolve () {
+
+  __builtin_cpu_init();
+  char  kernel[8];
+  char* forced = dispatch_getenv("BF_SOA_KERNEL", kernel, sizeof(kernel)) ? kernel : NULL;
+  if (forced != NULL && strcmp(forced, "scalar") == 0) {
+    return soa_search_scalar;
+  } else if (forced != NULL && strcmp(forced, "sse4") == 0 &&
+	     __builtin_cpu_supports("sse4.2")) {
+    return soa_search_sse4;
+  } else if (__builtin_cpu_supports("avx2") &&
+	     (forced == NULL || strcmp(forced, "avx2") == 0)) {
+    return soa_search_avx2;
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    return soa_search_sse4;
+  } else {
+    return soa_search_scalar;
+  }
+
+} // soa_search_resolve ()
+
+/** The search kernel chosen for this CPU. */
+static size_t soa_search (const uint64_t* sizes, size_t count, size_t size)
+  __attribute__((ifunc("soa_search_resolve")));
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Map the free index table.
+ */
+static void soa_init () {
+
+  size_t sizes_bytes   = SOA_INITIAL_CAPACITY * sizeof(uint64_t);
+  size_t headers_bytes = SOA_INITIAL_CAPACITY * sizeof(header_s*);
+  soa_sizes   = mmap(NULL, sizes_bytes, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  soa_headers = mmap(NULL, headers_bytes, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (soa_sizes == MAP_FAILED || soa_headers == MAP_FAILED) {
+    ERROR("Could not mmap() free index table");
+  }
+  soa_capacity = SOA_INITIAL_CAPACITY;
+
+} // soa_init ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Add a free block to the free index table, doubling the table if it is full.
+ *
+ * \param header_ptr The header of the block being freed.
+ */
+static void soa_insert (header_s* header_ptr) {
+
+  if (soa_count == soa_capacity) {
+    size_t new_capacity = soa_capacity * 2;
+    void*  new_sizes    = mremap(soa_sizes, soa_capacity * sizeof(uint64_t),
+				 new_capacity * sizeof(uint64_t), MREMAP_MAYMOVE);
+    void*  new_headers  = mremap(soa_headers, soa_capacity * sizeof(header_s*),
+				 new_capacity * sizeof(header_s*), MREMAP_MAYMOVE);
+    if (new_sizes == MAP_FAILED || new_headers == MAP_FAILED) {
+      ERROR("Could not grow free index table", soa_capacity);
+    }
+    soa_sizes    = new_sizes;
+    soa_headers  = new_headers;
+    soa_capacity = new_capacity;
+  }
+
+  SET_NEXT(header_ptr, NULL);
+  header_ptr->slot        = soa_count;
+  header_ptr->allocated   = false;
+  soa_sizes[soa_count]    = GET_SIZE(header_ptr);
+  soa_headers[soa_count]  = header_ptr;
+  soa_count              += 1;
+
+} // soa_insert ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Search the free index table for the _best fit_ for a request, and remove it
+ * by moving the last entry into its slot.
+ *
+ * \param size The number of bytes requested.
+ * \return The header of the best fitting free block, if one exists; `NULL`
+ *         otherwise.
+ */
+static header_s* soa_take_best (size_t size) {
+
+  // an empty table may not be mapped yet, nor a kernel chosen; and no free
+  // block fits a request of 2^63 bytes or more, which the vector kernels'
+  // signed comparisons would take as negative
+  if (soa_count == 0 || size > INT64_MAX) {
+    return NULL;
+  }
+  size_t slot = soa_search(soa_sizes, soa_count, size);
+  if (slot == soa_count) {
+    return NULL;
+  }
+
+  header_s* best = soa_headers[slot];
+  if (best->allocated) {
+    ERROR("Allocated block in free index", (intptr_t)best);
+  }
+
+  soa_count         -= 1;
+  soa_sizes[slot]    = soa_sizes[soa_count];
+  soa_headers[slot]  = soa_headers[soa_count];
+  soa_headers[slot]->slot = slot;
+  return best;
+
+} // soa_take_best ()
+// ==============================================================================
+#endif /* SOA_FREE_INDEX */
+
+
+
+#if defined (DECAY) || defined (MEMORY_PRESSURE)
+// ==============================================================================
+/** Return the time, in milliseconds, by the coarse (and cheapest) clock. */
+static uint64_t clock_ms () {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+} // clock_ms ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the whole pages of a free block, past its stamp, to the OS.  They
+ * read as zeroes when the block is reused.
+ *
+ * \param header_ptr The header of the free block.
+ * \return The number of bytes returned.
+ */
+static size_t purge_block (header_s* header_ptr) {
+
+  intptr_t block = (intptr_t)HEADER_TO_BLOCK(header_ptr);
+  intptr_t first = (block + sizeof(uint64_t) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  intptr_t last  = (block + GET_SIZE(header_ptr)) & ~(PAGE_SIZE - 1);
+  header_ptr->purged = true;
+  if (last <= first) {
+    return 0;
+  }
+  madvise((void*)first, last - first, MADV_DONTNEED);
+  return last - first;
+
+} // purge_block ()
+// ==============================================================================
+#endif /* DECAY || MEMORY_PRESSURE */
+
+
+
+#if defined (DECAY)
+
+
+// ==============================================================================
+/**
+ * Examine a bounded number of free blocks, and return the pages of those that
+ * have been free for longer than `DECAY_MS` to the OS.  The caller must hold the
+ * heap lock.
+ *
+ * \param now The current time.
+ */
+static void decay_scavenge (uint64_t now) {
+
+  size_t purged = 0;
+  for (int scanned = 0; scanned < DECAY_SCAN && purged < DECAY_PURGE_MAX; scanned += 1) {
+
+#if defined (SOA_FREE_INDEX)
+    // the table is not ordered by age, so sweep it round and round
+    if (soa_count == 0) {
+      return;
+    }
+    decay_slot = (decay_slot + 1) % soa_count;
+    header_s* header_ptr = soa_headers[decay_slot];
+    if (GET_SIZE(header_ptr) >= PURGE_MIN_SIZE && !header_ptr->purged &&
+	now - DECAY_STAMP(header_ptr) >= DECAY_MS) {
+      purged += purge_block(header_ptr);
+    }
+#else
+    // work from the tail, the longest free, up to the first block too young
+    header_s* header_ptr = (decay_cursor == NULL ? free_list_tail : GET_PREV(decay_cursor));
+    if (header_ptr == NULL) {
+      return;
+    }
+    if (GET_SIZE(header_ptr) >= PURGE_MIN_SIZE && !header_ptr->purged) {
+      if (now - DECAY_STAMP(header_ptr) < DECAY_MS) {
+	return;
+      }
+      purged += purge_block(header_ptr);
+    }
+    decay_cursor = header_ptr;
+#endif
+
+  }
+
+} // decay_scavenge ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check the clock, and run a scavenging pass if one is due.  The caller must
+ * hold the heap lock.
+ */
+static void decay_tick () {
+
+  uint64_t now = clock_ms();
+  if (now >= decay_next) {
+    decay_next = now + DECAY_INTERVAL_MS;
+    decay_scavenge(now);
+  }
+
+} // decay_tick ()
+// ==============================================================================
+#endif /* DECAY */
+
+
+
+// ==============================================================================
+/**
+ * Add a freed block to the general best-fit index:  the free list, or the free
+ * index table when built with `SOA_FREE_INDEX`.
+ *
+ * \param header_ptr The header of the block being freed.
+ */
+static void free_index_insert (header_s* header_ptr) {
+
+#if defined (DECAY) || defined (MEMORY_PRESSURE)
+  header_ptr->purged = false;
+#endif
+#if defined (DECAY)
+  // stamp blocks large enough to be scavenged with the time that they were freed
+  if (GET_SIZE(header_ptr) >= PURGE_MIN_SIZE) {
+    DECAY_STAMP(header_ptr) = clock_ms();
+  }
+#endif
+#if defined (MEMORY_PRESSURE)
+  // under pressure, keep no large free block resident
+  if (under_pressure && GET_SIZE(header_ptr) >= PURGE_MIN_SIZE) {
+    purge_block(header_ptr);
+  }
+#endif
+
+#if defined (SOA_FREE_INDEX)
+  soa_insert(header_ptr);
+#else
+  free_list_push(header_ptr);
+#endif
+
+} // free_index_insert ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Remove and return the best fitting block for a request from the general
+ * best-fit index.
+ *
+ * \param size The number of bytes requested.
+ * \return The header of the best fitting free block, if one exists; `NULL`
+ *         otherwise.
+ */
+static header_s* free_index_take_best (size_t size) {
+
+#if defined (SOA_FREE_INDEX)
+  return soa_take_best(size);
+#else
+  return free_list_take_best(size);
+#endif
+
+} // free_index_take_best ()
+// ==============================================================================
+
+
+
+#if FASTBIN_COUNT > 0
+// ==============================================================================
+/**
+ * Move every block cached on the fastbins into the best-fit index, so that
+ * they may satisfy requests of any size that they fit.  Called occasionally to
+ * keep the blocks held by the fastbins from fragmenting the heap.
+ */
+static void fastbin_consolidate () {
+
+  DEBUG("Consolidating fastbins", fastbin_blocks);
+  for (int i = 0; i < FASTBIN_COUNT; i += 1) {
+
+    // pop each block off of this fastbin and push it onto the free LL
+    header_s* current = fastbins[i];
+    while (current != NULL) {
+      header_s* next = GET_NEXT(current);
+      free_index_insert(current);
+      current = next;
+    }
+    fastbins[i]        = NULL;
+    fastbin_lengths[i] = 0;
+
+  }
+  fastbin_blocks = 0;
+
+} // fastbin_consolidate ()
+// ==============================================================================
+#endif /* FASTBIN_COUNT > 0 */
+
+
+
+#if defined (MEMORY_PRESSURE)
+// ==============================================================================
+/**
+ * Trim the heap hard:  fold the fastbins into the best-fit index, and return
+ * the whole pages of every free block to the OS.  The caller must hold the heap
+ * lock.
+ */
+static void pressure_trim () {
+
+#if FASTBIN_COUNT > 0
+  fastbin_consolidate();
+#endif
+
+  size_t purged = 0;
+#if defined (SOA_FREE_INDEX)
+  for (size_t i = 0; i < soa_count; i += 1) {
+    header_s* header_ptr = soa_headers[i];
+#else
+  for (header_s* header_ptr = free_list_head; header_ptr != NULL; header_ptr = GET_NEXT(header_ptr)) {
+#endif
+    if (GET_SIZE(header_ptr) >= PURGE_MIN_SIZE && !header_ptr->purged) {
+      purged += purge_block(header_ptr);
+    }
+  }
+#if defined (PREZERO)
+  // pages returned to the OS read as zeroes, so these stay known zero
+  for (header_s* header_ptr = prezero_list_head; header_ptr != NULL; header_ptr = GET_NEXT(header_ptr)) {
+    purged += purge_block(header_ptr);
+  }
+#endif
+  DEBUG("Trimmed under memory pressure", purged);
+
+} // pressure_trim ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check the clock, and if a sample is due, sample the cgroup's memory pressure,
+ * trimming the heap on entering pressure.  The caller must hold the heap lock.
+ */
+static void pressure_tick () {
+
+  uint64_t now = clock_ms();
+  if (now < pressure_next) {
+    return;
+  }
+  pressure_next = now + PRESSURE_INTERVAL_MS;
+
+  bool high = pressure_high();
+  if (high && !under_pressure) {
+    pressure_trim();
+  }
+  under_pressure = high;
+
+} // pressure_tick ()
+// ==============================================================================
+#endif /* MEMORY_PRESSURE */
+
+
+
+#if defined (PREZERO)
+// ==============================================================================
+/**
+ * Take the best fitting block from the known-zero list.  The caller must hold
+ * the heap lock.
+ *
+ * \param size The number of bytes requested.
+ * \return The header of the block, or `NULL` if none fits.
+ */
+static header_s* prezero_take_best (size_t size) {
+
+  // search for the best fit, keeping the block before it so that it can be
+  // unlinked
+  header_s* best      = NULL;
+  header_s* best_prev = NULL;
+  header_s* prev      = NULL;
+  for (header_s* current = prezero_list_head; current != NULL; current = GET_NEXT(current)) {
+    if (size <= GET_SIZE(current) &&
+	(best == NULL || GET_SIZE(current) < GET_SIZE(best))) {
+      best      = current;
+      best_prev = prev;
+    }
+    prev = current;
+  }
+
+  if (best != NULL) {
+    if (best_prev == NULL) {
+      prezero_list_head = GET_NEXT(best);
+    } else {
+      SET_NEXT(best_prev, GET_NEXT(best));
+    }
+    prezero_bytes -= GET_SIZE(best);
+  }
+  return best;
+
+} // prezero_take_best ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Move every block awaiting zeroing into the best-fit index as it is, for a
+ * request that nothing else fits.  The caller must hold the heap lock.
+ *
+ * \return `true` if any block was moved; `false` otherwise.
+ */
+static bool prezero_reclaim () {
+
+  if (prezero_pending_head == NULL) {
+    return false;
+  }
+  while (prezero_pending_head != NULL) {
+    header_s* header_ptr = prezero_pending_head;
+    prezero_pending_head = GET_NEXT(header_ptr);
+    prezero_bytes       -= GET_SIZE(header_ptr);
+    free_index_insert(header_ptr);
+  }
+  return true;
+
+} // prezero_reclaim ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The zeroing thread:  take each block awaiting zeroing, zero it without the
+ * heap lock (it is on no list meanwhile), and put it on the known-zero list.
+ *
+ * \param arg Unused.
+ * \return Never returns.
+ */
+static void* prezero_main (void* arg) {
+
+  LOCK();
+  while (true) {
+
+    while (prezero_pending_head == NULL) {
+      pthread_cond_wait(&prezero_cond, &heap_lock);
+    }
+    header_s* header_ptr = prezero_pending_head;
+    prezero_pending_head = GET_NEXT(header_ptr);
+    UNLOCK();
+
+    memset(HEADER_TO_BLOCK(header_ptr), 0, GET_SIZE(header_ptr));
+
+    LOCK();
+    header_ptr->zeroed = true;
+    SET_NEXT(header_ptr, prezero_list_head);
+    prezero_list_head  = header_ptr;
+
+  }
+  return NULL;
+
+} // prezero_main ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** After a `fork()`, the child has no zeroing thread until it starts its own. */
+static void prezero_atfork_child () {
+
+  prezero_started = false;
+
+} // prezero_atfork_child ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Start the zeroing thread, if it has not been started.  Called without the
+ * heap lock, since creating a thread may allocate.  The thread blocks every
+ * signal, so that the program's handlers never run on it.
+ */
+static void prezero_start () {
+
+  if (__atomic_exchange_n(&prezero_started, true, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+
+  static bool registered = false;
+  if (!registered) {
+    registered = true;
+    pthread_atfork(NULL, NULL, prezero_atfork_child);
+  }
+
+  sigset_t all_signals;
+  sigset_t old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, prezero_main, NULL) == 0) {
+    pthread_detach(thread);
+  }
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+} // prezero_start ()
+// ==============================================================================
+#endif /* PREZERO */
+
+
+
+#if FASTBIN_COUNT > 0
+// ==============================================================================
+/**
+ * Determine whether any fastbin holds a block large enough for a request.
+ *
+ * \param size The number of bytes requested.
+ * \return `true` if some fastbin could satisfy the request; `false` otherwise.
+ */
+static bool fastbin_has_fit (size_t size) {
+
+  if (fastbin_blocks == 0) {
+    return false;
+  }
+  for (size_t i = (size <= FASTBIN_MAX_SIZE ? FASTBIN_INDEX(size) : FASTBIN_COUNT);
+       i < FASTBIN_COUNT;
+       i += 1) {
+    if (fastbins[i] != NULL) {
+      return true;
+    }
+  }
+  return false;
+
+} // fastbin_has_fit ()
+// ==============================================================================
+#endif /* FASTBIN_COUNT > 0 */
+
+
+// ==============================================================================
+/**
+ * Cover the gap before a newly bumped header with a padding header, so that
+ * the heap can be walked from header to header.  Each header follows the
+ * previous block's end, rounded up to a double word, unless such a padding
+ * header covers the space between them.
+ *
+ * \param pad_addr    The end of the previous block.
+ * \param header_addr The new header, at the end of the gap.
+ */
+static void pad_gap (intptr_t pad_addr, intptr_t header_addr) {
+
+  pad_addr = ROUND_UP_16(pad_addr);
+  if (header_addr > pad_addr) {
+    assert(header_addr - pad_addr >= (intptr_t)sizeof(header_s));
+    header_s* pad_ptr = (header_s*)pad_addr;
+    SET_SIZE(pad_ptr, header_addr - pad_addr - sizeof(header_s));
+    pad_ptr->allocated = false;
+    pad_ptr->cacheline = false;
+    pad_ptr->padding   = true;
+  }
+
+} // pad_gap ()
+// ==============================================================================
+
+
+
+#if defined (PERSISTENT_HEAP)
+// ==============================================================================
+/**
+ * Map the heap from the file named by `BF_HEAP_FILE`, at the address where it
+ * was last mapped if that is free, or else anywhere.  Without the variable, or
+ * if another process owns the file, map an anonymous heap, which behaves the
+ * same but does not persist.
+ *
+ * \return The start of the heap.
+ */
+static void* persist_map () {
+
+  const char* path = getenv(HEAP_FILE_ENV);
+  if (path != NULL) {
+    heap_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (heap_fd < 0) {
+      ERROR("Could not open heap file");
+    }
+    if (flock(heap_fd, LOCK_EX | LOCK_NB) != 0) {
+      DEBUG("Heap file is in use");
+      close(heap_fd);
+      heap_fd = -1;
+    }
+  }
+  if (heap_fd < 0) {
+    void* heap = mmap(NULL, HEAP_SIZE, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (heap == MAP_FAILED) {
+      ERROR("Could not mmap() heap region");
+    }
+    return heap;
+  }
+
+  // refuse, rather than truncate, a file that is not a heap of this layout
+  superblock_s image;
+  void*        hint = NULL;
+  ssize_t      got  = pread(heap_fd, &image, sizeof(image), 0);
+  if (got == sizeof(image) && image.magic != 0) {
+    if (image.magic       != SUPERBLOCK_MAGIC   ||
+	image.version     != SUPERBLOCK_VERSION ||
+	image.header_size != sizeof(header_s)   ||
+	image.heap_size   != HEAP_SIZE) {
+      ERROR("Heap file does not match this allocator");
+    }
+    hint = (void*)image.base;
+  } else if (got != 0 && lseek(heap_fd, 0, SEEK_END) != 0) {
+    ERROR("Heap file does not match this allocator");
+  }
+  if (ftruncate(heap_fd, HEAP_SIZE) != 0) {
+    ERROR("Could not size heap file");
+  }
+
+  void* heap = MAP_FAILED;
+  if (hint != NULL) {
+    heap = mmap(hint, HEAP_SIZE, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_FIXED_NOREPLACE, heap_fd, 0);
+  }
+  if (heap == MAP_FAILED) {
+    heap = mmap(NULL, HEAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, heap_fd, 0);
+  }
+  if (heap == MAP_FAILED) {
+    ERROR("Could not mmap() heap file");
+  }
+  return heap;
+
+} // persist_map ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Save the allocator's state into the superblock.  The caller must hold the
+ * heap lock.
+ */
+static void persist_save () {
+
+#if FASTBIN_COUNT > 0
+  fastbin_consolidate();
+#endif
+  superblock->free_offset         = free_addr - start_addr;
+  superblock->free_list_head      = LINK(free_list_head);
+  superblock->allocated_list_head = LINK(allocated_list_head);
+  superblock->cacheline_list_head = LINK(cacheline_list_head);
+#if defined (CACHE_COLORING)
+  superblock->next_color          = next_color;
+#endif
+
+} // persist_save ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Load the allocator's state from the superblock of a cleanly closed heap.
+ */
+static void persist_load () {
+
+  free_addr           = start_addr + superblock->free_offset;
+  free_list_head      = UNLINK(superblock->free_list_head);
+  allocated_list_head = UNLINK(superblock->allocated_list_head);
+  cacheline_list_head = UNLINK(superblock->cacheline_list_head);
+#if defined (CACHE_COLORING)
+  next_color          = superblock->next_color;
+#endif
+
+} // persist_load ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Rebuild the allocator's state for a heap that was not closed cleanly, by
+ * walking its headers in address order.  The walk ends at the first header
+ * that is zero (never written) or that would overrun the heap (torn), which
+ * becomes the new bump pointer.
+ */
+static void persist_recover () {
+
+  DEBUG("Recovering heap");
+  free_list_head      = NULL;
+  allocated_list_head = NULL;
+  cacheline_list_head = NULL;
+
+  intptr_t addr = start_addr + SUPERBLOCK_SIZE;
+  while (addr + (intptr_t)sizeof(header_s) <= end_addr) {
+
+    header_s* header_ptr = (header_s*)addr;
+    size_t    size       = GET_SIZE(header_ptr);
+    intptr_t  next_addr  = addr + sizeof(header_s) + size;
+    if ((size == 0 && !header_ptr->padding) || next_addr > end_addr) {
+      break;
+    }
+
+    if (header_ptr->padding) {
+      // nothing to list
+    } else if (header_ptr->allocated) {
+      allocated_list_push(header_ptr);
+    } else if (header_ptr->cacheline) {
+      SET_NEXT(header_ptr, cacheline_list_head);
+      SET_PREV(header_ptr, NULL);
+      cacheline_list_head = header_ptr;
+    } else {
+      free_index_insert(header_ptr);
+    }
+    addr = next_addr;
+
+  }
+  free_addr = addr;
+
+} // persist_recover ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Mark the superblock dirty, and make that durable before the heap changes.
+ */
+static void persist_touch () {
+
+  superblock->state = HEAP_DIRTY;
+  if (heap_fd >= 0) {
+    msync(superblock, SUPERBLOCK_SIZE, MS_SYNC);
+  }
+
+} // persist_touch ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Give a forked child a private copy of the heap, so that it neither changes
+ * nor closes its parent's heap file.
+ */
+static void persist_child () {
+
+  if (heap_fd >= 0) {
+    if (mmap((void*)start_addr, end_addr - start_addr, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_FIXED, heap_fd, 0) == MAP_FAILED) {
+      ERROR("Could not mmap() heap file");
+    }
+    close(heap_fd);
+    heap_fd = -1;
+  }
+
+} // persist_child ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Open the heap's superblock:  format a new heap, load the state of a clean
+ * one, or recover a dirty one.  Then mark it dirty, durably, before use.
+ */
+static void persist_open () {
+
+  superblock = (superblock_s*)start_addr;
+
+  if (superblock->magic != SUPERBLOCK_MAGIC) {
+    superblock->magic       = SUPERBLOCK_MAGIC;
+    superblock->version     = SUPERBLOCK_VERSION;
+    superblock->header_size = sizeof(header_s);
+    superblock->heap_size   = HEAP_SIZE;
+  } else if (superblock->state == HEAP_CLEAN) {
+    persist_load();
+  } else {
+    persist_recover();
+  }
+
+  superblock->base = start_addr;
+  persist_touch();
+  pthread_atfork(NULL, NULL, persist_child);
+
+} // persist_open ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Close the heap cleanly at exit:  save the state, sync the heap, and only
+ * then mark the superblock clean.
+ */
+static void __attribute__((destructor)) persist_close () {
+
+  if (heap_fd < 0) {
+    return;
+  }
+  LOCK();
+  persist_save();
+  msync((void*)start_addr, free_addr - start_addr, MS_SYNC);
+  superblock->state = HEAP_CLEAN;
+  msync(superblock, SUPERBLOCK_SIZE, MS_SYNC);
+  UNLOCK();
+
+} // persist_close ()
+// ==============================================================================
+#endif /* PERSISTENT_HEAP */
+
+
+
+// ==============================================================================
+/**
+ * The initialization method.  If this is the first use of the heap, initialize it.
+ */
+
+void init () {
+
+  // Only do anything if there is no heap region (i.e., first time called).
+  if (start_addr == 0) {
+
+    DEBUG("Trying to initialize");
+    
+    // Allocate virtual address space in which the heap will reside. Make it
+    // un-shared and not backed by any file (_anonymous_ space).  A failure to
+    // map this space is fatal.
+#if defined (PERSISTENT_HEAP)
+    void* heap = persist_map();
+#elif defined (HYBRID_MEDIUM_TIER)
+    void* heap = hybrid_reserve(ALLOC_TIER_MEDIUM);
+#else
+    void* heap = mmap(NULL,
+		      HEAP_SIZE,
+		      PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS,
+		      -1,
+		      0);
+    if (heap == MAP_FAILED) {
+      ERROR("Could not mmap() heap region");
+    }
+#endif
+
+    // Hold onto the boundaries of the heap as a whole.
+    start_addr = (intptr_t)heap;
+    end_addr   = start_addr + HEAP_SIZE;
+    free_addr  = start_addr;
+#if defined (PERSISTENT_HEAP)
+    free_addr += SUPERBLOCK_SIZE;
+#endif
+
+#if defined (SITE_SEGREGATION)
+    // Set aside the top of the heap for the nursery.
+    end_addr           -= NURSERY_SIZE;
+    nursery_start_addr  = end_addr;
+    nursery_free_addr   = end_addr;
+#endif
+
+#if defined (SOA_FREE_INDEX)
+    // Map the free index table apart from the heap, and pick the fastest
+    // search kernel that this CPU supports.
+    soa_init();
+#endif
+
+#if defined (PERSISTENT_HEAP)
+    // Resume the heap's saved state, if any.
+    persist_open();
+#endif
+
+#if defined (MEMORY_PRESSURE)
+    // Find the cgroup whose memory pressure to watch.
+    pressure_init();
+#endif
+
+    // DEBUG: Emit a message to indicate that this allocator is being called.
+    DEBUG("bf-alloc initialized");
+
+  }
+
+} // init ()
+// ==============================================================================
+
+
+
+#if !defined (HYBRID_MEDIUM_TIER)
+// ==============================================================================
+/**
+ * Initialize the heap when the library is loaded, before the program's own
+ * code runs, so that allocation need not check for it.  (As a tier of the
+ * hybrid allocator, the heap is initialized by that allocator instead.)
+ */
+static void __attribute__((constructor)) init_at_load () {
+
+  LOCK();
+  init();
+  UNLOCK();
+
+} // init_at_load ()
+// ==============================================================================
+#endif
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block from the bootstrap arena.  Its header is marked free, so
+ * that `free()` takes the slow path on which it is recognized and ignored.
+ * The caller must hold the heap lock.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, or `NULL` if the arena is full.
+ */
+static void* bootstrap_malloc (size_t size) {
+
+  size_t header_offset = ROUND_UP_16(bootstrap_used);
+  if (size > BOOTSTRAP_SIZE ||
+      header_offset + sizeof(header_s) + size > BOOTSTRAP_SIZE) {
+    return NULL;
+  }
+  bootstrap_used = header_offset + sizeof(header_s) + size;
+
+  header_s* header_ptr = (header_s*)(bootstrap_arena + header_offset);
+  SET_SIZE(header_ptr, size);
+  header_ptr->allocated = false;
+  header_ptr->cacheline = false;
+  header_ptr->padding   = false;
+#if defined (SITE_SEGREGATION)
+  header_ptr->nursery   = false;
+  header_ptr->sampled   = false;
+#endif
+#if defined (PREZERO)
+  header_ptr->zeroed    = true;
+#endif
+  return HEADER_TO_BLOCK(header_ptr);
+
+} // bootstrap_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.  Specifically, search the
+ * free list, choosing the _best fit_.  If no such block is available, expand
+ * into the heap region via _pointer bumping_.  The caller must hold the heap
+ * lock.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+static void* malloc_unlocked (size_t size) {
+
+  // if the requested block size is 0, return NULL because there is nothing to do
+  if (size == 0) {
+    return NULL;
+  }
+  PERSIST_TOUCH();
+
+#if FASTBIN_COUNT > 0
+  // small requests are first tried against the fastbin of their exact size,
+  // which needs no search at all
+  if (size <= FASTBIN_MAX_SIZE) {
+    size_t index = FASTBIN_INDEX(size);
+    header_s* header_ptr = fastbins[index];
+    if (header_ptr != NULL) {
+      fastbins[index]         = GET_NEXT(header_ptr);
+      PREFETCH(fastbins[index], 0);
+      fastbin_lengths[index] -= 1;
+      fastbin_blocks         -= 1;
+      allocated_list_push(header_ptr);
+      return HEADER_TO_BLOCK(header_ptr);
+    }
+  }
+#endif
+
+  // search the free LL for the best fitting block
+  header_s* best = free_index_take_best(size);
+
+#if FASTBIN_COUNT > 0
+  // before growing the heap, fold the fastbins into the free LL if any of
+  // their blocks could serve this request, and search again
+  if (best == NULL && fastbin_has_fit(size)) {
+    fastbin_consolidate();
+    best = free_index_take_best(size);
+  }
+#endif
+
+#if defined (PREZERO)
+  // before growing the heap, use a known-zero block, or else one that is
+  // still awaiting zeroing
+  if (best == NULL) {
+    best = prezero_take_best(size);
+  }
+  if (best == NULL && prezero_reclaim()) {
+    best = free_index_take_best(size);
+  }
+#endif
+
+  // create a pointer to eventually hold block pointer to be returned
+  // intially set to NULL
+  void* new_block_ptr = NULL;
+
+  // if we found a best block, allocate it
+  // 1) add it to the allocated LL
+  // 2) create a block pointer from best pointer
+  // 3) header pointer is best pointer and is stored in allocated LL
+  if (best != NULL) {
+
+    // add header to allocated list
+    allocated_list_push(best);
+
+    // set block pointer to be address after header--which is the pointer best
+    new_block_ptr       = HEADER_TO_BLOCK(best);
+    
+  } else {
+
+    // pad the address for double word alignment
+    // since the header is a multiple of 16 bytes, if we align for the header
+    // then the block will be double word aligned as well, and the heap can be
+    // walked by rounding each block's end up likewise
+    intptr_t header_addr = ROUND_UP_16(free_addr);
+
+#if defined (CACHE_COLORING)
+    // offset large blocks by a rotating number of cache lines, so that a run
+    // of same-sized blocks does not repeat the same cache set mapping
+    intptr_t pad_addr = header_addr;
+    if (size >= CACHE_COLOR_MIN_SIZE) {
+      header_addr += (next_color % CACHE_COLORS) * CACHE_LINE_SIZE;
+    }
+#endif
+
+    // create a pointer for the header at the next free address space
+    header_s* header_ptr = (header_s*)header_addr;
+    // create a pointer for the block immediately after the header
+    new_block_ptr = HEADER_TO_BLOCK(header_ptr);
+
+    // if new free_addr would surpass the end of the memory space (compared
+    // without adding, which a huge size would overflow)
+    // then return NULL since there isn't enough space to allocate
+    // else update free_addr
+    if ((intptr_t)new_block_ptr > end_addr ||
+	size > (size_t)(end_addr - (intptr_t)new_block_ptr)) {
+
+      // before the heap is initialized, its bounds are 0:  serve the request
+      // from the bootstrap arena, or else initialize the heap and try again
+      if (start_addr == 0) {
+	new_block_ptr = bootstrap_malloc(size);
+	if (new_block_ptr == NULL) {
+	  init();
+	  new_block_ptr = malloc_unlocked(size);
+	}
+	return new_block_ptr;
+      }
+      return NULL;
+
+    } else {
+
+#if defined (CACHE_COLORING)
+      if (size >= CACHE_COLOR_MIN_SIZE) {
+	next_color += 1;
+	pad_gap(pad_addr, header_addr);
+      }
+#endif
+      free_addr = (intptr_t)new_block_ptr + size;
+
+    }
+
+    // store the size of the block in the header and add it to the allocated LL
+    SET_SIZE(header_ptr, size);
+    header_ptr->cacheline = false;
+    header_ptr->padding   = false;
+#if defined (SITE_SEGREGATION)
+    header_ptr->nursery   = false;
+#endif
+#if defined (PREZERO)
+    // fresh heap space has never been written
+    header_ptr->zeroed    = true;
+#endif
+    allocated_list_push(header_ptr);
+
+  }
+
+  // return pointer to block
+  return new_block_ptr;
+
+} // malloc_unlocked ()
+// ==============================================================================
+
+
+#if defined (SITE_SEGREGATION)
+// ==============================================================================
+/**
+ * Find the site table entry for a call site, claiming it if another site held
+ * it (the table is a cache, so collisions simply forget the older site).
+ *
+ * \param site The call site (return address) of an allocation.
+ * \return The index of the site's entry.
+ */
+static uint16_t site_lookup (void* site) {
+
+  uint16_t index = SITE_HASH(site) & (SITE_TABLE_SIZE - 1);
+  if (site_table[index].site != site) {
+    site_table[index].site     = site;
+    site_table[index].samples  = 0;
+    site_table[index].lifetime = 0;
+  }
+  return index;
+
+} // site_lookup ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Fold the lifetime of a sampled block, now being freed, into the moving
+ * average of its call site.
+ *
+ * \param header_ptr The header of the sampled block.
+ */
+static void site_learn (header_s* header_ptr) {
+
+  site_entry_s* entry    = &site_table[header_ptr->site];
+  uint32_t      lifetime = alloc_clock - header_ptr->birth;
+  if (entry->samples == 0) {
+    entry->lifetime = lifetime;
+  } else {
+    entry->lifetime += ((int64_t)lifetime - (int64_t)entry->lifetime) / 8;
+  }
+  entry->samples += 1;
+
+} // site_learn ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block in the nursery, reusing the first free nursery block that
+ * fits or else bumping the nursery's pointer.
+ *
+ * \param size The number of bytes to allocate.
+ * \return The header of the allocated block, or `NULL` if the nursery is full.
+ */
+static header_s* nursery_malloc (size_t size) {
+
+  // take the first fit from the nursery free LL
+  header_s* prev = NULL;
+  header_s* current = nursery_list_head;
+  while (current != NULL && GET_SIZE(current) < size) {
+    prev    = current;
+    current = GET_NEXT(current);
+  }
+  if (current != NULL) {
+    if (prev == NULL) {
+      nursery_list_head = GET_NEXT(current);
+    } else {
+      SET_NEXT(prev, GET_NEXT(current));
+    }
+  } else {
+
+    // nothing fits, so bump (padding for double word alignment as the heap does)
+    intptr_t header_addr   = ROUND_UP_16(nursery_free_addr);
+    intptr_t new_free_addr = header_addr + sizeof(header_s) + size;
+    if (new_free_addr > nursery_start_addr + NURSERY_SIZE) {
+      return NULL;
+    }
+    nursery_free_addr = new_free_addr;
+    current           = (header_s*)header_addr;
+    SET_SIZE(current, size);
+    current->cacheline = false;
+    current->padding   = false;
+    current->nursery   = true;
+#if defined (PREZERO)
+    current->zeroed    = false;
+#endif
+
+  }
+
+  nursery_live += 1;
+  return current;
+
+} // nursery_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return a block to the nursery.  When the last nursery block is freed, the
+ * whole nursery is reset to empty, so that it is reused from its start.
+ *
+ * \param header_ptr The header of the block being freed.
+ */
+static void nursery_free (header_s* header_ptr) {
+
+  header_ptr->allocated = false;
+  nursery_live -= 1;
+  if (nursery_live == 0) {
+    nursery_list_head  = NULL;
+    nursery_free_addr  = nursery_start_addr;
+    nursery_resets    += 1;
+    return;
+  }
+  SET_NEXT(header_ptr, nursery_list_head);
+  SET_PREV(header_ptr, NULL);
+  nursery_list_head = header_ptr;
+
+} // nursery_free ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes on behalf of a call site:  in the nursery if the site's
+ * blocks are known to be short-lived, or else in the main heap.  Sample the
+ * lifetimes of some blocks to keep learning.  The caller must hold the heap
+ * lock.
+ *
+ * \param size The number of bytes to allocate.
+ * \param site The call site (return address) of the allocation.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+static void* site_malloc_unlocked (size_t size, void* site) {
+
+  if (size == 0) {
+    return NULL;
+  }
+
+  alloc_clock += 1;
+  uint16_t      index = site_lookup(site);
+  site_entry_s* entry = &site_table[index];
+
+  // place the block by its site's lifetime, falling back on the main heap
+  // (which, before the heap is initialized, serves the bootstrap arena:  no
+  // site has samples then, since bootstrap blocks are never learned from)
+  header_s* header_ptr = NULL;
+  if (entry->samples >= SITE_MIN_SAMPLES && entry->lifetime < SHORT_LIFETIME) {
+    header_ptr = nursery_malloc(size);
+    if (header_ptr != NULL) {
+      allocated_list_push(header_ptr);
+    }
+  }
+  if (header_ptr == NULL) {
+    void* new_block_ptr = malloc_unlocked(size);
+    if (new_block_ptr == NULL) {
+      return NULL;
+    }
+    header_ptr = BLOCK_TO_HEADER(new_block_ptr);
+  }
+
+  // sample this block's lifetime?
+  header_ptr->sampled = (alloc_clock % SITE_SAMPLE_RATE == 0);
+  if (header_ptr->sampled) {
+    header_ptr->site  = index;
+    header_ptr->birth = alloc_clock;
+  }
+
+  return HEADER_TO_BLOCK(header_ptr);
+
+} // site_malloc_unlocked ()
+// ==============================================================================
+#endif /* SITE_SEGREGATION */
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap.  Add the given block (if any) to the
+ * free list.  The caller must hold the heap lock.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+static void free_unlocked (void* ptr) {
+
+  // if pointer is NULL there is nothing to free, jsut return
+  if (ptr == NULL) {
+    return;
+  }
+
+  // get pointer to block from the header
+  header_s* header_ptr = BLOCK_TO_HEADER(ptr);
+
+  // if block is not allocated then it is already free, raise an error, unless
+  // it is from the bootstrap arena, which is never reused
+  if (!header_ptr->allocated) {
+    if (IS_BOOTSTRAP(ptr)) {
+      return;
+    }
+    ERROR("Double-free: ", (intptr_t)header_ptr);
+  }
+  PERSIST_TOUCH();
+#if defined (PREZERO)
+  header_ptr->zeroed = false;
+#endif
+
+#if defined (SITE_SEGREGATION)
+  // learn from a sampled block's lifetime
+  if (header_ptr->sampled) {
+    site_learn(header_ptr);
+  }
+#endif
+
+  // remove header from allocated LL
+  // if header is not the end of the allocated LL, adjust prev pointer of next
+  if ( GET_NEXT(header_ptr) != NULL) {
+    SET_PREV(GET_NEXT(header_ptr), GET_PREV(header_ptr));
+  }
+
+  // if header is not head of allocated LL, adjust next pointer of prev
+  // else make next pointer the head of allocated LL
+  if ( GET_PREV(header_ptr) != NULL ){
+    SET_NEXT(GET_PREV(header_ptr), GET_NEXT(header_ptr));
+  } else {
+    allocated_list_head = GET_NEXT(header_ptr);
+  }
+
+#if defined (SITE_SEGREGATION)
+  // nursery blocks are reused only by the nursery
+  if (header_ptr->nursery) {
+    nursery_free(header_ptr);
+    return;
+  }
+#endif
+
+  // blocks allocated by malloc_cacheline() are line aligned, so keep them
+  // apart for reuse by that function alone
+  if (header_ptr->cacheline) {
+    SET_NEXT(header_ptr, cacheline_list_head);
+    SET_PREV(header_ptr, NULL);
+    header_ptr->allocated = false;
+    cacheline_list_head   = header_ptr;
+    return;
+  }
+  
+#if FASTBIN_COUNT > 0
+  // small blocks are cached on the fastbin for their 16-byte size step, unless
+  // that fastbin is full, in which case they overflow onto the free LL.  Every
+  // block is followed by padding to the next double word, so record that
+  // rounded size as its usable size.
+  if (GET_SIZE(header_ptr) <= FASTBIN_MAX_SIZE) {
+    size_t index = FASTBIN_INDEX(GET_SIZE(header_ptr));
+    if (fastbin_lengths[index] < FASTBIN_DEPTH) {
+      SET_SIZE(header_ptr, ROUND_UP_16(GET_SIZE(header_ptr)));
+      SET_NEXT(header_ptr, fastbins[index]);
+      SET_PREV(header_ptr, NULL);
+      header_ptr->allocated  = false;
+      fastbins[index]        = header_ptr;
+      fastbin_lengths[index] += 1;
+      fastbin_blocks         += 1;
+      return;
+    }
+  }
+#endif
+
+#if defined (PREZERO)
+  // large blocks are zeroed ahead of time, up to a limit, by the zeroing thread
+  if (GET_SIZE(header_ptr) >= PREZERO_MIN_SIZE &&
+      prezero_bytes + GET_SIZE(header_ptr) <= PREZERO_MAX_BYTES) {
+    header_ptr->allocated = false;
+    SET_NEXT(header_ptr, prezero_pending_head);
+    prezero_pending_head  = header_ptr;
+    prezero_bytes        += GET_SIZE(header_ptr);
+    pthread_cond_signal(&prezero_cond);
+    return;
+  }
+#endif
+
+  // add header to the free LL (or free index table)
+  free_index_insert(header_ptr);
+
+} // free_unlocked ()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Stop allocating from this thread's current ephemeral chunk, so that it may
+ * be reused once its live blocks are freed.
+ */
+static void ephemeral_retire () {
+
+  if (my_chunk != NULL) {
+    my_chunk->retired = true;
+    __atomic_add_fetch(&my_chunk->live, my_count, __ATOMIC_ACQ_REL);
+    my_chunk = NULL;
+    my_bump  = 0;
+    my_limit = 0;
+    my_count = 0;
+  }
+
+} // ephemeral_retire ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Is an ephemeral chunk ready for reuse, with all of its blocks freed?
+ *
+ * \param chunk The chunk to check.
+ * \return Whether the chunk may be reused.
+ */
+static bool ephemeral_reusable (ephemeral_chunk_s* chunk) {
+
+  return chunk->retired && __atomic_load_n(&chunk->live, __ATOMIC_ACQUIRE) == 0;
+
+} // ephemeral_reusable ()
+// ==============================================================================
+
+
+
+#if defined (THREAD_SAFE)
+// ==============================================================================
+/**
+ * Give up an exiting thread's ephemeral chunks, for other threads to adopt once
+ * their blocks are freed.
+ *
+ * \param unused The thread's key value.
+ */
+static void ephemeral_thread_exit (void* unused) {
+
+  ephemeral_retire();
+  if (my_chunks == NULL) {
+    return;
+  }
+  ephemeral_chunk_s* last = my_chunks;
+  while (last->next != NULL) {
+    last = last->next;
+  }
+  LOCK();
+  last->next    = orphan_chunks;
+  orphan_chunks = my_chunks;
+  UNLOCK();
+  my_chunks = NULL;
+
+} // ephemeral_thread_exit ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Create the key that gives up ephemeral chunks when their threads exit. */
+static void ephemeral_key_create () {
+
+  pthread_key_create(&ephemeral_key, ephemeral_thread_exit);
+
+} // ephemeral_key_create ()
+// ==============================================================================
+#endif /* THREAD_SAFE */
+
+
+
+// ==============================================================================
+/**
+ * Map the region from which ephemeral chunks are carved, aligned to a chunk,
+ * unless it is already mapped.  It is mapped apart from the heap, on the first
+ * call to `malloc_ephemeral()`, so that programs that never call it keep the
+ * whole heap.  (Ephemeral chunks never persist, so with `PERSISTENT_HEAP` the
+ * region is anonymous memory still.)  The caller must hold the heap lock.
+ *
+ * \return `true` if the region is mapped; `false` if it could not be.
+ */
+static bool ephemeral_reserve () {
+
+  if (ephemeral_end_addr != 0) {
+    return true;
+  }
+  void* region = mmap(NULL, EPHEMERAL_REGION_SIZE + EPHEMERAL_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    return false;
+  }
+  intptr_t start = ((intptr_t)region + EPHEMERAL_CHUNK_SIZE - 1) & ~(intptr_t)(EPHEMERAL_CHUNK_SIZE - 1);
+  ephemeral_start_addr = start;
+  ephemeral_free_addr  = start;
+  __atomic_store_n(&ephemeral_end_addr, start + EPHEMERAL_REGION_SIZE, __ATOMIC_RELEASE);
+  return true;
+
+} // ephemeral_reserve ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find a chunk for this thread to allocate from:  one of its own whose blocks
+ * are all freed, else one left by an exited thread, else a newly carved one.
+ *
+ * \return The chunk, or `NULL` if the ephemeral region is exhausted.
+ */
+static ephemeral_chunk_s* ephemeral_find_chunk () {
+
+  for (ephemeral_chunk_s* chunk = my_chunks; chunk != NULL; chunk = chunk->next) {
+    if (ephemeral_reusable(chunk)) {
+      return chunk;
+    }
+  }
+
+  ephemeral_chunk_s* chunk = NULL;
+#if defined (THREAD_SAFE)
+  LOCK();
+  ephemeral_chunk_s** link = &orphan_chunks;
+  while (*link != NULL && !ephemeral_reusable(*link)) {
+    link = &(*link)->next;
+  }
+  if (*link != NULL) {
+    chunk = *link;
+    *link = chunk->next;
+  }
+  UNLOCK();
+#endif
+
+  if (chunk == NULL) {
+    LOCK();
+    bool reserved = ephemeral_reserve();
+    UNLOCK();
+    if (!reserved) {
+      return NULL;
+    }
+    intptr_t chunk_addr = __atomic_fetch_add(&ephemeral_free_addr, EPHEMERAL_CHUNK_SIZE,
+					     __ATOMIC_RELAXED);
+    if (chunk_addr >= ephemeral_end_addr) {
+      return NULL;
+    }
+    chunk = (ephemeral_chunk_s*)chunk_addr;
+#if defined (THREAD_SAFE)
+    // register for the destructor with this thread's first chunk
+    if (my_chunks == NULL) {
+      pthread_once(&ephemeral_key_once, ephemeral_key_create);
+      pthread_setspecific(ephemeral_key, chunk);
+    }
+#endif
+  }
+
+  chunk->next = my_chunks;
+  my_chunks   = chunk;
+  return chunk;
+
+} // ephemeral_find_chunk ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The slow path of `malloc_ephemeral()`:  retire the current chunk and start
+ * another.
+ *
+ * \param size The number of bytes to allocate, a multiple of 16.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+static __attribute__((noinline)) void* ephemeral_refill (size_t size) {
+
+  if (size > EPHEMERAL_MAX_SIZE) {
+    return NULL;
+  }
+
+  ephemeral_retire();
+  ephemeral_chunk_s* chunk = ephemeral_find_chunk();
+  if (chunk == NULL) {
+    return NULL;
+  }
+  chunk->retired = false;
+  chunk->live    = 0;
+
+  // the first block starts on the line after the chunk's header
+  intptr_t block_addr = (intptr_t)chunk + CACHE_LINE_SIZE;
+  my_chunk = chunk;
+  my_bump  = block_addr + size;
+  my_limit = (intptr_t)chunk + EPHEMERAL_CHUNK_SIZE;
+  my_count = 1;
+  return (void*)block_addr;
+
+} // ephemeral_refill ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Free an ephemeral block.  A block in this thread's current chunk is only
+ * counted down, and if that leaves the chunk empty, the chunk is bumped from
+ * its start again.  A block in any other chunk is counted down atomically.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+static void ephemeral_free (void* ptr) {
+
+  ephemeral_chunk_s* chunk = EPHEMERAL_CHUNK(ptr);
+  if (chunk == my_chunk) {
+    my_count -= 1;
+    if (my_count + __atomic_load_n(&chunk->live, __ATOMIC_ACQUIRE) == 0) {
+      chunk->live = 0;
+      my_count    = 0;
+      my_bump     = (intptr_t)chunk + CACHE_LINE_SIZE;
+    }
+  } else {
+    __atomic_sub_fetch(&chunk->live, 1, __ATOMIC_ACQ_REL);
+  }
+
+} // ephemeral_free ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space on behalf of a call site, taking the heap
+ * lock.  The site matters only with `SITE_SEGREGATION`.
+ *
+ * \param size The number of bytes to allocate.
+ * \param site The call site (return address) of the allocation.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+static void* malloc_from (size_t size, void* site) {
+
+  LOCK();
+#if defined (SITE_SEGREGATION)
+  void* new_block_ptr = site_malloc_unlocked(size, site);
+#else
+  void* new_block_ptr = malloc_unlocked(size);
+#endif
+  DECAY_TICK();
+  PRESSURE_TICK();
+  UNLOCK();
+  return new_block_ptr;
+
+} // malloc_from ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Is a link to a header plausible:  none, or an aligned address? */
+#define CHECK_LINK(hp) ((hp) == NULL || (intptr_t)(hp) % 16 == 0)
+
+/**
+ * Check one header of the heap against its neighbours on its list.  An
+ * allocated block must be linked both ways with allocated neighbours.  A free
+ * block must link to a free block, except with `SOA_FREE_INDEX`, where free
+ * blocks in the table keep no links.  The caller must hold the heap lock.
+ *
+ * \param header_ptr The header.
+ * \return `true` if an error was found; `false` otherwise.
+ */
+static bool check_header (header_s* header_ptr) {
+
+  header_s* next = GET_NEXT(header_ptr);
+  if (!CHECK_LINK(next)) {
+    return true;
+  }
+  if (header_ptr->allocated) {
+    header_s* prev = GET_PREV(header_ptr);
+    if (!CHECK_LINK(prev) ||
+	(prev == NULL ? allocated_list_head != header_ptr :
+	 !prev->allocated || GET_NEXT(prev) != header_ptr)) {
+      return true;
+    }
+    return next != NULL && (!next->allocated || GET_PREV(next) != header_ptr);
+  }
+#if defined (SOA_FREE_INDEX)
+  return false;
+#else
+  return next != NULL && next->allocated;
+#endif
+
+} // check_header ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check a bounded slice of the heap:  the heads of its lists, and the next
+ * `check_slice` headers in address order, resuming where the last check
+ * stopped.  Each header must lead to the next within the heap, and agree with
+ * its list.  This catches most overruns of a block into its neighbour's
+ * header, though not in the nursery, whose blocks are checked only as
+ * neighbours of others.
+ *
+ * \return `true` if an error was found; `false` otherwise.
+ */
+static bool check () {
+
+  bool error = false;
+  LOCK();
+#if FASTBIN_COUNT > 0
+  for (int i = 0; i < FASTBIN_COUNT; i += 1) {
+    if (!CHECK_LINK(fastbins[i]) || (fastbins[i] != NULL && fastbins[i]->allocated)) {
+      error = true;
+    }
+  }
+#endif
+#if !defined (SOA_FREE_INDEX)
+  if (!CHECK_LINK(free_list_head) || (free_list_head != NULL && free_list_head->allocated)) {
+    error = true;
+  }
+#endif
+  if (!CHECK_LINK(allocated_list_head) ||
+      (allocated_list_head != NULL && !allocated_list_head->allocated)) {
+    error = true;
+  }
+
+  // headers never move, so the slice resumes at the header where the last
+  // stopped, and starts afresh at the end of the heap
+  intptr_t first_addr = start_addr;
+#if defined (PERSISTENT_HEAP)
+  first_addr += SUPERBLOCK_SIZE;
+#endif
+  for (size_t i = 0; i < check_slice && start_addr != 0; i += 1) {
+    if (check_addr < first_addr || check_addr >= free_addr) {
+      check_addr = first_addr;
+      if (check_addr >= free_addr) {
+	break;
+      }
+    }
+    header_s* header_ptr = (header_s*)check_addr;
+    intptr_t  block_end  = (intptr_t)HEADER_TO_BLOCK(header_ptr) + GET_SIZE(header_ptr);
+    if (block_end < check_addr || block_end > (intptr_t)ROUND_UP_16(free_addr) ||
+	(!header_ptr->padding && check_header(header_ptr))) {
+      error      = true;
+      check_addr = 0;
+      break;
+    }
+    check_addr = ROUND_UP_16(block_end);
+  }
+  UNLOCK();
+  return error;
+
+} // check ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Count a call to `malloc()` or `free()` by a checking variant, and check a
+ * slice of the heap every `check_interval` calls.
+ *
+ * \return `true` if a check found an error; `false` otherwise.
+ */
+static bool check_tick () {
+
+  check_ops += 1;
+  if (check_ops < check_interval) {
+    return false;
+  }
+  check_ops = 0;
+  return check();
+
+} // check_tick ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate `size` bytes of heap space on behalf of a call site, as a given
+ * variant of `malloc()` does.  Each variant inlines this with its own constant
+ * `variant`, so that the lean one carries no trace of the others.
+ *
+ * \param size    The number of bytes to allocate.
+ * \param site    The call site (return address) of the allocation.
+ * \param variant The variant.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+static inline __attribute__((always_inline))
+void* malloc_variant (size_t size, void* site, dispatch_variant_t variant) {
+
+  TRACE(variant, "malloc(): ", size);
+  CHECK(variant);
+  void* new_block_ptr = malloc_from(size, site);
+  TRACE(variant, "malloc() returning: ", (intptr_t)new_block_ptr);
+  return new_block_ptr;
+
+} // malloc_variant ()
+
+static void* malloc_fast (size_t size, void* site) {
+  return malloc_variant(size, site, DISPATCH_FAST);
+}
+
+#if !defined (HYBRID_MEDIUM_TIER)
+static void* malloc_check (size_t size, void* site) {
+  return malloc_variant(size, site, DISPATCH_CHECK);
+}
+
+static void* malloc_debug (size_t size, void* site) {
+  return malloc_variant(size, site, DISPATCH_DEBUG);
+}
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap, as a given variant of `free()` does.
+ *
+ * \param ptr     A pointer to the block to be deallocated.
+ * \param variant The variant.
+ */
+static inline __attribute__((always_inline))
+void free_variant (void* ptr, dispatch_variant_t variant) {
+
+  TRACE(variant, "free(): ", (intptr_t)ptr);
+  CHECK(variant);
+
+  // ephemeral blocks have no headers, and are freed without the lock
+  if (IS_EPHEMERAL(ptr)) {
+    ephemeral_free(ptr);
+    return;
+  }
+
+  LOCK();
+  free_unlocked(ptr);
+  DECAY_TICK();
+  PRESSURE_TICK();
+  UNLOCK();
+
+#if defined (PREZERO)
+  if (prezero_pending_head != NULL && !__atomic_load_n(&prezero_started, __ATOMIC_ACQUIRE)) {
+    prezero_start();
+  }
+#endif
+
+} // free_variant ()
+
+static void free_fast (void* ptr) {
+  free_variant(ptr, DISPATCH_FAST);
+}
+
+#if !defined (HYBRID_MEDIUM_TIER)
+static void free_check (void* ptr) {
+  free_variant(ptr, DISPATCH_CHECK);
+}
+
+static void free_debug (void* ptr) {
+  free_variant(ptr, DISPATCH_DEBUG);
+}
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Bind the variants of `malloc()` and `free()` named by `ALLOC_DISPATCH`, when
+ * the library is loaded.  The entry points themselves cannot be `ifunc`
+ * symbols:  the dynamic linker relocates the C library, which calls them,
+ * before this library, and refuses to run the resolvers of an object that is
+ * not yet relocated.  So each calls, or jumps, through its own `ifunc`.  The
+ * hybrid allocator's tiers use the lean variants only.
+ */
+typedef void* (*malloc_variant_f) (size_t size, void* site);
+typedef void  (*free_variant_f)   (void* ptr);
+
+#if defined (HYBRID_MEDIUM_TIER)
+#define malloc_dispatch malloc_fast
+#define free_dispatch   free_fast
+#else
+static malloc_variant_f malloc_resolve () {
+
+  check_interval = dispatch_tunable(CHECK_INTERVAL_ENV, CHECK_INTERVAL);
+  check_slice    = dispatch_tunable(CHECK_SLICE_ENV, CHECK_SLICE);
+  malloc_variant_f variants[DISPATCH_VARIANTS] = { malloc_fast, malloc_check, malloc_debug };
+  return variants[dispatch_variant()];
+
+} // malloc_resolve ()
+
+static free_variant_f free_resolve () {
+
+  free_variant_f variants[DISPATCH_VARIANTS] = { free_fast, free_check, free_debug };
+  return variants[dispatch_variant()];
+
+} // free_resolve ()
+
+static void* malloc_dispatch (size_t size, void* site) __attribute__((ifunc("malloc_resolve")));
+static void  free_dispatch   (void* ptr)               __attribute__((ifunc("free_resolve")));
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* malloc (size_t size) {
+
+  return malloc_dispatch(size, __builtin_return_address(0));
+
+} // malloc()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+void free (void* ptr) {
+
+  free_dispatch(ptr);
+
+} // free()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block that sits alone on its cache line(s).  Reuse the best
+ * fitting block freed by an earlier call, if any; otherwise bump the heap to
+ * the next line boundary, place the header at the end of that line, and round
+ * the block up to whole lines.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* malloc_cacheline (size_t size) {
+
+  if (size == 0) {
+    return NULL;
+  }
+  size = ROUND_UP_LINE(size);
+
+  LOCK();
+  init();
+  PERSIST_TOUCH();
+
+  // search the cacheline free LL for the best fit, keeping the block before
+  // it so that it can be unlinked
+  header_s* best      = NULL;
+  header_s* best_prev = NULL;
+  header_s* prev      = NULL;
+  for (header_s* current = cacheline_list_head; current != NULL; current = GET_NEXT(current)) {
+    if (size <= GET_SIZE(current) &&
+	(best == NULL || GET_SIZE(current) < GET_SIZE(best))) {
+      best      = current;
+      best_prev = prev;
+    }
+    prev = current;
+  }
+
+  header_s* header_ptr = best;
+  if (best != NULL) {
+
+    if (best_prev == NULL) {
+      cacheline_list_head = GET_NEXT(best);
+    } else {
+      SET_NEXT(best_prev, GET_NEXT(best));
+    }
+
+  } else {
+
+    // the block starts on the line after the header's line
+    intptr_t line_addr     = ROUND_UP_LINE(free_addr);
+    header_ptr             = (header_s*)(line_addr + CACHE_LINE_SIZE - sizeof(header_s));
+    intptr_t new_free_addr = line_addr + CACHE_LINE_SIZE + size;
+    if (new_free_addr > end_addr) {
+      UNLOCK();
+      return NULL;
+    }
+    pad_gap(free_addr, (intptr_t)header_ptr);
+    free_addr             = new_free_addr;
+    SET_SIZE(header_ptr, size);
+    header_ptr->cacheline = true;
+    header_ptr->padding   = false;
+#if defined (SITE_SEGREGATION)
+    header_ptr->nursery   = false;
+    header_ptr->sampled   = false;
+#endif
+#if defined (PREZERO)
+    header_ptr->zeroed    = false;
+#endif
+
+  }
+
+  allocated_list_push(header_ptr);
+  UNLOCK();
+  return HEADER_TO_BLOCK(header_ptr);
+
+} // malloc_cacheline ()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Allocate a short-lived block from this thread's ephemeral chunk by bumping a
+ * pointer, falling back on a new chunk when the current one is full.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* malloc_ephemeral (size_t size) {
+
+  if (size == 0) {
+    return NULL;
+  }
+  size = ROUND_UP_16(size);
+  intptr_t block_addr = my_bump;
+  if (my_limit - block_addr >= (intptr_t)size) {
+    my_bump   = block_addr + size;
+    my_count += 1;
+    return (void*)block_addr;
+  }
+  return ephemeral_refill(size);
+
+} // malloc_ephemeral ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Free every ephemeral block that this thread has allocated, by marking all of
+ * its chunks empty and restarting its current chunk.
+ */
+void ephemeral_scope_exit () {
+
+  for (ephemeral_chunk_s* chunk = my_chunks; chunk != NULL; chunk = chunk->next) {
+    chunk->retired = (chunk != my_chunk);
+    __atomic_store_n(&chunk->live, 0, __ATOMIC_RELEASE);
+  }
+  if (my_chunk != NULL) {
+    my_bump  = (intptr_t)my_chunk + CACHE_LINE_SIZE;
+    my_count = 0;
+  }
+
+} // ephemeral_scope_exit ()
+// ==============================================================================
+
+
+
+#if !defined (PERSISTENT_HEAP)
+// ==============================================================================
+/**
+ * Return to the OS the topmost `COMPACT_TRIM_BYTES` of the whole pages of the
+ * movable region above its bump pointer that have been touched.
+ */
+static void movable_trim () {
+
+  intptr_t first = (movable_free_addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  intptr_t last  = (movable_high_addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  if (last - first > (intptr_t)COMPACT_TRIM_BYTES) {
+    first = last - COMPACT_TRIM_BYTES;
+  }
+  if (last > first) {
+    madvise((void*)first, last - first, MADV_DONTNEED);
+  }
+  movable_high_addr = (first > movable_free_addr ? first : movable_free_addr);
+
+} // movable_trim ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Cover the space from one movable block to another with a free block.
+ *
+ * \param from The start of the space.
+ * \param to   The end of the space, a movable block's header.
+ */
+static void movable_gap (intptr_t from, intptr_t to) {
+
+  if (to > from) {
+    movable_header_s* gap_ptr = (movable_header_s*)from;
+    gap_ptr->handle = NULL;
+    gap_ptr->size   = to - from - sizeof(movable_header_s);
+  }
+
+} // movable_gap ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Is a listed hole still free space?  Holes left by the pass under way, or by
+ * the last one, are; older ones are only until the pass scans over them.
+ *
+ * \param hole The hole.
+ * \return `true` if the hole is valid; `false` otherwise.
+ */
+static bool hole_valid (const movable_hole_s* hole) {
+
+  return hole->pass == compact_passes || (compacting && hole->addr >= compact_scan);
+
+} // hole_valid ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Cover the space before a locked block with a free block, and list it as a
+ * hole, in place of a hole that is no longer valid or else of the smallest, if
+ * the table is full.
+ *
+ * \param from The start of the space.
+ * \param to   The end of the space, the locked block's header.
+ */
+static void hole_add (intptr_t from, intptr_t to) {
+
+  if (to <= from) {
+    return;
+  }
+  movable_gap(from, to);
+  int slot = hole_count;
+  if (hole_count == HOLE_TABLE_SIZE) {
+    slot = 0;
+    for (int i = 0; i < hole_count && hole_valid(&movable_holes[slot]); i += 1) {
+      if (!hole_valid(&movable_holes[i]) || movable_holes[i].size < movable_holes[slot].size) {
+	slot = i;
+      }
+    }
+    if (hole_valid(&movable_holes[slot]) && movable_holes[slot].size >= (size_t)(to - from)) {
+      return;
+    }
+  } else {
+    hole_count += 1;
+  }
+  movable_holes[slot].addr = from;
+  movable_holes[slot].size = to - from;
+  movable_holes[slot].pass = compact_passes;
+
+} // hole_add ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Fill the first listed hole that fits a new block, dropping those no longer
+ * valid, and cover what is left of it with a smaller free block.
+ *
+ * \param block_size The size of the new block, with its header.
+ * \return The new block's header, or `NULL` if no hole fits.
+ */
+static movable_header_s* hole_take (size_t block_size) {
+
+  for (int i = 0; i < hole_count; ) {
+    movable_hole_s* hole = &movable_holes[i];
+    if (!hole_valid(hole)) {
+      *hole = movable_holes[--hole_count];
+      continue;
+    }
+    if (hole->size >= block_size) {
+      movable_header_s* header_ptr = (movable_header_s*)hole->addr;
+      hole->addr += block_size;
+      hole->size -= block_size;
+      movable_gap(hole->addr, hole->addr + hole->size);
+      if (hole->size == 0) {
+	*hole = movable_holes[--hole_count];
+      }
+      movable_garbage -= block_size;
+      movable_pinned  -= (movable_pinned < block_size ? movable_pinned : block_size);
+      return header_ptr;
+    }
+    i += 1;
+  }
+  return NULL;
+
+} // hole_take ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * End a compaction pass:  lower the movable region's bump pointer to the end
+ * of the compacted blocks.  The steps that follow trim the pages above it.
+ */
+static void compact_finish () {
+
+  hole_add(compact_hole, compact_hole_end);
+  movable_free_addr = compact_dest;
+  compacting        = false;
+  movable_pinned    = movable_garbage;
+
+} // compact_finish ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take a step of compaction:  between passes, trim the movable region, and
+ * start a pass if there is enough garbage.  Each unlocked block is slid down
+ * onto the end of the compacted blocks, or into the largest space left before
+ * a locked block, and its handle is updated.  A locked block stays put, and
+ * the spaces before such blocks that are not filled become free blocks.  A
+ * step ends after `COMPACT_SLICE_BYTES` moved or `COMPACT_SLICE_HEADERS`
+ * visited, so that no call stalls for long; a whole step runs the pass to its
+ * end.
+ *
+ * \param whole Whether to start a pass on any garbage, and to finish it.
+ */
+static void compact_step (bool whole) {
+
+  if (!compacting) {
+    if (movable_high_addr - movable_free_addr >= (intptr_t)COMPACT_MIN_GARBAGE) {
+      movable_trim();
+    }
+    size_t garbage = movable_garbage - movable_pinned;
+    size_t live    = movable_free_addr - movable_start_addr - movable_garbage;
+    if (movable_garbage == 0 ||
+	(!whole && (garbage < COMPACT_MIN_GARBAGE || garbage < live / 4))) {
+      return;
+    }
+    compacting       = true;
+    compact_dest     = movable_start_addr;
+    compact_scan     = movable_start_addr;
+    compact_hole     = 0;
+    compact_hole_end = 0;
+    compact_passes  += 1;
+  }
+
+  size_t moved = 0;
+  for (int headers = 0;
+       compact_scan < movable_free_addr &&
+	 (whole || (headers < COMPACT_SLICE_HEADERS && moved < COMPACT_SLICE_BYTES));
+       headers += 1) {
+
+    movable_header_s* header_ptr = (movable_header_s*)compact_scan;
+    size_t            block_size = sizeof(movable_header_s) + header_ptr->size;
+    compact_scan += block_size;
+
+    if (header_ptr->handle == NULL) {
+
+      // a free block joins the space between the pointers
+      movable_garbage -= block_size;
+
+    } else if (header_ptr->handle->locks > 0) {
+
+      // a locked block stays, and the space before it is kept as the hole to
+      // fill, if it is the largest yet, or else listed for halloc()
+      intptr_t gap = (intptr_t)header_ptr - compact_dest;
+      movable_garbage += gap;
+      if (gap > compact_hole_end - compact_hole) {
+	hole_add(compact_hole, compact_hole_end);
+	compact_hole     = compact_dest;
+	compact_hole_end = (intptr_t)header_ptr;
+      } else {
+	hole_add(compact_dest, (intptr_t)header_ptr);
+      }
+      compact_dest = compact_scan;
+
+    } else {
+
+      // an unlocked block fills the hole, if it fits, or else slides down
+      intptr_t to = compact_dest;
+      if (compact_hole_end - compact_hole >= (intptr_t)block_size) {
+	to                = compact_hole;
+	compact_hole     += block_size;
+	movable_garbage  -= block_size;
+      } else {
+	compact_dest     += block_size;
+      }
+      if ((intptr_t)header_ptr != to) {
+	memmove((void*)to, header_ptr, block_size);
+	header_ptr                = (movable_header_s*)to;
+	header_ptr->handle->block = MOVABLE_TO_BLOCK(header_ptr);
+	moved                    += block_size;
+      }
+
+    }
+
+  }
+
+  if (compact_scan >= movable_free_addr) {
+    compact_finish();
+  }
+
+} // compact_step ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take a handle for a new block, from those freed or else from the table,
+ * which is mapped on first use.
+ *
+ * \return The handle, or `NULL` if all are in use.
+ */
+static alloc_handle_s* handle_take () {
+
+  if (unused_handles != NULL) {
+    alloc_handle_s* handle = unused_handles;
+    unused_handles = handle->next_unused;
+    return handle;
+  }
+  if (handle_table == NULL) {
+    void* table = mmap(NULL, HANDLE_TABLE_SIZE * sizeof(alloc_handle_s), PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (table == MAP_FAILED) {
+      return NULL;
+    }
+    handle_table = table;
+  }
+  if (handle_count == HANDLE_TABLE_SIZE) {
+    return NULL;
+  }
+  return &handle_table[handle_count++];
+
+} // handle_take ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Map the movable region, unless it is already mapped.  It is mapped apart
+ * from the heap, on the first call to `halloc()`, so that programs that never
+ * call it keep the whole heap.  The caller must hold the heap lock.
+ *
+ * \return `true` if the region is mapped; `false` if it could not be.
+ */
+static bool movable_reserve () {
+
+  if (movable_start_addr != 0) {
+    return true;
+  }
+  void* region = mmap(NULL, MOVABLE_REGION_SIZE, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    return false;
+  }
+  movable_start_addr = (intptr_t)region;
+  movable_end_addr   = movable_start_addr + MOVABLE_REGION_SIZE;
+  movable_free_addr  = movable_start_addr;
+  movable_high_addr  = movable_start_addr;
+  return true;
+
+} // movable_reserve ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a movable block in a hole, or else bumped from the movable region.
+ * If the region is full, compact it wholly and try again.
+ *
+ * \param size The number of bytes to allocate.
+ * \return The block's handle, if successful; `NULL` if unsuccessful.
+ */
+alloc_handle_s* halloc (size_t size) {
+
+  if (size == 0) {
+    return NULL;
+  }
+  size = ROUND_UP_16(size);
+
+  LOCK();
+  alloc_handle_s* handle = (movable_reserve() ? handle_take() : NULL);
+  if (handle == NULL) {
+    UNLOCK();
+    return NULL;
+  }
+
+  // a pass under way must end before another can start
+  size_t            block_size = sizeof(movable_header_s) + size;
+  movable_header_s* header_ptr = hole_take(block_size);
+  if (header_ptr == NULL) {
+    for (int pass = 0; pass < 2 && movable_free_addr + block_size > movable_end_addr; pass += 1) {
+      compact_step(true);
+    }
+    if (movable_free_addr + block_size > movable_end_addr) {
+      handle->next_unused = unused_handles;
+      unused_handles      = handle;
+      UNLOCK();
+      return NULL;
+    }
+    header_ptr         = (movable_header_s*)movable_free_addr;
+    movable_free_addr += block_size;
+    if (movable_free_addr > movable_high_addr) {
+      movable_high_addr = movable_free_addr;
+    }
+  }
+  header_ptr->handle = handle;
+  header_ptr->size   = size;
+  handle->block      = MOVABLE_TO_BLOCK(header_ptr);
+  handle->locks      = 0;
+
+  compact_step(false);
+  UNLOCK();
+  return handle;
+
+} // halloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Lock a movable block in place, and return where it is.
+ *
+ * \param handle The block's handle.
+ * \return A pointer to the block, valid until the matching `hunlock()`.
+ */
+void* hlock (alloc_handle_s* handle) {
+
+  LOCK();
+  handle->locks += 1;
+  void* block = handle->block;
+  UNLOCK();
+  return block;
+
+} // hlock ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Undo a call to `hlock()`.
+ *
+ * \param handle The block's handle.
+ */
+void hunlock (alloc_handle_s* handle) {
+
+  LOCK();
+  assert(handle->locks > 0);
+  handle->locks -= 1;
+  UNLOCK();
+
+} // hunlock ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Free a movable block, and its handle.  The topmost block is simply given
+ * back to the bump pointer; any other becomes garbage for the compactor.
+ *
+ * \param handle The block's handle, or `NULL`.
+ */
+void hfree (alloc_handle_s* handle) {
+
+  if (handle == NULL) {
+    return;
+  }
+
+  LOCK();
+  movable_header_s* header_ptr = BLOCK_TO_MOVABLE(handle->block);
+  size_t            block_size = sizeof(movable_header_s) + header_ptr->size;
+  header_ptr->handle = NULL;
+  if (!compacting && (intptr_t)header_ptr + block_size == movable_free_addr) {
+    movable_free_addr = (intptr_t)header_ptr;
+  } else {
+    movable_garbage += block_size;
+  }
+  handle->next_unused = unused_handles;
+  unused_handles      = handle;
+
+  compact_step(false);
+  UNLOCK();
+
+} // hfree ()
+// ==============================================================================
+#endif /* !PERSISTENT_HEAP */
+
+
+
+// ==============================================================================
+/**
+ * Return the number of bytes carved from the heap, including the nursery's
+ * and the movable region's.
+ *
+ * \return The heap extent, in bytes.
+ */
+size_t alloc_heap_extent () {
+
+  LOCK();
+  size_t extent = free_addr - start_addr;
+#if defined (SITE_SEGREGATION)
+  extent += nursery_free_addr - nursery_start_addr;
+#endif
+#if !defined (PERSISTENT_HEAP)
+  extent += movable_free_addr - movable_start_addr;
+#endif
+  UNLOCK();
+  return extent;
+
+} // alloc_heap_extent ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Visit the blocks of a region of the heap in address order, from header to
+ * header, up to the region's bump pointer.  The caller must hold the heap lock,
+ * which, when there is one, is yielded every `WALK_CHUNK` headers.  Headers are
+ * never moved, so the walk resumes where it left off; the heap may have changed
+ * in the meantime.
+ *
+ * \param addr           The first header of the region.
+ * \param limit          The region's bump pointer, which may grow during a yield.
+ * \param resets         A count of the region's resets, which end the walk, or `NULL`.
+ * \param from           Visit only blocks at or above this address...
+ * \param to             ...and below this one.
+ * \param allocated_only Whether to visit only allocated blocks.
+ * \param callback       The function to call for each block visited.
+ * \param arg            The argument to pass to `callback`.
+ * \return The number of blocks visited.
+ */
+static size_t walk_region (intptr_t addr, const intptr_t* limit, const uint64_t* resets,
+			   intptr_t from, intptr_t to, bool allocated_only,
+			   alloc_walk_f callback, void* arg) {
+
+  size_t visited = 0;
+  int    headers = 0;
+  while (addr < *limit && addr < to) {
+
+    header_s* header_ptr = (header_s*)addr;
+    void*     block      = HEADER_TO_BLOCK(header_ptr);
+    if (!header_ptr->padding && (intptr_t)block >= from && (intptr_t)block < to &&
+	(header_ptr->allocated || !allocated_only)) {
+      callback(block, GET_SIZE(header_ptr), header_ptr->allocated, arg);
+      visited += 1;
+    }
+    addr = ROUND_UP_16((intptr_t)block + GET_SIZE(header_ptr));
+
+#if defined (THREAD_SAFE)
+    // let waiting threads allocate and free, then resume at the next header
+    headers += 1;
+    if (headers == WALK_CHUNK) {
+      uint64_t seen = (resets == NULL ? 0 : *resets);
+      headers = 0;
+      UNLOCK();
+      LOCK();
+      if (resets != NULL && *resets != seen) {
+	break;
+      }
+    }
+#else
+    (void)headers;
+    (void)resets;
+#endif
+
+  }
+  return visited;
+
+} // walk_region ()
+// ==============================================================================
+
+
+
+#if !defined (PERSISTENT_HEAP)
+// ==============================================================================
+/**
+ * Visit the blocks of the movable region in address order, from header to
+ * header, where they lie now.  During a compaction pass, skip the space freed
+ * between the compacted blocks and those yet to be, and what the pass has not
+ * yet filled of its hole, which have no headers.  The caller must hold the
+ * heap lock, which is not yielded, since the compactor moves blocks.
+ *
+ * \param from           Visit only blocks at or above this address...
+ * \param to             ...and below this one.
+ * \param allocated_only Whether to visit only allocated blocks.
+ * \param callback       The function to call for each block visited.
+ * \param arg            The argument to pass to `callback`.
+ * \return The number of blocks visited.
+ */
+static size_t walk_movable (intptr_t from, intptr_t to, bool allocated_only,
+			    alloc_walk_f callback, void* arg) {
+
+  size_t   visited = 0;
+  intptr_t addr    = movable_start_addr;
+  while (addr < movable_free_addr && addr < to) {
+
+    if (compacting && addr == compact_hole && compact_hole < compact_hole_end) {
+      addr = compact_hole_end;
+      continue;
+    }
+    if (compacting && addr == compact_dest && compact_dest < compact_scan) {
+      addr = compact_scan;
+      continue;
+    }
+
+    movable_header_s* header_ptr = (movable_header_s*)addr;
+    void*             block      = MOVABLE_TO_BLOCK(header_ptr);
+    bool              allocated  = (header_ptr->handle != NULL);
+    if ((intptr_t)block >= from && (intptr_t)block < to && (allocated || !allocated_only)) {
+      callback(block, header_ptr->size, allocated, arg);
+      visited += 1;
+    }
+    addr = (intptr_t)block + header_ptr->size;
+
+  }
+  return visited;
+
+} // walk_movable ()
+// ==============================================================================
+#endif
+
+
+
+// ==============================================================================
+/**
+ * Visit the blocks of the heap, then of the nursery, and then of the movable
+ * region, each in address order.  Ephemeral blocks have no headers, and are
+ * skipped.
+ *
+ * \param from           Visit only blocks at or above this address...
+ * \param to             ...and below this one.
+ * \param allocated_only Whether to visit only allocated blocks.
+ * \param callback       The function to call for each block visited.
+ * \param arg            The argument to pass to `callback`.
+ * \return The number of blocks visited.
+ */
+static size_t walk_heap (intptr_t from, intptr_t to, bool allocated_only,
+			 alloc_walk_f callback, void* arg) {
+
+  LOCK();
+  init();
+  intptr_t first_addr = start_addr;
+#if defined (PERSISTENT_HEAP)
+  first_addr += SUPERBLOCK_SIZE;
+#endif
+  size_t visited = walk_region(first_addr, &free_addr, NULL,
+			       from, to, allocated_only, callback, arg);
+#if defined (SITE_SEGREGATION)
+  visited += walk_region(nursery_start_addr, &nursery_free_addr, &nursery_resets,
+			 from, to, allocated_only, callback, arg);
+#endif
+#if !defined (PERSISTENT_HEAP)
+  visited += walk_movable(from, to, allocated_only, callback, arg);
+#endif
+  UNLOCK();
+  return visited;
+
+} // walk_heap ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Visit every block of the heap, allocated or free, region by region in
+ * address order.
+ *
+ * \param callback The function to call for each block.
+ * \param arg      The argument to pass to `callback`.
+ */
+void alloc_heap_walk (alloc_walk_f callback, void* arg) {
+
+  walk_heap(0, INTPTR_MAX, false, callback, arg);
+
+} // alloc_heap_walk ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Visit each allocated block that starts within a range of addresses, region
+ * by region in address order.
+ *
+ * \param base     The start of the range.
+ * \param size     The size of the range, in bytes.
+ * \param callback The function to call for each block.
+ * \param arg      The argument to pass to `callback`.
+ * \return The number of blocks visited.
+ */
+size_t malloc_iterate (uintptr_t base, size_t size, alloc_walk_f callback, void* arg) {
+
+  uintptr_t end = (base + size < base ? UINTPTR_MAX : base + size);
+  return walk_heap(base, end > INTPTR_MAX ? INTPTR_MAX : end, true, callback, arg);
+
+} // malloc_iterate ()
+// ==============================================================================
+
+
+
+#if defined (HYBRID_MEDIUM_TIER)
+// ==============================================================================
+/**
+ * Return the number of bytes that a block may hold, the size in its header.
+ * The hybrid allocator does not hand out ephemeral blocks, which have none.
+ *
+ * \param ptr A pointer to an allocated block.
+ * \return The usable size of the block, in bytes.
+ */
+size_t usable_size (void* ptr) {
+
+  assert(!IS_EPHEMERAL(ptr));
+  return GET_SIZE(BLOCK_TO_HEADER(ptr));
+
+} // usable_size ()
+// ==============================================================================
 
-  /** The usable size of the block (exclusive of the header itself). */
-  size_t         size;
 
-  /** Is the block allocated or free? */
-  bool           allocated;
 
-} header_s;
 // ==============================================================================
+/**
+ * Is a block one from the bootstrap arena, which serves the requests made
+ * before the hybrid allocator's constructor initializes this tier?
+ *
+ * \param ptr A pointer to a block.
+ * \return `true` if the block is from the bootstrap arena; `false` otherwise.
+ */
+bool bootstrap_block (void* ptr) {
 
+  return IS_BOOTSTRAP(ptr);
 
-
+} // bootstrap_block ()
 // ==============================================================================
-// MACRO CONSTANTS AND FUNCTIONS
+#endif
 
-/** The system's page size. */
-#define PAGE_SIZE sysconf(_SC_PAGESIZE)
 
+#if defined (SHARED_HEAP)
+// ==============================================================================
 /**
- * Macros to easily calculate the number of bytes for larger scales (e.g., kilo,
- * mega, gigabytes).
+ * Take a shared heap's lock.  If a process died holding it, its update is
+ * complete or leaked a block, so the heap is marked consistent and used on.
+ *
+ * \param heap The shared heap.
  */
-#define KB(size)  ((size_t)size * 1024)
-#define MB(size)  (KB(size) * 1024)
-#define GB(size)  (MB(size) * 1024)
+static void shm_lock (shm_heap_s* heap) {
+
+  int result = pthread_mutex_lock(&heap->lock);
+  if (result == EOWNERDEAD) {
+    DEBUG("Recovering shared heap lock");
+    pthread_mutex_consistent(&heap->lock);
+  } else if (result != 0) {
+    ERROR("Could not lock shared heap");
+  }
+
+} // shm_lock ()
+// ==============================================================================
 
-/** The virtual address space reserved for the heap. */
-#define HEAP_SIZE GB(2)
 
-/** Given a pointer to a header, obtain a `void*` pointer to the block itself. */
-#define HEADER_TO_BLOCK(hp) ((void*)((intptr_t)hp + sizeof(header_s)))
 
-/** Given a pointer to a block, obtain a `header_s*` pointer to its header. */
-#define BLOCK_TO_HEADER(bp) ((header_s*)((intptr_t)bp - sizeof(header_s)))
 // ==============================================================================
+/**
+ * Map a shared heap from a file descriptor.
+ *
+ * \param fd   The shared memory object or memfd.
+ * \param size The size of the heap.
+ * \return The heap, if successful; `NULL` if unsuccessful.
+ */
+static shm_heap_s* shm_map (int fd, size_t size) {
 
+  void* heap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return heap == MAP_FAILED ? NULL : heap;
 
+} // shm_map ()
 // ==============================================================================
-// GLOBALS
 
-/** The address of the next available byte in the heap region. */
-static intptr_t free_addr  = 0;
 
-/** The beginning of the heap. */
-static intptr_t start_addr = 0;
 
-/** The end of the heap. */
-static intptr_t end_addr   = 0;
+// ==============================================================================
+/**
+ * Create a shared heap.  A named heap is a POSIX shared memory object, which
+ * other processes attach to with `shm_heap_attach()`, and which persists until
+ * `shm_unlink()`.  An unnamed heap is a memfd, which is shared only with the
+ * children that the creator forks.
+ *
+ * \param name The name of the heap, such as "/workers", or `NULL`.
+ * \param size The size of the heap, in bytes.
+ * \return The heap, if successful; `NULL` if unsuccessful.
+ */
+shm_heap_s* shm_heap_create (const char* name, size_t size) {
 
-/** The head of the free list. */
-static header_s* free_list_head = NULL;
+  size = ROUND_UP_LINE(size);
+  if (size <= SHM_FIRST_OFFSET) {
+    return NULL;
+  }
+  int fd = (name == NULL ?
+	    memfd_create("bf-shm", MFD_CLOEXEC) :
+	    shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+  if (fd < 0) {
+    return NULL;
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return NULL;
+  }
+  shm_heap_s* heap = shm_map(fd, size);
+  if (heap == NULL) {
+    return NULL;
+  }
 
-/** The head of the allocated list. */
-static header_s* allocated_list_head = NULL;
+  pthread_mutexattr_t attributes;
+  pthread_mutexattr_init(&attributes);
+  pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&heap->lock, &attributes);
+  pthread_mutexattr_destroy(&attributes);
+  heap->size        = size;
+  heap->free_offset = SHM_FIRST_OFFSET;
+  heap->free_list   = 0;
+  heap->root        = 0;
+
+  // publish the heap as initialized only once it is
+  __atomic_store_n(&heap->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  return heap;
+
+} // shm_heap_create ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * The initialization method.  If this is the first use of the heap, initialize it.
+ * Attach to a named shared heap created by another process.
+ *
+ * \param name The name of the heap.
+ * \return The heap, if successful; `NULL` if unsuccessful.
  */
+shm_heap_s* shm_heap_attach (const char* name) {
 
-void init () {
+  int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || (size_t)status.st_size <= SHM_FIRST_OFFSET) {
+    close(fd);
+    return NULL;
+  }
+  shm_heap_s* heap = shm_map(fd, status.st_size);
+  if (heap != NULL && __atomic_load_n(&heap->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) {
+    munmap(heap, status.st_size);
+    return NULL;
+  }
+  return heap;
 
-  // Only do anything if there is no heap region (i.e., first time called).
-  if (start_addr == 0) {
+} // shm_heap_attach ()
+// ==============================================================================
 
-    DEBUG("Trying to initialize");
-    
-    // Allocate virtual address space in which the heap will reside. Make it
-    // un-shared and not backed by any file (_anonymous_ space).  A failure to
-    // map this space is fatal.
-    void* heap = mmap(NULL,
-		      HEAP_SIZE,
-		      PROT_READ | PROT_WRITE,
-		      MAP_PRIVATE | MAP_ANONYMOUS,
-		      -1,
-		      0);
-    if (heap == MAP_FAILED) {
-      ERROR("Could not mmap() heap region");
-    }
 
-    // Hold onto the boundaries of the heap as a whole.
-    start_addr = (intptr_t)heap;
-    end_addr   = start_addr + HEAP_SIZE;
-    free_addr  = start_addr;
 
-    // DEBUG: Emit a message to indicate that this allocator is being called.
-    DEBUG("bf-alloc initialized");
+// ==============================================================================
+/**
+ * Detach from a shared heap, unmapping it from this process.
+ *
+ * \param heap The shared heap.
+ */
+void shm_heap_detach (shm_heap_s* heap) {
 
-  }
+  munmap(heap, heap->size);
 
-} // init ()
+} // shm_heap_detach ()
 // ==============================================================================
 
 
+
 // ==============================================================================
 /**
- * Allocate and return `size` bytes of heap space.  Specifically, search the
- * free list, choosing the _best fit_.  If no such block is available, expand
- * into the heap region via _pointer bumping_.
+ * Allocate `size` bytes from a shared heap:  the best fitting free block, or
+ * else a block bumped from the heap.
  *
+ * \param heap The shared heap.
  * \param size The number of bytes to allocate.
  * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
  */
-void* malloc (size_t size) {
+void* shm_malloc (shm_heap_s* heap, size_t size) {
 
-  // if heap hasn't yet been initialized, do it
-  init();
-
-  // if the requested block size is 0, return NULL because there is nothing to do
   if (size == 0) {
     return NULL;
   }
+  size = ROUND_UP_16(size);
+  shm_lock(heap);
 
-  
-  // going to loop through the free blocks on free LL
-  // create a pointer and point it to free LL head
-  // create a pointer to store best fit, initially set to NULL
-  header_s* current = free_list_head;
-  header_s* best    = NULL;
+  // search the free list for the best fit, keeping the link that points to it
+  uint64_t* best_link = NULL;
+  uint64_t  best_size = 0;
+  for (uint64_t* link = &heap->free_list; *link != 0; ) {
+    shm_header_s* current = SHM_POINTER(heap, *link);
+    if (size <= current->size && (best_link == NULL || current->size < best_size)) {
+      best_link = link;
+      best_size = current->size;
+      // an exact fit cannot be beaten, so stop at the first one
+      if (best_size == size) {
+	break;
+      }
+    }
+    link = &current->next;
+  }
 
-  // start looping thru free LL until we reach the end
-  while (current != NULL) {
+  shm_header_s* header_ptr = NULL;
+  if (best_link != NULL) {
 
-    // if there is an allocated block on free LL, raise an error
-    if (current->allocated) {
-      ERROR("Allocated block on free list", (intptr_t)current);
-    }
+    // unlinking is the single store that takes the block
+    header_ptr = SHM_POINTER(heap, *best_link);
+    *best_link = header_ptr->next;
 
-    // if there is no best block and current block is => requested size,
-    // or if current block is closer to requested size than best block
-    // then make current block the best block
-    if ( (best == NULL && size <= current->size) ||
-	 (best != NULL && size <= current->size && current->size < best->size) ) {
-      best = current;
-    }
+  } else {
 
-    // if best block is the exact requested size, then break the loop
-    // because we've found our prefect fit
-    if (best != NULL && best->size == size) {
-      break;
+    // fill in the header, then take the space with a single store
+    uint64_t header_offset = heap->free_offset;
+    uint64_t new_offset    = header_offset + sizeof(shm_header_s) + size;
+    if (new_offset > heap->size) {
+      pthread_mutex_unlock(&heap->lock);
+      return NULL;
     }
+    header_ptr       = SHM_POINTER(heap, header_offset);
+    header_ptr->size = size;
+    heap->free_offset = new_offset;
 
-    // move down LL to check next block in free LL
-    current = current->next;
-    
   }
 
-  // create a pointer to eventually hold block pointer to be returned
-  // intially set to NULL
-  void* new_block_ptr = NULL;
+  header_ptr->allocated = true;
+  pthread_mutex_unlock(&heap->lock);
+  return (void*)(header_ptr + 1);
 
-  // if we found a best block, allocate it
-  // 1) remove from free LL
-  // 2) add it to the allocated LL
-  // 3) create a block pointer from best pointer
-  // 4) header pointer is best pointer and is stored in allocated LL
-   if (best != NULL) {
+} // shm_malloc ()
+// ==============================================================================
 
-    // remove best from LL by moving pointers
-    // if prev of best is NULL then it is the head of free LL
-    // so make next of best the new head of free LL
-    // else have prev of best skip over best with its next pointer
-    if (best->prev == NULL) {
-      free_list_head   = best->next;
-    } else {
-      best->prev->next = best->next;
-    }
-    // if best is not the end of the free LL
-    // then make the next of best skip over best with its prev pointer
-    if (best->next != NULL) {
-      best->next->prev = best->prev;
-    }
 
-    // add header to allocated list
-    // make the next of best the current head of allocated LL
-    best->next          = allocated_list_head;
-    // make best the new head of alloacted LL
-    allocated_list_head = best;
-    // make prev of best NULL
-    best->prev          = NULL;
-    // if best is not the only header in LL, make best the prev of next header in LL
-    if (best->next != NULL) {
-      best->next->prev  = best;
-    }
-    // set best to be allocated
-    best->allocated     = true;
 
-    // set block pointer to be address after header--which is the pointer best
-    new_block_ptr       = HEADER_TO_BLOCK(best);
-    
-  } else {
+// ==============================================================================
+/**
+ * Free a block of a shared heap, which any attached process may do.
+ *
+ * \param heap The shared heap.
+ * \param ptr  A pointer to the block to be deallocated.
+ */
+void shm_free (shm_heap_s* heap, void* ptr) {
 
-    // pad the address for double word alignment
-    // since the header is 32 bytes, if we align for the header
-    // then the block will be double word aligned as well
-    free_addr = free_addr + (16 - free_addr % 16);
+  if (ptr == NULL) {
+    return;
+  }
+  shm_header_s* header_ptr = (shm_header_s*)ptr - 1;
+  shm_lock(heap);
+  if (!header_ptr->allocated) {
+    ERROR("Double-free: ", (intptr_t)header_ptr);
+  }
 
-    // create a pointer for the header at the next free address space
-    header_s* header_ptr = (header_s*)free_addr;
-    // create a pointer for the block immediately after the header
-    new_block_ptr = HEADER_TO_BLOCK(header_ptr);
+  // pushing is the single store that releases the block
+  header_ptr->allocated = false;
+  header_ptr->next      = heap->free_list;
+  heap->free_list       = SHM_OFFSET(heap, header_ptr);
+  pthread_mutex_unlock(&heap->lock);
 
-    // add header to the allocated LL
-    // make next for header_ptr be the current LL head
-    header_ptr->next      = allocated_list_head;
-    // make header_ptr the LL head
-    allocated_list_head   = header_ptr;
-    // make prev for header_ptr NULL since it's the beginning
-    header_ptr->prev      = NULL;
-    // if there was a block as the LL head, then make it's prev header_ptr
-    if (header_ptr->next != NULL) {
-      header_ptr->next->prev = header_ptr;
-    }
-    // store the size of the block in the header
-    header_ptr->size      = size;
-    // set to true that the block has been allocated
-    header_ptr->allocated = true;
-
-    // if new free_addr has surpassed the end of the memory space
-    // then return NULL since there isn't enough space to allocate
-    // else update free_addr
-    intptr_t new_free_addr = (intptr_t)new_block_ptr + size;
-    if (new_free_addr > end_addr) {
+} // shm_free ()
+// ==============================================================================
 
-      return NULL;
 
-    } else {
 
-      free_addr = new_free_addr;
+// ==============================================================================
+/**
+ * Convert a block of a shared heap to its offset, which is the same in every
+ * process, to hand the block off.
+ *
+ * \param heap The shared heap.
+ * \param ptr  A pointer to a block, or `NULL`.
+ * \return The block's offset, or 0 for `NULL`.
+ */
+size_t shm_offset (shm_heap_s* heap, void* ptr) {
+
+  return ptr == NULL ? 0 : SHM_OFFSET(heap, ptr);
 
-    }
+} // shm_offset ()
+// ==============================================================================
 
-  }
 
-  // return pointer to block
-  return new_block_ptr;
 
-} // malloc()
+// ==============================================================================
+/**
+ * Convert an offset in a shared heap to a pointer in this process.
+ *
+ * \param heap   The shared heap.
+ * \param offset An offset returned by `shm_offset()`.
+ * \return A pointer to the block, or `NULL` for offset 0.
+ */
+void* shm_pointer (shm_heap_s* heap, size_t offset) {
+
+  return offset == 0 ? NULL : SHM_POINTER(heap, offset);
+
+} // shm_pointer ()
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Deallocate a given block on the heap.  Add the given block (if any) to the
- * free list.
+ * Return the root block of a shared heap, through which processes find their
+ * shared data after attaching.
  *
- * \param ptr A pointer to the block to be deallocated.
+ * \param heap The shared heap.
+ * \return The root block, or `NULL` if none has been set.
  */
-void free (void* ptr) {
+void* shm_root (shm_heap_s* heap) {
 
-  // if pointer is NULL there is nothing to free, jsut return
-  if (ptr == NULL) {
-    return;
-  }
+  return shm_pointer(heap, __atomic_load_n(&heap->root, __ATOMIC_ACQUIRE));
 
-  // get pointer to block from the header
-  header_s* header_ptr = BLOCK_TO_HEADER(ptr);
+} // shm_root ()
+// ==============================================================================
 
-  // if block is not allocated then it is already free, raise an error
-  if (!header_ptr->allocated) {
-    ERROR("Double-free: ", (intptr_t)header_ptr);
-  }
 
-  // remove header from allocated LL
-  // if header is not the end of the allocated LL, adjust prev pointer of next
-  if ( header_ptr->next != NULL) {
-    header_ptr->next->prev = header_ptr->prev;
-  }
 
-  // if header is not head of allocated LL, adjust next pointer of prev
-  // else make next pointer the head of allocated LL
-  if ( header_ptr->prev != NULL ){
-    header_ptr->prev->next = header_ptr->next;
-  } else {
-    allocated_list_head = header_ptr->next;
-  }
-  
-  // add header to free LL
-  // make next the current head of free LL
-  header_ptr->next = free_list_head;
-  // make freed header the new head of free LL
-  free_list_head   = header_ptr;
-  // make prev of freed header NULL
-  header_ptr->prev = NULL;
-  // if freed header is not the only pointer in LL, make prev pointer of next the freed header
-  if (header_ptr->next != NULL) {
-    header_ptr->next->prev = header_ptr;
+// ==============================================================================
+/**
+ * Set the root block of a shared heap.
+ *
+ * \param heap The shared heap.
+ * \param ptr  The new root block, or `NULL` for none.
+ */
+void shm_set_root (shm_heap_s* heap, void* ptr) {
+
+  __atomic_store_n(&heap->root, shm_offset(heap, ptr), __ATOMIC_RELEASE);
+
+} // shm_set_root ()
+// ==============================================================================
+#endif /* SHARED_HEAP */
+
+
+#if defined (PERSISTENT_HEAP)
+// ==============================================================================
+/**
+ * Return the root block of the persistent heap.
+ *
+ * \return The root block, or `NULL` if none has been set.
+ */
+void* alloc_root () {
+
+  LOCK();
+  init();
+  header_s* root_ptr = UNLINK(superblock->root);
+  UNLOCK();
+  return root_ptr == NULL ? NULL : HEADER_TO_BLOCK(root_ptr);
+
+} // alloc_root ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Set the root block of the persistent heap.
+ *
+ * \param ptr The new root block, or `NULL` for none.
+ */
+void alloc_set_root (void* ptr) {
+
+  LOCK();
+  init();
+  superblock->root = (ptr == NULL ? 0 : LINK(BLOCK_TO_HEADER(ptr)));
+  UNLOCK();
+
+} // alloc_set_root ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Make the persistent heap durable, as of now, without closing it.
+ *
+ * \return 0 if successful; -1 if the heap could not be synced.
+ */
+int alloc_sync () {
+
+  int result = 0;
+  LOCK();
+  init();
+  persist_save();
+  if (heap_fd >= 0) {
+    result = msync((void*)start_addr, free_addr - start_addr, MS_SYNC);
   }
-  // set the freed header to NOT allocated
-  header_ptr->allocated = false;
+  UNLOCK();
+  return result;
 
-} // free()
+} // alloc_sync ()
 // ==============================================================================
+#endif /* PERSISTENT_HEAP */
 
 
 
@@ -350,12 +4435,35 @@ void free (void* ptr) {
  */
 void* calloc (size_t nmemb, size_t size) {
 
+  size_t block_size = nmemb * size;
+
+#if defined (PREZERO)
+  // large requests take a block that is already zero, if there is one
+  if (block_size >= PREZERO_MIN_SIZE) {
+    LOCK();
+    init();
+    header_s* header_ptr = prezero_take_best(block_size);
+    if (header_ptr != NULL) {
+      allocated_list_push(header_ptr);
+    }
+    UNLOCK();
+    if (header_ptr != NULL) {
+      return HEADER_TO_BLOCK(header_ptr);
+    }
+  }
+#endif
+
   // Allocate a block of the requested size.
-  size_t block_size    = nmemb * size;
-  void*  new_block_ptr = malloc(block_size);
+  void* new_block_ptr = malloc_dispatch(block_size, __builtin_return_address(0));
 
-  // If the allocation succeeded, clear the entire block.
+  // If the allocation succeeded, clear the entire block, unless it is known to
+  // be zero already.
   if (new_block_ptr != NULL) {
+#if defined (PREZERO)
+    if (BLOCK_TO_HEADER(new_block_ptr)->zeroed) {
+      return new_block_ptr;
+    }
+#endif
     memset(new_block_ptr, 0, block_size);
   }
 
@@ -384,7 +4492,7 @@ void* realloc (void* ptr, size_t size) {
   // Special case: If there is no original block, then just allocate the new one
   // of the given size.
   if (ptr == NULL) {
-    return malloc(size);
+    return malloc_dispatch(size, __builtin_return_address(0));
   }
 
   // Special case: If the new size is 0, that's tantamount to freeing the block.
@@ -393,19 +4501,31 @@ void* realloc (void* ptr, size_t size) {
     return NULL;
   }
 
+  // An ephemeral block has no header to give its size, so copy as much as its
+  // chunk holds after it.
+  if (IS_EPHEMERAL(ptr)) {
+    void*  new_block_ptr = malloc_dispatch(size, __builtin_return_address(0));
+    size_t chunk_rest    = (intptr_t)EPHEMERAL_CHUNK(ptr) + EPHEMERAL_CHUNK_SIZE - (intptr_t)ptr;
+    if (new_block_ptr != NULL) {
+      memcpy(new_block_ptr, ptr, size < chunk_rest ? size : chunk_rest);
+      free(ptr);
+    }
+    return new_block_ptr;
+  }
+
   // Get the current block size from its header.
   header_s* header_ptr = BLOCK_TO_HEADER(ptr);
 
   // If the new size isn't an increase, then just return the original block as-is.
-  if (size <= header_ptr->size) {
+  if (size <= GET_SIZE(header_ptr)) {
     return ptr;
   }
 
   // The new size is an increase.  Allocate the new, larger block, copy the
   // contents of the old into it, and free the old.
-  void* new_block_ptr = malloc(size);
+  void* new_block_ptr = malloc_dispatch(size, __builtin_return_address(0));
   if (new_block_ptr != NULL) {
-    memcpy(new_block_ptr, ptr, header_ptr->size);
+    memcpy(new_block_ptr, ptr, GET_SIZE(header_ptr));
     free(ptr);
   }
     
@@ -0,0 +1,158 @@
+// ==============================================================================
+/**
+ * dispatch.c
+ *
+ * Load-time selection among the variants of the allocators' entry points.
+ * Like safeio, it does not rely on heap allocation:  it is called from the
+ * allocators' `ifunc` resolvers, before any heap exists.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dispatch.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The environment as the process started, and how much of it is read at once. */
+#define ENVIRON_PATH  "/proc/self/environ"
+#define ENVIRON_CHUNK 1024
+
+/** The variable that names the variant, and the longest name it may hold. */
+#define DISPATCH_ENV        "ALLOC_DISPATCH"
+#define MAX_VARIANT_LENGTH  16
+
+/** The longest value of a numeric tunable. */
+#define MAX_TUNABLE_LENGTH  24
+
+/** Marks an entry of the environment that cannot be the one sought. */
+#define NO_MATCH SIZE_MAX
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The variant chosen, or `DISPATCH_VARIANTS` if none has been chosen yet. */
+static dispatch_variant_t chosen_variant = DISPATCH_VARIANTS;
+
+/** The names of the variants, as `ALLOC_DISPATCH` gives them. */
+static const char* variant_names[DISPATCH_VARIANTS] = { "fast", "check", "debug" };
+// ==============================================================================
+
+
+
+// ==============================================================================
+bool dispatch_getenv (const char* name, char* value, size_t length) {
+
+  int fd = open(ENVIRON_PATH, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+
+  // the entries are null-ended `name=value` strings, which may straddle the
+  // chunks read, so match them a character at a time
+  size_t  name_length = strlen(name);
+  size_t  matched     = 0;
+  size_t  copied      = 0;
+  bool    in_value    = false;
+  bool    found       = false;
+  char    buffer[ENVIRON_CHUNK];
+  ssize_t chunk_length;
+  while (!found && (chunk_length = read(fd, buffer, ENVIRON_CHUNK)) > 0) {
+    for (ssize_t i = 0; i < chunk_length && !found; i += 1) {
+      char c = buffer[i];
+      if (in_value) {
+	if (c == '\0') {
+	  found = true;
+	} else if (copied + 1 < length) {
+	  value[copied++] = c;
+	}
+      } else if (c == '\0') {
+	matched = 0;
+      } else if (matched == NO_MATCH) {
+	continue;
+      } else if (matched < name_length && c == name[matched]) {
+	matched += 1;
+      } else if (matched == name_length && c == '=') {
+	in_value = true;
+      } else {
+	matched = NO_MATCH;
+      }
+    }
+  }
+  close(fd);
+
+  // the last entry may end the file without a null
+  if (in_value && length > 0) {
+    value[copied] = '\0';
+  }
+  return in_value;
+
+} // dispatch_getenv ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+dispatch_variant_t dispatch_variant () {
+
+  if (chosen_variant != DISPATCH_VARIANTS) {
+    return chosen_variant;
+  }
+
+  chosen_variant = DISPATCH_FAST;
+  char name[MAX_VARIANT_LENGTH];
+  if (dispatch_getenv(DISPATCH_ENV, name, MAX_VARIANT_LENGTH)) {
+    for (int i = 0; i < DISPATCH_VARIANTS; i += 1) {
+      if (strcmp(name, variant_names[i]) == 0) {
+	chosen_variant = i;
+      }
+    }
+  }
+  return chosen_variant;
+
+} // dispatch_variant ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+size_t dispatch_tunable (const char* name, size_t default_value) {
+
+  // a value that fills the buffer may have been cut short, so is too long
+  char value[MAX_TUNABLE_LENGTH];
+  if (!dispatch_getenv(name, value, MAX_TUNABLE_LENGTH) ||
+      strlen(value) == MAX_TUNABLE_LENGTH - 1) {
+    return default_value;
+  }
+  // parse it by hand:  strtoul() needs the C library's locale, which is not
+  // yet set up when resolvers run
+  size_t number = 0;
+  for (const char* digit = value; *digit != '\0'; digit += 1) {
+    size_t next = *digit - '0';
+    if (*digit < '0' || *digit > '9' ||
+	number > SIZE_MAX / 10 || number * 10 > SIZE_MAX - next) {
+      return default_value;
+    }
+    number = number * 10 + next;
+  }
+  return number == 0 ? default_value : number;
+
+} // dispatch_tunable ()
+// ==============================================================================
@@ -0,0 +1,137 @@
+// ==============================================================================
+/**
+ * dispatch.h
+ *
+ * Load-time selection among the variants of the allocators' entry points.
+ * Each allocator compiles its `malloc()` and `free()` several times, lean or
+ * instrumented, and binds one of them with a GNU `ifunc` resolver when the
+ * library is loaded.  The variant is named by the `ALLOC_DISPATCH`
+ * environment variable:
+ *
+ *   `fast`  (the default) No instrumentation at all.
+ *   `check` Every `ALLOC_CHECK_INTERVAL` calls, check the consistency of
+ *           the next `ALLOC_CHECK_SLICE` units of the heap (pages or
+ *           headers, as the allocator walks it), and abort on an error.
+ *           Catch double frees as they happen.
+ *   `debug` As `check`, and also trace each call to `stderr`.
+ *
+ * Resolvers run while the dynamic linker is still relocating, before the C
+ * library has set up `environ`, so `getenv()` cannot be used.  Like safeio,
+ * these functions do not rely on heap allocation.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_DISPATCH_H)
+#define _DISPATCH_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "safeio.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND MACROS
+
+/** The variants of the entry points. */
+typedef enum dispatch_variant {
+  DISPATCH_FAST,
+  DISPATCH_CHECK,
+  DISPATCH_DEBUG,
+  DISPATCH_VARIANTS
+} dispatch_variant_t;
+
+/**
+ * Emit a trace message from the debugging variant.  With `DEBUG_ALLOC`, every
+ * variant traces, as before.  In the other variants, the test is on a
+ * constant, and is compiled away.  The output's `fsync()` fails on a pipe or a
+ * terminal, so `errno` is kept, lest a successful call appear to fail.
+ */
+#if defined (DEBUG_ALLOC)
+#define TRACE(variant,msg,...)						\
+  do {									\
+    int saved_errno = errno;						\
+    DEBUG(msg, ##__VA_ARGS__);						\
+    errno = saved_errno;						\
+  } while (0)
+#else
+#define TRACE(variant,msg,...)						\
+  do {									\
+    if ((variant) == DISPATCH_DEBUG) {					\
+      int saved_errno = errno;						\
+      safe_debug(msg, NUMARGS(__VA_ARGS__), ##__VA_ARGS__);		\
+      errno = saved_errno;						\
+    }									\
+  } while (0)
+#endif
+
+/** The environment variables that tune the checking and debugging variants. */
+#define CHECK_INTERVAL_ENV "ALLOC_CHECK_INTERVAL"
+#define CHECK_SLICE_ENV    "ALLOC_CHECK_SLICE"
+
+/**
+ * Count a call toward the next check of the heap, with the allocator's own
+ * `check_tick()`, in the checking and debugging variants, and abort if the
+ * check finds an error.
+ */
+#define CHECK(variant)							\
+  do {									\
+    if ((variant) != DISPATCH_FAST && check_tick()) {			\
+      ERROR("Heap check failed");					\
+    }									\
+  } while (0)
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find a variable of the environment with which the process started, by
+ * reading `/proc/self/environ`.  It may be called from an `ifunc` resolver.
+ *
+ * \param name   The name of the variable.
+ * \param value  Where to copy its value, truncated if need be, and null-ended.
+ * \param length The size of `value`, in bytes.
+ * \return `true` if the variable is set; `false` otherwise.
+ */
+bool dispatch_getenv (const char* name, char* value, size_t length);
+
+/**
+ * Choose the variant of the entry points named by `ALLOC_DISPATCH`.  An
+ * unknown name chooses the fast variant.  The choice is made once, so that all
+ * of a library's resolvers agree.
+ *
+ * \return The variant.
+ */
+dispatch_variant_t dispatch_variant (void);
+
+/**
+ * Read a numeric tunable from the environment, as `dispatch_getenv()` does.
+ *
+ * \param name          The name of the variable.
+ * \param default_value The value if the variable is unset, or not a positive
+ *                      number that a `size_t` can hold.
+ * \return The value.
+ */
+size_t dispatch_tunable (const char* name, size_t default_value);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _DISPATCH_H
+// ==============================================================================
@@ -0,0 +1,555 @@
+// ==============================================================================
+/**
+ * hybrid-alloc.c
+ *
+ * A _hybrid_ heap allocator, which sends each request to the tier that suits
+ * its size:
+ *
+ *   - small requests, up to 2 KB, to the power-of-2 size classes of sf-alloc,
+ *     which allocate and free them from per-page free lists;
+ *   - medium requests, up to 256 KB, to the best-fit engine of bf-alloc, whose
+ *     blocks waste at most a header, not up to half of the block;
+ *   - huge requests to a direct `mmap()` of their own, which `free()` unmaps.
+ *
+ * The small and medium tiers take adjacent parts of one reserved region, so
+ * `free()` finds a block's tier from its address alone.  Each tier keeps its
+ * own statistics, reported by `alloc_tier_stats()`.
+ *
+ * The tiers are initialized by a library constructor, so no entry point checks
+ * for them.  Before then, each tier serves requests from its own bootstrap
+ * arena, as it does when built alone.  Those blocks lie outside the region, so
+ * `free()` asks the tiers about such blocks before taking them for huge ones.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "alloc.h"
+#include "hybrid.h"
+#include "safeio.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The virtual address space reserved for the small and medium tiers. */
+#define REGION_SIZE (HYBRID_SMALL_SIZE + HYBRID_MEDIUM_SIZE)
+
+/**
+ * The space in front of a huge block.  It holds the length of the block's
+ * mapping in its last word, and is a whole cache line so that huge blocks are
+ * line aligned.
+ */
+#define HUGE_HEADER_SIZE 64
+
+/** Given a pointer to a huge block, obtain the length of its mapping. */
+#define HUGE_MAPPING_LENGTH(bp) (((size_t*)(bp))[-1])
+
+/** The tier that serves a request of a given size. */
+#define TIER_FOR_SIZE(size) ((size) <= HYBRID_SMALL_MAX  ? ALLOC_TIER_SMALL  : \
+			     (size) <= HYBRID_MEDIUM_MAX ? ALLOC_TIER_MEDIUM : \
+			     ALLOC_TIER_HUGE)
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The beginning and end of the region shared by the small and medium tiers. */
+static intptr_t region_start = 0;
+static intptr_t region_end   = 0;
+
+/** The end of the small tier's part, and start of the medium tier's. */
+static intptr_t small_end    = 0;
+
+/** The statistics of each tier, but for their extents. */
+static alloc_tier_stats_s tier_stats[ALLOC_TIERS];
+
+/** The number of bytes mapped for huge blocks. */
+static size_t huge_mapped = 0;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Reserve a tier's part of the region, the small tier's first, mapping the
+ * region if neither tier has yet.  A failure to map it is fatal.
+ *
+ * \param tier The small or medium tier.
+ * \return The start of the tier's part.
+ */
+void* hybrid_reserve (alloc_tier_t tier) {
+
+  assert(tier == ALLOC_TIER_SMALL || tier == ALLOC_TIER_MEDIUM);
+  if (region_start == 0) {
+    void* region = mmap(NULL,
+			REGION_SIZE,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS,
+			-1,
+			0);
+    if (region == MAP_FAILED) {
+      ERROR("Could not mmap() hybrid region");
+    }
+    region_start = (intptr_t)region;
+    region_end   = region_start + REGION_SIZE;
+    small_end    = region_start + HYBRID_SMALL_SIZE;
+  }
+  return (void*)(tier == ALLOC_TIER_SMALL ? region_start : small_end);
+
+} // hybrid_reserve ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Initialize the tiers when the library is loaded, before the program's own
+ * code runs, so that allocation need not check for them.  A tier whose
+ * bootstrap arena ran out before then has initialized itself already.
+ */
+static void __attribute__((constructor)) init () {
+
+  sf_init();
+  bf_init();
+  DEBUG("hybrid-alloc initialized");
+
+} // init ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the tier that allocated a block, from its address.
+ *
+ * \param ptr A pointer to an allocated block.
+ * \return The block's tier.
+ */
+static alloc_tier_t tier_of (void* ptr) {
+
+  intptr_t addr = (intptr_t)ptr;
+  if (addr < region_start || region_end <= addr) {
+    return ALLOC_TIER_HUGE;
+  }
+  return addr < small_end ? ALLOC_TIER_SMALL : ALLOC_TIER_MEDIUM;
+
+} // tier_of ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Is a block one from a tier's bootstrap arena, served before the tiers were
+ * initialized?  Such a block lies outside the region, as a huge block does.
+ *
+ * \param ptr A pointer to a block outside the region.
+ * \return `true` if the block is from a bootstrap arena; `false` otherwise.
+ */
+static bool is_bootstrap (void* ptr) {
+
+  return sf_bootstrap_block(ptr) || bf_bootstrap_block(ptr);
+
+} // is_bootstrap ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Map a huge block of its own, unless its length with the header would
+ * overflow.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+static void* huge_malloc (size_t size) {
+
+  if (size > PTRDIFF_MAX) {
+    return NULL;
+  }
+  size_t length  = HUGE_HEADER_SIZE + size;
+  void*  mapping = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    DEBUG("Could not mmap() huge allocation", size);
+    return NULL;
+  }
+
+  intptr_t block_addr = (intptr_t)mapping + HUGE_HEADER_SIZE;
+  HUGE_MAPPING_LENGTH(block_addr) = length;
+  huge_mapped += length;
+  return (void*)block_addr;
+
+} // huge_malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Unmap a huge block.
+ *
+ * \param ptr A pointer to the huge block.
+ */
+static void huge_free (void* ptr) {
+
+  size_t length = HUGE_MAPPING_LENGTH(ptr);
+  assert(length > HUGE_HEADER_SIZE);
+  huge_mapped -= length;
+  if (munmap((void*)((intptr_t)ptr - HUGE_HEADER_SIZE), length) == -1) {
+    ERROR("Could not unmap huge block", (intptr_t)ptr);
+  }
+
+} // huge_free ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Resize a huge block, letting `mremap()` move it if need be.
+ *
+ * \param ptr  A pointer to the huge block.
+ * \param size The new size of the block.
+ * \return A pointer to the resized block, if successful; `NULL` if unsuccessful.
+ */
+static void* huge_realloc (void* ptr, size_t size) {
+
+  if (size > PTRDIFF_MAX) {
+    return NULL;
+  }
+  size_t old_length = HUGE_MAPPING_LENGTH(ptr);
+  size_t new_length = HUGE_HEADER_SIZE + size;
+  void*  mapping    = mremap((void*)((intptr_t)ptr - HUGE_HEADER_SIZE), old_length,
+			     new_length, MREMAP_MAYMOVE);
+  if (mapping == MAP_FAILED) {
+    DEBUG("realloc(): mremap() of huge block failed", old_length, new_length);
+    return NULL;
+  }
+
+  void* new_block_ptr = (void*)((intptr_t)mapping + HUGE_HEADER_SIZE);
+  HUGE_MAPPING_LENGTH(new_block_ptr) = new_length;
+  huge_mapped += new_length - old_length;
+  return new_block_ptr;
+
+} // huge_realloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the number of bytes that a block may hold, asking its tier.
+ *
+ * \param ptr  A pointer to an allocated block.
+ * \param tier The block's tier.
+ * \return The usable size of the block, in bytes.
+ */
+static size_t usable_size (void* ptr, alloc_tier_t tier) {
+
+  switch (tier) {
+  case ALLOC_TIER_SMALL:
+    return sf_usable_size(ptr);
+  case ALLOC_TIER_MEDIUM:
+    return bf_usable_size(ptr);
+  default:
+    if (sf_bootstrap_block(ptr)) {
+      return sf_usable_size(ptr);
+    }
+    if (bf_bootstrap_block(ptr)) {
+      return bf_usable_size(ptr);
+    }
+    return HUGE_MAPPING_LENGTH(ptr) - HUGE_HEADER_SIZE;
+  }
+
+} // usable_size ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space from the tier for its size.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* malloc (size_t size) {
+
+  if (size == 0) {
+    return NULL;
+  }
+
+  alloc_tier_t tier = TIER_FOR_SIZE(size);
+  void*        new_block_ptr;
+  switch (tier) {
+  case ALLOC_TIER_SMALL:
+    new_block_ptr = sf_malloc(size);
+    break;
+  case ALLOC_TIER_MEDIUM:
+    new_block_ptr = bf_malloc(size);
+    break;
+  default:
+    new_block_ptr = huge_malloc(size);
+    break;
+  }
+
+  if (new_block_ptr != NULL) {
+    tier_stats[tier].allocs += 1;
+  }
+  return new_block_ptr;
+
+} // malloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Deallocate a given block, returning it to the tier that allocated it.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+void free (void* ptr) {
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  alloc_tier_t tier = tier_of(ptr);
+  switch (tier) {
+  case ALLOC_TIER_SMALL:
+    sf_free(ptr);
+    break;
+  case ALLOC_TIER_MEDIUM:
+    bf_free(ptr);
+    break;
+  default:
+    // Blocks from the bootstrap arenas are never reused.
+    if (is_bootstrap(ptr)) {
+      return;
+    }
+    huge_free(ptr);
+    break;
+  }
+  tier_stats[tier].frees += 1;
+
+} // free ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block of `nmemb * size` bytes on the heap, zeroing its contents.
+ *
+ * \param nmemb The number of elements in the new block.
+ * \param size  The size, in bytes, of each of the `nmemb` elements.
+ * \return      A pointer to the newly allocated and zeroed block, if successful;
+ *              `NULL` if unsuccessful.
+ */
+void* calloc (size_t nmemb, size_t size) {
+
+  size_t block_size    = nmemb * size;
+  void*  new_block_ptr = malloc(block_size);
+
+  // Fresh huge mappings are already zeroed.
+  if (new_block_ptr != NULL && TIER_FOR_SIZE(block_size) != ALLOC_TIER_HUGE) {
+    memset(new_block_ptr, 0, block_size);
+  }
+
+  return new_block_ptr;
+
+} // calloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Update the given block at `ptr` to take on the given `size`.  A block whose
+ * new size belongs to the same tier is resized by that tier; otherwise, it is
+ * moved to a new block of the new size's tier.
+ *
+ * \param ptr  The block to be assigned a new size.
+ * \param size The new size that the block should assume.
+ * \return     A pointer to the resultant block, which may be `ptr` itself, or
+ *             may be a newly allocated block.
+ */
+void* realloc (void* ptr, size_t size) {
+
+  if (ptr == NULL) {
+    return malloc(size);
+  }
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  // A block from a bootstrap arena cannot be resized, so it is always moved.
+  alloc_tier_t tier = tier_of(ptr);
+  if (tier == TIER_FOR_SIZE(size) && !(tier == ALLOC_TIER_HUGE && is_bootstrap(ptr))) {
+    switch (tier) {
+    case ALLOC_TIER_SMALL:
+      return sf_realloc(ptr, size);
+    case ALLOC_TIER_MEDIUM:
+      return bf_realloc(ptr, size);
+    default:
+      return huge_realloc(ptr, size);
+    }
+  }
+
+  // Move the block to the other tier.
+  void*  new_block_ptr = malloc(size);
+  size_t old_size      = usable_size(ptr, tier);
+  if (new_block_ptr != NULL) {
+    memcpy(new_block_ptr, ptr, old_size < size ? old_size : size);
+    free(ptr);
+  }
+  return new_block_ptr;
+
+} // realloc ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate a block that sits alone on its cache line(s), from the tier for its
+ * size.  Huge blocks follow a one-line header in a mapping of their own.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* malloc_cacheline (size_t size) {
+
+  if (size == 0) {
+    return NULL;
+  }
+
+  alloc_tier_t tier = TIER_FOR_SIZE(size);
+  void*        new_block_ptr;
+  switch (tier) {
+  case ALLOC_TIER_SMALL:
+    new_block_ptr = sf_malloc_cacheline(size);
+    break;
+  case ALLOC_TIER_MEDIUM:
+    new_block_ptr = bf_malloc_cacheline(size);
+    break;
+  default:
+    new_block_ptr = huge_malloc(size);
+    break;
+  }
+
+  if (new_block_ptr != NULL) {
+    tier_stats[tier].allocs += 1;
+  }
+  return new_block_ptr;
+
+} // malloc_cacheline ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the number of bytes carved for blocks by the small and medium tiers.
+ * Huge blocks are mapped and unmapped whole, so they are not counted.
+ *
+ * \return The heap extent, in bytes.
+ */
+size_t alloc_heap_extent () {
+
+  if (region_start == 0) {
+    return 0;
+  }
+  return sf_heap_extent() + bf_heap_extent();
+
+} // alloc_heap_extent ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Visit every block of the small and then the medium tier, allocated or free,
+ * in the order of their parts of the region.  Huge blocks are not visited.
+ *
+ * \param callback The function to call for each block.
+ * \param arg      The argument to pass to `callback`.
+ */
+void alloc_heap_walk (alloc_walk_f callback, void* arg) {
+
+  sf_heap_walk(callback, arg);
+  bf_heap_walk(callback, arg);
+
+} // alloc_heap_walk ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Visit each allocated block of the small and medium tiers that starts within
+ * a range of addresses.
+ *
+ * \param base     The start of the range.
+ * \param size     The size of the range, in bytes.
+ * \param callback The function to call for each block.
+ * \param arg      The argument to pass to `callback`.
+ * \return The number of blocks visited.
+ */
+size_t malloc_iterate (uintptr_t base, size_t size, alloc_walk_f callback, void* arg) {
+
+  return (sf_malloc_iterate(base, size, callback, arg) +
+	  bf_malloc_iterate(base, size, callback, arg));
+
+} // malloc_iterate ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Report the statistics of one tier.
+ *
+ * \param tier  The tier.
+ * \param stats Where to store its statistics.
+ */
+void alloc_tier_stats (alloc_tier_t tier, alloc_tier_stats_s* stats) {
+
+  assert(tier < ALLOC_TIERS);
+  *stats = tier_stats[tier];
+  if (region_start == 0) {
+    stats->extent = 0;
+    return;
+  }
+  switch (tier) {
+  case ALLOC_TIER_SMALL:
+    stats->extent = sf_heap_extent();
+    break;
+  case ALLOC_TIER_MEDIUM:
+    stats->extent = bf_heap_extent();
+    break;
+  default:
+    stats->extent = huge_mapped;
+    break;
+  }
+
+} // alloc_tier_stats ()
+// ==============================================================================
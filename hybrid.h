@@ -0,0 +1,139 @@
+// ==============================================================================
+/**
+ * hybrid.h
+ *
+ * The interface between the hybrid allocator and its tiers.  sf-alloc, built
+ * with `HYBRID_SMALL_TIER`, and bf-alloc, built with `HYBRID_MEDIUM_TIER`,
+ * include this header, which gives their entry points tier-specific names and
+ * sizes their heaps to their parts of the hybrid allocator's region.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_HYBRID_H)
+#define _HYBRID_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "alloc.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The largest request served by the small tier, its largest size class. */
+#define HYBRID_SMALL_MAX 2048
+
+/** The largest request served by the medium tier; larger ones are mapped. */
+#define HYBRID_MEDIUM_MAX (256 * 1024)
+
+/** The sizes of the tiers' parts of the region, small tier first. */
+#define HYBRID_SMALL_SIZE  ((size_t)512 << 20)
+#define HYBRID_MEDIUM_SIZE ((size_t)1536 << 20)
+
+/** Give the including tier its name and its part of the region. */
+#if defined (HYBRID_SMALL_TIER)
+#define HEAP_SIZE                HYBRID_SMALL_SIZE
+#define init()                   sf_init()
+#define check()                  sf_check()
+#define malloc(size)             sf_malloc(size)
+#define free(ptr)                sf_free(ptr)
+#define calloc(nmemb, size)      sf_calloc(nmemb, size)
+#define realloc(ptr, size)       sf_realloc(ptr, size)
+#define malloc_cacheline(size)   sf_malloc_cacheline(size)
+#define alloc_heap_extent()      sf_heap_extent()
+#define alloc_heap_walk(cb, arg) sf_heap_walk(cb, arg)
+#define malloc_iterate(base, size, cb, arg) sf_malloc_iterate(base, size, cb, arg)
+#define usable_size(ptr)         sf_usable_size(ptr)
+#define bootstrap_block(ptr)     sf_bootstrap_block(ptr)
+#elif defined (HYBRID_MEDIUM_TIER)
+#define HEAP_SIZE                HYBRID_MEDIUM_SIZE
+#define init()                   bf_init()
+#define malloc(size)             bf_malloc(size)
+#define free(ptr)                bf_free(ptr)
+#define calloc(nmemb, size)      bf_calloc(nmemb, size)
+#define realloc(ptr, size)       bf_realloc(ptr, size)
+#define malloc_cacheline(size)   bf_malloc_cacheline(size)
+#define malloc_ephemeral(size)   bf_malloc_ephemeral(size)
+#define ephemeral_scope_exit()   bf_ephemeral_scope_exit()
+#define halloc(size)             bf_halloc(size)
+#define hlock(handle)            bf_hlock(handle)
+#define hunlock(handle)          bf_hunlock(handle)
+#define hfree(handle)            bf_hfree(handle)
+#define alloc_heap_extent()      bf_heap_extent()
+#define alloc_heap_walk(cb, arg) bf_heap_walk(cb, arg)
+#define malloc_iterate(base, size, cb, arg) bf_malloc_iterate(base, size, cb, arg)
+#define usable_size(ptr)         bf_usable_size(ptr)
+#define bootstrap_block(ptr)     bf_bootstrap_block(ptr)
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Reserve a tier's part of the hybrid allocator's region, mapping the region
+ * if neither tier has yet.  Each tier calls this once, from its `init()`,
+ * which may run before the hybrid allocator's constructor, if the tier's
+ * bootstrap arena runs out.
+ *
+ * \param tier The small or medium tier.
+ * \return The start of the tier's part.
+ */
+void* hybrid_reserve (alloc_tier_t tier);
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The entry points of the small tier, sf-alloc.  `sf_usable_size()` returns
+ * the number of bytes that a block may hold, its class size, and
+ * `sf_bootstrap_block()` whether a block is from the tier's bootstrap arena.
+ */
+void   sf_init (void);
+void*  sf_malloc (size_t size);
+void   sf_free (void* ptr);
+void*  sf_realloc (void* ptr, size_t size);
+void*  sf_malloc_cacheline (size_t size);
+size_t sf_heap_extent (void);
+void   sf_heap_walk (alloc_walk_f callback, void* arg);
+size_t sf_malloc_iterate (uintptr_t base, size_t size, alloc_walk_f callback, void* arg);
+size_t sf_usable_size (void* ptr);
+bool   sf_bootstrap_block (void* ptr);
+
+/**
+ * The entry points of the medium tier, bf-alloc.  `bf_usable_size()` returns
+ * the number of bytes that a block may hold, the size in its header, and
+ * `bf_bootstrap_block()` whether a block is from the tier's bootstrap arena.
+ */
+void   bf_init (void);
+void*  bf_malloc (size_t size);
+void   bf_free (void* ptr);
+void*  bf_realloc (void* ptr, size_t size);
+void*  bf_malloc_cacheline (size_t size);
+size_t bf_heap_extent (void);
+void   bf_heap_walk (alloc_walk_f callback, void* arg);
+size_t bf_malloc_iterate (uintptr_t base, size_t size, alloc_walk_f callback, void* arg);
+size_t bf_usable_size (void* ptr);
+bool   bf_bootstrap_block (void* ptr);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _HYBRID_H
+// ==============================================================================
@@ -0,0 +1,245 @@
+// ==============================================================================
+/**
+ * pressure.c
+ *
+ * A memory pressure monitor for the allocators, built on the cgroup v2 files
+ * of the cgroup that the process runs in.  Like safeio, it does not rely on
+ * heap allocation:  it is called from within `malloc()` and `free()`.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/vfs.h>
+
+#include "pressure.h"
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The longest cgroup directory path, and the longest file that is read. */
+#define MAX_PATH_LENGTH 1024
+#define MAX_FILE_LENGTH 1024
+
+/** The root of the cgroup v2 hierarchy, and its filesystem's magic number. */
+#define CGROUP_ROOT         "/sys/fs/cgroup"
+#define CGROUP2_SUPER_MAGIC 0x63677270
+
+/**
+ * The PSI trigger registered on `memory.pressure`:  report when some task has
+ * stalled on memory for 100 ms within any 1 s window.
+ */
+#define PSI_TRIGGER "some 100000 1000000"
+
+/**
+ * The share of the last 10 seconds, in percent, that some task may stall on
+ * memory before the cgroup is under pressure.
+ */
+#if !defined (PRESSURE_STALL_PERCENT)
+#define PRESSURE_STALL_PERCENT 10
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The cgroup directory, with a trailing slash, and its length. */
+static char   cgroup_dir[MAX_PATH_LENGTH];
+static size_t cgroup_dir_length = 0;
+
+/** The PSI trigger on `memory.pressure`, or -1 if there is none. */
+static int    trigger_fd = -1;
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Open a file in the cgroup directory.
+ *
+ * \param name  The name of the file.
+ * \param flags The flags with which to open it.
+ * \return The file descriptor, or -1 if the file could not be opened.
+ */
+static int open_file (const char* name, int flags) {
+
+  char   path[MAX_PATH_LENGTH + 32];
+  size_t name_length = strlen(name);
+  if (cgroup_dir_length == 0 || name_length >= 32) {
+    return -1;
+  }
+  memcpy(path, cgroup_dir, cgroup_dir_length);
+  memcpy(path + cgroup_dir_length, name, name_length + 1);
+  return open(path, flags | O_CLOEXEC);
+
+} // open_file ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read the start of a file into a buffer, ending it with a null.
+ *
+ * \param fd     The file to read, which is then closed.
+ * \param buffer The buffer, of `MAX_FILE_LENGTH` bytes.
+ * \return The number of bytes read, or -1 if the file could not be read.
+ */
+static ssize_t read_file (int fd, char* buffer) {
+
+  if (fd == -1) {
+    return -1;
+  }
+  ssize_t length = read(fd, buffer, MAX_FILE_LENGTH - 1);
+  close(fd);
+  if (length < 0) {
+    return -1;
+  }
+  buffer[length] = '\0';
+  return length;
+
+} // read_file ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read a file of the cgroup directory that holds a count of bytes.
+ *
+ * \param name The name of the file.
+ * \return The count, or 0 if the file is missing or holds `max`.
+ */
+static size_t read_bytes (const char* name) {
+
+  char buffer[MAX_FILE_LENGTH];
+  if (read_file(open_file(name, O_RDONLY), buffer) <= 0) {
+    return 0;
+  }
+  return strtoull(buffer, NULL, 10);
+
+} // read_bytes ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read the `some avg10` figure of the cgroup's `memory.pressure`.
+ *
+ * \return The percentage of time stalled, truncated, or 0 if it is missing.
+ */
+static long read_stall_percent () {
+
+  char buffer[MAX_FILE_LENGTH];
+  if (read_file(open_file("memory.pressure", O_RDONLY), buffer) <= 0) {
+    return 0;
+  }
+  char* some = strstr(buffer, "some avg10=");
+  if (some == NULL) {
+    return 0;
+  }
+  return strtol(some + strlen("some avg10="), NULL, 10);
+
+} // read_stall_percent ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+bool pressure_init () {
+
+  // an explicit directory, such as a fake one made for a test, comes first
+  const char* dir = getenv("ALLOC_CGROUP");
+  size_t      length;
+  if (dir != NULL) {
+    length = strlen(dir);
+    if (length == 0 || length + 2 > MAX_PATH_LENGTH) {
+      return false;
+    }
+    memcpy(cgroup_dir, dir, length);
+  } else {
+
+    // otherwise find the process's entry in the unified hierarchy, "0::<path>"
+    char buffer[MAX_FILE_LENGTH];
+    if (read_file(open("/proc/self/cgroup", O_RDONLY | O_CLOEXEC), buffer) <= 0) {
+      return false;
+    }
+    char* entry = strstr(buffer, "0::/");
+    if (entry == NULL || (entry != buffer && entry[-1] != '\n')) {
+      return false;
+    }
+    entry += strlen("0::");
+    size_t entry_length = strcspn(entry, "\n");
+    length              = strlen(CGROUP_ROOT) + entry_length;
+    if (length + 2 > MAX_PATH_LENGTH) {
+      return false;
+    }
+    memcpy(cgroup_dir, CGROUP_ROOT, strlen(CGROUP_ROOT));
+    memcpy(cgroup_dir + strlen(CGROUP_ROOT), entry, entry_length);
+
+  }
+  cgroup_dir[length]     = '/';
+  cgroup_dir[length + 1] = '\0';
+  cgroup_dir_length      = length + 1;
+
+  // a trigger may only be written to the kernel's own file; a fake one would
+  // simply be overwritten
+  int           fd = open_file("memory.pressure", O_RDWR | O_NONBLOCK);
+  struct statfs fs;
+  if (fd != -1 && fstatfs(fd, &fs) == 0 && fs.f_type == CGROUP2_SUPER_MAGIC &&
+      write(fd, PSI_TRIGGER, strlen(PSI_TRIGGER) + 1) > 0) {
+    trigger_fd = fd;
+  } else if (fd != -1) {
+    close(fd);
+  }
+
+  return true;
+
+} // pressure_init ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+bool pressure_high () {
+
+  if (cgroup_dir_length == 0) {
+    return false;
+  }
+
+  // near the limit, the kernel will soon reclaim, or kill, on its own
+  size_t limit = read_bytes("memory.max");
+  if (limit != 0 && read_bytes("memory.current") >= limit - limit / 8) {
+    return true;
+  }
+
+  // a fired trigger reports stalls within the last second
+  if (trigger_fd != -1) {
+    struct pollfd poll_fd = { .fd = trigger_fd, .events = POLLPRI };
+    if (poll(&poll_fd, 1, 0) == 1 && (poll_fd.revents & POLLPRI)) {
+      return true;
+    }
+  }
+
+  return read_stall_percent() >= PRESSURE_STALL_PERCENT;
+
+} // pressure_high ()
+// ==============================================================================
+
@@ -0,0 +1,57 @@
+// ==============================================================================
+/**
+ * pressure.h
+ *
+ * A memory pressure monitor for the allocators, built on the cgroup v2 files
+ * of the cgroup that the process runs in.  Like safeio, it does not rely on
+ * heap allocation.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// Avoid multiple inclusion.
+
+#if !defined (_PRESSURE_H)
+#define _PRESSURE_H
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stdbool.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the cgroup directory to monitor:  the one named by the `ALLOC_CGROUP`
+ * environment variable, if set, or else the process's own cgroup v2 directory
+ * under `/sys/fs/cgroup`.  If that directory's `memory.pressure` is a real
+ * PSI file, also register a trigger on it, to be told of stalls as they
+ * happen.
+ *
+ * \return `true` if there is a directory to monitor; `false` otherwise.
+ */
+bool pressure_init (void);
+
+/**
+ * Sample the cgroup:  is its memory usage within an eighth of `memory.max`,
+ * has the PSI trigger fired, or is the share of time that
+ * some task stalled on memory over the last 10 seconds above
+ * `PRESSURE_STALL_PERCENT`?  Files that are missing count as no pressure.
+ *
+ * \return `true` if the cgroup is under memory pressure; `false` otherwise.
+ */
+bool pressure_high (void);
+// ==============================================================================
+
+
+
+// ==============================================================================
+#endif // _PRESSURE_H
+// ==============================================================================
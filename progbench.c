@@ -0,0 +1,410 @@
+// ==============================================================================
+/**
+ * progbench.c
+ *
+ * Run real programs under each allocator, to catch allocators that only look
+ * good on microbenchmarks.  Each program in a fixed, offline set is run once
+ * per allocator via `LD_PRELOAD` (or with none, under glibc's), e.g.:
+ *
+ *   ./progbench 400000 glibc ./libbf.so ./libsf.so
+ *
+ * The programs work in a scratch directory, on a generated text file of the
+ * given number of lines:  a sort of it, a compression of it, a build of
+ * bf-alloc, and Python and Perl scripts over it.  Programs that are not
+ * installed are skipped.  Each is run a few times untraced, reporting the best
+ * wall time and the largest peak RSS and page faults, of the program and its
+ * children; then once more under `ptrace()`, to count its system calls.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS
+
+/** The number of untraced runs of each program per allocator. */
+#define RUNS 3
+
+/** The most allocators that may be compared. */
+#define MAX_ALLOCATORS 8
+// ==============================================================================
+
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+/** A program to run, as a shell command in the scratch directory. */
+typedef struct program {
+
+  /** The program's name in the report. */
+  const char* name;
+
+  /** The executable that must be installed for the program to run. */
+  const char* requires;
+
+  /**
+   * The command.  `input.txt` is the generated file, and `$SRC` the directory
+   * holding this repository's sources.
+   */
+  const char* command;
+
+} program_s;
+
+/** What one run of a program cost. */
+typedef struct cost {
+
+  /** The wall time, in nanoseconds. */
+  uint64_t wall;
+
+  /** The peak RSS, in KB, and the page faults, of the program and its children. */
+  long     rss;
+  long     minor_faults;
+  long     major_faults;
+
+  /** The system calls made by the program and its children, or -1 if unknown. */
+  long     syscalls;
+
+  /** Did the program exit successfully? */
+  int      succeeded;
+
+} cost_s;
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The programs, which should allocate in different patterns. */
+static const program_s programs[] = {
+  { "sort",   "sort",    "sort --parallel=1 -o sorted.txt input.txt" },
+  { "gzip",   "gzip",    "gzip -6 -c input.txt > input.txt.gz" },
+  { "build",  "cc",      "cc -std=gnu99 -O2 -fno-builtin -fPIC -shared -o libbf.so "
+                         "\"$SRC/bf-alloc.c\" \"$SRC/safeio.c\"" },
+  { "python", "python3", "python3 -c '"
+                         "import collections, json\n"
+                         "words = open(\"input.txt\").read().split()\n"
+                         "counts = collections.Counter(words)\n"
+                         "pairs = sorted(counts.items(), key=lambda p: (-p[1], p[0]))\n"
+                         "open(\"counts.json\", \"w\").write(json.dumps(pairs))\n"
+                         "'" },
+  { "perl",   "perl",    "perl -ne '$c{$_}++ for split; "
+                         "END { print \"$_ $c{$_}\\n\" for sort keys %c }' "
+                         "input.txt > counts.txt" },
+};
+
+/** The number of programs. */
+#define PROGRAMS (sizeof(programs) / sizeof(programs[0]))
+// ==============================================================================
+
+
+
+// ==============================================================================
+/** Return the current time in nanoseconds. */
+static uint64_t now_ns () {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+} // now_ns ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Determine whether an executable is installed, somewhere on the `PATH`.
+ *
+ * \param name The executable's name.
+ * \return 1 if it is found; 0 otherwise.
+ */
+static int installed (const char* name) {
+
+  const char* path = getenv("PATH");
+  while (path != NULL && *path != '\0') {
+    const char* end = strchrnul(path, ':');
+    char        candidate[PATH_MAX];
+    snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)(end - path), path, name);
+    if (access(candidate, X_OK) == 0) {
+      return 1;
+    }
+    path = (*end == ':') ? end + 1 : end;
+  }
+  return 0;
+
+} // installed ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Write the input file:  `lines` lines of pseudo-random words, with a skewed
+ * vocabulary so that some words repeat often and others rarely.
+ *
+ * \param path  The file to write.
+ * \param lines The number of lines.
+ */
+static void generate_input (const char* path, long lines) {
+
+  FILE* input = fopen(path, "w");
+  if (input == NULL) {
+    perror(path);
+    exit(1);
+  }
+
+  uint64_t state = 1;
+  for (long line = 0; line < lines; line += 1) {
+    int words = 1 + line % 12;
+    for (int word = 0; word < words; word += 1) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      unsigned int number = (state >> 33) % ((state >> 20) % 2 ? 1000 : 200000);
+      fprintf(input, "%sw%u", word == 0 ? "" : " ", number);
+    }
+    fputc('\n', input);
+  }
+  fclose(input);
+
+} // generate_input ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * In a new child, run a program under an allocator, with its output discarded.
+ *
+ * \param program The program.
+ * \param library The allocator's library, or `NULL` for the C library's.
+ * \param traced  Whether to stop for the parent to trace the program.
+ * \return The child's process ID.
+ */
+static pid_t start_program (const program_s* program, const char* library, int traced) {
+
+  fflush(stdout);
+  pid_t child = fork();
+  if (child == -1) {
+    perror("fork");
+    exit(1);
+  }
+  if (child == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    if (library != NULL) {
+      setenv("LD_PRELOAD", library, 1);
+    }
+    if (traced) {
+      ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+      raise(SIGSTOP);
+    }
+    execl("/bin/sh", "sh", "-c", program->command, (char*)NULL);
+    _exit(127);
+  }
+  return child;
+
+} // start_program ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Count the system calls made by a traced child and all of its descendants,
+ * until it exits.
+ *
+ * \param child The child, stopped before it runs the program.
+ * \return The number of system calls, or -1 if they could not be traced.
+ */
+static long count_syscalls (pid_t child) {
+
+  int status;
+  if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status) ||
+      ptrace(PTRACE_SETOPTIONS, child, NULL,
+	     PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+	     PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL) != 0) {
+    // tracing is not permitted here, so let the child run untraced
+    kill(child, SIGKILL);
+    waitpid(child, &status, 0);
+    return -1;
+  }
+
+  // Each call stops its caller twice, on entry and on exit.  Where the kernel
+  // cannot say which, count half of the stops instead.  Trace until no tracee
+  // is left to wait for.
+  long  entries = 0;
+  long  stops   = 0;
+  pid_t pid;
+  ptrace(PTRACE_SYSCALL, child, NULL, 0);
+  while ((pid = waitpid(-1, &status, __WALL)) != -1) {
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      continue;
+    }
+
+    int signal = WSTOPSIG(status);
+    if (signal == (SIGTRAP | 0x80)) {
+      struct __ptrace_syscall_info info;
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0) {
+	entries += (info.op == PTRACE_SYSCALL_INFO_ENTRY);
+      } else {
+	stops += 1;
+      }
+      signal = 0;
+    } else if (status >> 16 != 0) {
+      // a fork, clone, or exec; new processes and threads are traced from
+      // their start
+      signal = 0;
+    } else if (signal == SIGSTOP) {
+      // the first stop of a new tracee, not meant for the program
+      signal = 0;
+    }
+    ptrace(PTRACE_SYSCALL, pid, NULL, signal);
+
+  }
+  return entries + stops / 2;
+
+} // count_syscalls ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Run a program under an allocator, `RUNS` times untraced and once traced.
+ *
+ * \param program The program.
+ * \param library The allocator's library, or `NULL` for the C library's.
+ * \return What the program cost:  the best wall time, and the largest RSS and
+ *         fault counts.
+ */
+static cost_s run_program (const program_s* program, const char* library) {
+
+  cost_s cost = { UINT64_MAX, 0, 0, 0, -1, 1 };
+  for (int run = 0; run < RUNS; run += 1) {
+    uint64_t      start = now_ns();
+    pid_t         child = start_program(program, library, 0);
+    int           status;
+    struct rusage usage;
+    if (wait4(child, &status, 0, &usage) != child) {
+      perror("wait4");
+      exit(1);
+    }
+    uint64_t wall = now_ns() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      cost.succeeded = 0;
+    }
+    if (wall < cost.wall) {
+      cost.wall = wall;
+    }
+    if (usage.ru_maxrss > cost.rss) {
+      cost.rss = usage.ru_maxrss;
+    }
+    if (usage.ru_minflt > cost.minor_faults) {
+      cost.minor_faults = usage.ru_minflt;
+    }
+    if (usage.ru_majflt > cost.major_faults) {
+      cost.major_faults = usage.ru_majflt;
+    }
+  }
+
+  cost.syscalls = count_syscalls(start_program(program, library, 1));
+  return cost;
+
+} // run_program ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The entry point.  Generate the input, then run every installed program under
+ * every allocator named.
+ */
+int main (int argc, char** argv) {
+
+  if (argc < 3 || argc - 2 > MAX_ALLOCATORS) {
+    fprintf(stderr, "USAGE: %s <# input lines> <glibc | library>...\n", argv[0]);
+    return 1;
+  }
+  long lines = atol(argv[1]);
+
+  // The programs run in a scratch directory, so name the libraries and sources
+  // by absolute paths.
+  char* libraries[MAX_ALLOCATORS];
+  int   allocators = argc - 2;
+  for (int i = 0; i < allocators; i += 1) {
+    libraries[i] = NULL;
+    if (strcmp(argv[i + 2], "glibc") != 0 &&
+	(libraries[i] = realpath(argv[i + 2], NULL)) == NULL) {
+      perror(argv[i + 2]);
+      return 1;
+    }
+  }
+  char source[PATH_MAX];
+  if (getcwd(source, sizeof(source)) == NULL) {
+    perror("getcwd");
+    return 1;
+  }
+  setenv("SRC", source, 1);
+
+  char scratch[] = "/tmp/progbench.XXXXXX";
+  if (mkdtemp(scratch) == NULL || chdir(scratch) != 0) {
+    perror(scratch);
+    return 1;
+  }
+  generate_input("input.txt", lines);
+
+  printf("%-7s %-10s %10s %10s %10s %7s %9s\n",
+	 "program", "allocator", "wall ms", "peak KB", "minflt", "majflt", "syscalls");
+  for (size_t p = 0; p < PROGRAMS; p += 1) {
+
+    if (!installed(programs[p].requires)) {
+      printf("%-7s (skipped:  %s is not installed)\n", programs[p].name, programs[p].requires);
+      continue;
+    }
+    for (int i = 0; i < allocators; i += 1) {
+      cost_s      cost = run_program(&programs[p], libraries[i]);
+      const char* name = libraries[i] == NULL ? "glibc" : strrchr(libraries[i], '/') + 1;
+      printf("%-7s %-10s %10.1f %10ld %10ld %7ld ",
+	     programs[p].name, name, cost.wall / 1e6, cost.rss,
+	     cost.minor_faults, cost.major_faults);
+      if (cost.syscalls < 0) {
+	printf("%9s", "n/a");
+      } else {
+	printf("%9ld", cost.syscalls);
+      }
+      printf("%s\n", cost.succeeded ? "" : "  FAILED");
+    }
+
+  }
+
+  // Clear out the scratch directory.
+  char command[PATH_MAX + 16];
+  snprintf(command, sizeof(command), "rm -rf %s", scratch);
+  return system(command) == 0 ? 0 : 1;
+
+} // main ()
+// ==============================================================================
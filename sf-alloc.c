@@ -7,6 +7,70 @@
  * class size, and the first available free block allocated from that free list.
  * If the list does not contain any blocks, a page is allocated and used to
  * populate that free list.
+ *
+ * Each page keeps its own free list and a count of its live blocks, and each
+ * size class keeps a list of its _partial pages_, those with free blocks.  A
+ * page that fills is dropped from that list, and one that regains a free block
+ * is put back at the front, so that the fullest pages are allocated from first
+ * and the others drain.  A page whose blocks are all freed goes to a pool of
+ * free pages for any size class to reuse, and pages beyond a few in the pool
+ * are returned to the OS with `madvise()`.
+ *
+ * A bitmap records which size classes have partial pages.  When the heap is
+ * exhausted, a page that is wholly free but retained by another class is
+ * reformatted for the request.  Failing that, a free block of the next larger
+ * class, found with one bit scan, is carved into a _sub-page_:  a header and
+ * blocks of the requested class, laid out as in a page.  The sub-page holds a
+ * place in its page's chain of carved blocks, by which `free()` finds its
+ * header, and goes back to its page as a block once all of its blocks are
+ * free.  A larger block too small to carve serves the request whole.
+ *
+ * The heap is initialized by a library constructor, so `malloc()` does not
+ * check for it:  before then, its bounds are 0, and a request fails on its slow
+ * path, where it is served from a small static _bootstrap arena_ instead.  This
+ * serves the requests made by the dynamic loader and the C library while they
+ * start up.  Blocks there look like large blocks, and are never reused.
+ *
+ * Each page records the offset of its first block, so that
+ * `alloc_heap_walk()` and `malloc_iterate()` can walk the heap page by page,
+ * telling allocated blocks from free ones by the page's free list.
+ *
+ * When built with `CACHE_COLORING`, the first block of each new page starts at
+ * a rotating cache-line offset (its _color_), so that the blocks of a class do
+ * not sit at the same offsets, and in the same cache sets, on every page.
+ *
+ * When built with `THREAD_SAFE`, each thread keeps its own free lists and owns
+ * the pages that it carves, so adjacent small blocks are never handed to
+ * different threads.  A block freed by another thread is returned to its
+ * owner through a lock-free _remote free_ list.
+ *
+ * When built with `COMPRESSED_LINKS`, free list links and page headers hold
+ * 32-bit offsets into the heap instead of pointers, which allows a smallest
+ * size class of 8 bytes.
+ *
+ * When built with `TUNED_SIZE_CLASSES`, the power-of-2 size classes are
+ * replaced by those in `size-classes.h`, fitted to a program's allocation
+ * sizes by the `sizeclasses` tool.
+ *
+ * When built with `DECAY`, each pooled page is stamped with the time that it
+ * was pooled, and every few hundred calls the oldest pooled pages that have
+ * gone unused for `DECAY_MS` are returned to the OS, a bounded number at a
+ * time, so that an idle heap shrinks to nothing without the cost of releasing
+ * pages that are about to be reused.
+ *
+ * When built with `MEMORY_PRESSURE`, the allocator samples the memory limit,
+ * usage and PSI stall figures of its cgroup (see pressure.h) every
+ * `PRESSURE_INTERVAL_MS`.  On entering pressure it returns every pooled page
+ * to the OS, and while pressure lasts, it retains no free pages at all, and a
+ * size class that runs out of blocks takes them from the pages that it already
+ * has, as on an exhausted heap, before it takes another.
+ *
+ * `malloc()` and `free()` are compiled in lean, checking and debugging
+ * variants, of which an `ifunc` resolver binds one when the library is loaded,
+ * as named by the `ALLOC_DISPATCH` environment variable (see dispatch.h).  Only
+ * the checking and debugging variants call `check()`, every so many calls, on
+ * a bounded slice of the heap.  They also keep a bitmap of allocated blocks
+ * for each page, in a table apart from the heap, which catches double frees.
  **/
 // ==============================================================================
 
@@ -25,21 +89,32 @@
 #include <unistd.h>
 #include <sys/mman.h>
 
-#include "safeio.h"
-// ==============================================================================
-
+#if defined (THREAD_SAFE)
+#include <linux/membarrier.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
 
+#if defined (DECAY) || defined (MEMORY_PRESSURE)
+#include <time.h>
+#endif
 
-// ==============================================================================
-// TYPES AND STRUCTURES
+#include "alloc.h"
+#include "dispatch.h"
+#include "safeio.h"
 
-/** The header for each free object. */
-typedef struct header {
+#if defined (MEMORY_PRESSURE)
+#include "pressure.h"
+#endif
 
-  /** Pointer to the next header in the list. */
-  struct header* next;
+#if defined (TUNED_SIZE_CLASSES)
+#include "size-classes.h"
+#endif
 
-} header_s;
+#if defined (HYBRID_SMALL_TIER)
+#include "hybrid.h"
+#endif
 // ==============================================================================
 
 
@@ -50,6 +125,19 @@ typedef struct header {
 /** The system's page size. */
 #define PAGE_SIZE sysconf(_SC_PAGESIZE)
 
+/** The size of a cache line. */
+#define CACHE_LINE_SIZE 64
+
+/**
+ * Hint to the processor that the line holding `addr` will soon be read
+ * (`rw` = 0) or written (`rw` = 1).  Disabled with `-DNO_PREFETCH`.
+ */
+#if defined (NO_PREFETCH)
+#define PREFETCH(addr, rw)
+#else
+#define PREFETCH(addr, rw) __builtin_prefetch((const void*)(addr), (rw))
+#endif
+
 /** Mask of the offset bits of a virtual address. */
 #define OFFSET_MASK (PAGE_SIZE - 1)
 
@@ -62,10 +150,34 @@ typedef struct header {
 #define GB(size)  (MB(size) * 1024)
 
 /** The virtual address space reserved for the heap. */
+#if !defined (HEAP_SIZE)
 #define HEAP_SIZE GB(2)
+#endif
+
+#if defined (TUNED_SIZE_CLASSES)
+/** The tuned size classes, numbered from the smallest. */
+#define MIN_SIZE_CLASS 0
+#define MAX_SIZE_CLASS (TUNED_CLASS_COUNT - 1)
+
+/**
+ * Look up the size class of a size, in 16-byte units; a size beyond the
+ * largest class is given the class after it.
+ */
+#define CALC_SIZE_CLASS(x) ((x) > TUNED_MAX_CLASS_SIZE ? MAX_SIZE_CLASS + 1 :	\
+			    (unsigned int)tuned_size_classes[((x) + 15) / 16])
 
-/** The smallest size class, 16 bytes (a double-word). */
+/** Look up the size of a block in a given size class. */
+#define CALC_CLASS_SIZE(x) ((size_t)tuned_class_sizes[x])
+#else
+/**
+ * The smallest size class:  16 bytes (a double-word), or 8 bytes (a word) when
+ * a compressed link fits in a word.
+ */
+#if defined (COMPRESSED_LINKS)
+#define MIN_SIZE_CLASS 3
+#else
 #define MIN_SIZE_CLASS 4
+#endif
 
 /** The largest size class, 2048 bytes (half-page). */
 #define MAX_SIZE_CLASS 11
@@ -75,15 +187,280 @@ typedef struct header {
 
 /** Calculate the size of a block in a given size class, given as 2^class. */
 #define CALC_CLASS_SIZE(x) (1 << x)
+#endif
+
+/** The smallest offset of a page's first block, leaving room for the header. */
+#define MIN_FIRST_OFFSET ((sizeof(page_header_s) + 15) & ~(size_t)15)
+
+/**
+ * The most free pages kept in the pool before the rest are returned to the OS:
+ * more when built with `DECAY`, which returns idle pages over time.
+ */
+#if !defined (RETAINED_FREE_PAGES) && defined (DECAY)
+#define RETAINED_FREE_PAGES 4096
+#elif !defined (RETAINED_FREE_PAGES)
+#define RETAINED_FREE_PAGES 64
+#endif
+
+/**
+ * The time, in milliseconds, after which a pooled page that has not been reused
+ * is returned to the OS, when built with `DECAY`.
+ */
+#if !defined (DECAY_MS)
+#define DECAY_MS 1000
+#endif
+
+/** The number of calls to `malloc()` and `free()` between checks of the clock. */
+#define DECAY_TICK_OPS 256
+
+/** The least time, in milliseconds, between scavenging passes. */
+#define DECAY_INTERVAL_MS (DECAY_MS / 32 + 1)
+
+/** The most pages returned to the OS by one scavenging pass. */
+#define DECAY_PURGE_MAX 1024
+
+/**
+ * The number of calls to `malloc()` and `free()` between checks of the clock,
+ * and the least time, in milliseconds, between samples of the cgroup's memory
+ * pressure, when built with `MEMORY_PRESSURE`.
+ */
+#define PRESSURE_TICK_OPS    256
+#define PRESSURE_INTERVAL_MS 100
+
+/**
+ * The calls to `malloc()` and `free()` between heap checks in the checking
+ * variants, and the pages that each check examines, unless tuned with
+ * `ALLOC_CHECK_INTERVAL` and `ALLOC_CHECK_SLICE` (see dispatch.h).
+ */
+#define CHECK_INTERVAL 64
+#define CHECK_SLICE    4
+
+#if defined (TUNED_SIZE_CLASSES)
+/**
+ * The offset of a page's first block:  just after the header, or, for a class
+ * of whole cache lines, after the first line, so that its blocks stay line
+ * aligned.
+ */
+#define FIRST_OFFSET(class_size) ((class_size) % CACHE_LINE_SIZE == 0 ?	\
+				  CACHE_LINE_SIZE : MIN_FIRST_OFFSET)
+
+/**
+ * The number of cache-line colors available to a size class, and the shift of
+ * the first block for a color:  the first block may move forward by as many
+ * whole lines as are left over at the end of the page.
+ */
+#define CLASS_COLORS(class_size) ((PAGE_SIZE - FIRST_OFFSET(class_size)) % (class_size) / \
+				  CACHE_LINE_SIZE + 1)
+#define COLOR_SHIFT(class_size, color)					\
+  ((intptr_t)((color) % CLASS_COLORS(class_size)) * CACHE_LINE_SIZE)
+#else
+/**
+ * The offset of a page's first block, which normally follows one block's worth
+ * of header space, keeping blocks aligned to their size.
+ */
+#define FIRST_OFFSET(class_size) ((class_size) < MIN_FIRST_OFFSET ?		\
+				  MIN_FIRST_OFFSET : (class_size))
+
+/**
+ * The number of cache-line colors available to a size class, and the shift of
+ * the first block for a color:  the first block may be pulled back to anywhere
+ * from `MIN_FIRST_OFFSET` up to one class size into the page.
+ */
+#define CLASS_COLORS(class_size) ((class_size) <= MIN_FIRST_OFFSET ? 1 :	\
+				  ((class_size) - MIN_FIRST_OFFSET) / CACHE_LINE_SIZE + 1)
+#define COLOR_SHIFT(class_size, color)					\
+  (-(intptr_t)((color) % CLASS_COLORS(class_size)) * CACHE_LINE_SIZE)
+#endif
+
+/** Given a pointer to a block, find the header at the top of its page. */
+#define GET_PAGE_HEADER(bp) ((page_header_s*)((intptr_t)bp & ~OFFSET_MASK))
 
 /**
- * Given a pointer to a block, find the header at the top of the page that
+ * Given a pointer to a block, find the header of the page or sub-page that
  * contains the size class, and return that size.
  */
-#define GET_SIZE_CLASS(bp) (*(size_t*)((intptr_t)bp & ~OFFSET_MASK))
+#define GET_SIZE_CLASS(bp) (block_page(bp)->size_class)
+
+/** Is a page header that of a sub-page, carved from a block of a page? */
+#define IS_SUBPAGE(pp) (((intptr_t)(pp) & OFFSET_MASK) != 0)
+
+/**
+ * The space in front of a large block.  It holds the length of the block's
+ * mapping in its last word, and is a whole cache line so that large blocks are
+ * line aligned.
+ */
+#define LARGE_HEADER_SIZE CACHE_LINE_SIZE
+
+/** Given a pointer to a large block, obtain the length of its mapping. */
+#define LARGE_MAPPING_LENGTH(bp) (((size_t*)(bp))[-1])
+
+/**
+ * The size of the static bootstrap arena, which serves the requests made
+ * before the heap is initialized.
+ */
+#define BOOTSTRAP_SIZE (64 * 1024)
+
+/** Is a block one from the bootstrap arena? */
+#define IS_BOOTSTRAP(bp) ((intptr_t)(bp) >= (intptr_t)bootstrap_arena &&	\
+			  (intptr_t)(bp) <  (intptr_t)bootstrap_arena + BOOTSTRAP_SIZE)
+
+/**
+ * The granularity of compressed links:  a word, the smallest block alignment,
+ * so that 32-bit offsets span 32 GB.
+ */
+#define LINK_GRANULARITY 8
+
+/**
+ * Find the bit of a block in the allocated block bitmaps, one bit per
+ * `LINK_GRANULARITY` bytes of the heap.
+ */
+#define ALLOCATED_WORD(bp) (&allocated_bits[((intptr_t)(bp) - start_addr) / LINK_GRANULARITY / 64])
+#define ALLOCATED_BIT(bp)  ((uint64_t)1 << (((intptr_t)(bp) - start_addr) / LINK_GRANULARITY % 64))
+
+/**
+ * Convert between pointers and the links stored in free blocks and page
+ * headers.  With `COMPRESSED_LINKS`, a link is a 32-bit offset from
+ * `start_addr` in units of `LINK_GRANULARITY`, stored plus one so that 0 is
+ * `NULL`.
+ */
+#if defined (COMPRESSED_LINKS)
+#define LINK(p)   ((link_t)((p) == NULL ? 0 :				\
+			    ((intptr_t)(p) - start_addr) / LINK_GRANULARITY + 1))
+#define UNLINK(l) ((l) == 0 ? NULL :						\
+		   (void*)(start_addr + ((intptr_t)(l) - 1) * LINK_GRANULARITY))
+#else
+#define LINK(p)   ((void*)(p))
+#define UNLINK(l) ((void*)(l))
+#endif
+#define GET_NEXT(hp)      ((header_s*)UNLINK((hp)->next))
+#define SET_NEXT(hp, p)   ((hp)->next = LINK(p))
+#define GET_NEXT_PAGE(pp) ((page_header_s*)UNLINK((pp)->next_page))
+#define GET_PREV_PAGE(pp) ((page_header_s*)UNLINK((pp)->prev_page))
+#define GET_FREE(pp)      ((header_s*)UNLINK((pp)->free))
+
+#if defined (COMPRESSED_LINKS)
+_Static_assert(HEAP_SIZE / LINK_GRANULARITY < UINT32_MAX,
+	       "compressed links cannot span the heap");
+#endif
+// ==============================================================================
+
+
+// ==============================================================================
+// TYPES AND STRUCTURES
+
+#if defined (COMPRESSED_LINKS)
+/** A link to a free block or thread cache, as an offset into the heap. */
+typedef uint32_t link_t;
+#endif
+
+/** The header for each free object. */
+typedef struct header {
+
+  /** Pointer to the next header in the list. */
+#if defined (COMPRESSED_LINKS)
+  link_t         next;
+#else
+  struct header* next;
+#endif
+
+} header_s;
+
+/**
+ * The header at the top of each page, kept in the space in front of its first
+ * block.
+ */
+typedef struct page_header {
+
+#if defined (COMPRESSED_LINKS)
+  /** The page's free blocks. */
+  link_t                free;
+
+  /** The next and previous partial pages of this page's size class. */
+  link_t                next_page;
+  link_t                prev_page;
+
+#if defined (THREAD_SAFE)
+  /** The cache of the thread that carved, and owns, this page. */
+  link_t                owner;
+#endif
+#else
+  /** The page's free blocks. */
+  header_s*             free;
+
+  /** The next and previous partial pages of this page's size class. */
+  struct page_header*   next_page;
+  struct page_header*   prev_page;
+
+#if defined (THREAD_SAFE)
+  /** The cache of the thread that carved, and owns, this page. */
+  struct thread_cache*  owner;
+#endif
+#endif
+
+  /** The number of the page's blocks that are allocated. */
+  uint16_t              live;
+
+  /** The size class of the blocks in this page. */
+  uint8_t               size_class;
+
+  /** The offset of the page's first block, in double-words. */
+  uint8_t               first_block;
+
+  /**
+   * In a page, one more than the index of the first of its blocks carved into
+   * a sub-page; in a sub-page, that of the next block that its page has
+   * carved.  0 at the end of the chain.
+   */
+  uint8_t               carved;
+
+} page_header_s;
+
+/** The partial pages of each size class, and which classes have any. */
+typedef struct class_lists {
+
+  /** The array of partial page list heads, one per size class. */
+  page_header_s* partial_pages[MAX_SIZE_CLASS + 1];
+
+  /** A bit per size class, set when its partial page list is non-empty. */
+  uint32_t       nonempty;
+
+} class_lists_s;
+
+_Static_assert(MAX_SIZE_CLASS < 32, "the non-empty class bitmap is too narrow");
+
+#if defined (TUNED_SIZE_CLASSES)
+_Static_assert(MIN_FIRST_OFFSET <= CACHE_LINE_SIZE, "the page header spills past a line");
+#endif
+
+#if defined (THREAD_SAFE)
+/** The pages of one thread, and the blocks that others have freed to it. */
+typedef struct thread_cache {
+
+  /** The partial pages of this thread's size classes. */
+  class_lists_s        lists;
+
+  /** The next cache in the list of all caches. */
+  struct thread_cache* next_cache;
+
+  /** Is a live thread using this cache? */
+  bool                 in_use;
+
+  /** Is the cache's thread changing its pages? */
+  bool                 busy;
+
+  /** Is a heap walk reading its pages, so that its thread must wait? */
+  bool                 walked;
+
+  /** Blocks from this cache's pages freed by other threads, on their own line. */
+  header_s*            remote_frees __attribute__((aligned(CACHE_LINE_SIZE)));
+
+} thread_cache_s;
+#endif
 // ==============================================================================
 
 
+
+
 // ==============================================================================
 // GLOBALS
 
@@ -96,59 +473,1059 @@ static intptr_t start_addr = 0;
 /** The end of the heap. */
 static intptr_t end_addr   = 0;
 
-/** The array of free list heads, one per size class. */
-static header_s* free_lists[MAX_SIZE_CLASS + 1] = { NULL };
+#if defined (THREAD_SAFE)
+/** The cache of the calling thread, if it has allocated yet. */
+static __thread thread_cache_s* my_cache __attribute__((tls_model("initial-exec"))) = NULL;
+
+/** The list of all thread caches, in use or waiting to be adopted. */
+static thread_cache_s* all_caches = NULL;
+
+/** Release a thread's cache when it exits. */
+static pthread_key_t cache_key;
+
+/** Make sure that the heap is initialized exactly once. */
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+#else
+/** The partial pages of each size class. */
+static class_lists_s class_lists = { { NULL }, 0 };
+#endif
+
+/** The bootstrap arena, and the offset of its next free byte. */
+static uint8_t bootstrap_arena[BOOTSTRAP_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+static size_t  bootstrap_used = 0;
+
+/**
+ * The pool of free pages, a stack of page numbers mapped apart from the heap.
+ * The entries below `released_pages` have been returned to the OS.
+ */
+static uint32_t* free_pages     = NULL;
+static size_t    free_page_count = 0;
+static size_t    released_pages  = 0;
+
+#if defined (DECAY)
+/** The times at which the pages of the pool were pooled, entry for entry. */
+static uint64_t* free_page_times = NULL;
+
+/** The time at which the next scavenging pass is due. */
+static uint64_t  decay_next = 0;
+
+/** The calls to `malloc()` and `free()` since this thread last checked the clock. */
+#if defined (THREAD_SAFE)
+static __thread unsigned int decay_ops __attribute__((tls_model("initial-exec"))) = 0;
+#else
+static unsigned int decay_ops = 0;
+#endif
+#endif
+
+#if defined (MEMORY_PRESSURE)
+/** Is the cgroup under memory pressure, as last sampled? */
+static bool      under_pressure = false;
+
+/** The time at which the next sample is due. */
+static uint64_t  pressure_next  = 0;
+
+/** The calls to `malloc()` and `free()` since this thread last checked the clock. */
+#if defined (THREAD_SAFE)
+static __thread unsigned int pressure_ops __attribute__((tls_model("initial-exec"))) = 0;
+#else
+static unsigned int pressure_ops = 0;
+#endif
+#endif
+
+#if defined (THREAD_SAFE)
+/** Serialize use of the pool of free pages. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Serialize heap walks, so that each marks its caches walked alone. */
+static pthread_mutex_t walk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Can a heap walk hold other threads out of their pages (with `membarrier()`)? */
+static bool            walk_others = false;
+#endif
+
+#if defined (CACHE_COLORING)
+/** The color to give the next page carved for a size class. */
+static unsigned int next_color = 0;
+#endif
+
+/** The calls between heap checks, and the pages that each check examines. */
+static size_t check_interval = CHECK_INTERVAL;
+static size_t check_slice    = CHECK_SLICE;
+
+/**
+ * In the checking variants, a bit for the start of each allocated block, in a
+ * table mapped apart from the heap:  each page's bitmap is its slice of the
+ * table, which is touched only for pages that are used.  `NULL` in the lean
+ * variant.
+ */
+static uint64_t* allocated_bits = NULL;
+
+/** The calls since this thread's last heap check, and the next page it checks. */
+#if defined (THREAD_SAFE)
+static __thread size_t check_ops  __attribute__((tls_model("initial-exec"))) = 0;
+static __thread size_t check_page __attribute__((tls_model("initial-exec"))) = 0;
+#else
+static size_t check_ops  = 0;
+static size_t check_page = 0;
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find a block of a page carved into a sub-page, by its link in the page's
+ * chain of carved blocks.
+ *
+ * \param page The page.
+ * \param link The link, one more than the block's index.
+ * \return The header of the sub-page.
+ */
+static page_header_s* carved_block (page_header_s* page, uint8_t link) {
+
+  return (page_header_s*)((intptr_t)page + page->first_block * 16 +
+			  (intptr_t)(link - 1) * CALC_CLASS_SIZE(page->size_class));
+
+} // carved_block ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find the header of the page or sub-page that holds a block.  Only in a page
+ * that has carved blocks need the block be looked for:  a block that starts a
+ * block of the page is the page's own, and any other lies in a sub-page, whose
+ * header starts the page's block.
+ *
+ * \param bp A pointer to the block.
+ * \return The header of the page or sub-page.
+ */
+static inline page_header_s* block_page (void* bp) {
+
+  page_header_s* page = GET_PAGE_HEADER(bp);
+  if (page->carved == 0) {
+    return page;
+  }
+  size_t   class_size = CALC_CLASS_SIZE(page->size_class);
+  intptr_t first      = (intptr_t)page + page->first_block * 16;
+  intptr_t block      = first + ((intptr_t)bp - first) / class_size * class_size;
+  return block == (intptr_t)bp ? page : (page_header_s*)block;
+
+} // block_page ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check the blocks of a page or sub-page:  its free list must hold blocks of
+ * the page, on block boundaries, none marked allocated, and with its live
+ * blocks, fill it.  A pooled page, which has neither, is not checked.
+ *
+ * \param page     The page or sub-page.
+ * \param page_end The end of the page or sub-page.
+ * \return `true` if an error was found; `false` otherwise.
+ */
+static bool check_blocks (page_header_s* page, intptr_t page_end) {
+
+  if (page->live == 0 && GET_FREE(page) == NULL) {
+    return false;
+  }
+  if (page->size_class < MIN_SIZE_CLASS || page->size_class > MAX_SIZE_CLASS) {
+    return true;
+  }
+
+  size_t   class_size = CALC_CLASS_SIZE(page->size_class);
+  intptr_t page_addr  = (intptr_t)page;
+  intptr_t first      = page_addr + page->first_block * 16;
+  if (first < page_addr + (intptr_t)sizeof(page_header_s) || first + (intptr_t)class_size > page_end) {
+    return true;
+  }
+
+  // a free list that runs past the page's capacity has a cycle, or a stray link
+  size_t capacity    = (page_end - first) / class_size;
+  size_t free_blocks = 0;
+  for (header_s* block = GET_FREE(page); block != NULL; block = GET_NEXT(block)) {
+    intptr_t addr = (intptr_t)block;
+    if (free_blocks == capacity || addr < first || addr >= page_end ||
+	(addr - first) % class_size != 0 ||
+	(allocated_bits != NULL && (*ALLOCATED_WORD(block) & ALLOCATED_BIT(block)))) {
+      return true;
+    }
+    free_blocks += 1;
+  }
+  return free_blocks + page->live != capacity;
+
+} // check_blocks ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Check one size class page, and each sub-page carved from its blocks, each of
+ * which is one of the page's live blocks.
+ *
+ * \param page The page.
+ * \return `true` if an error was found; `false` otherwise.
+ */
+static bool check_page_blocks (page_header_s* page) {
+
+  intptr_t page_end = (intptr_t)page + PAGE_SIZE;
+  if (check_blocks(page, page_end)) {
+    return true;
+  }
+
+  size_t carved = 0;
+  for (uint8_t link = page->carved; link != 0; carved += 1) {
+    page_header_s* subpage = carved_block(page, link);
+    size_t         length  = CALC_CLASS_SIZE(page->size_class);
+    if (carved == page->live || (intptr_t)subpage + (intptr_t)length > page_end ||
+	check_blocks(subpage, (intptr_t)subpage + length)) {
+      return true;
+    }
+    link = subpage->carved;
+  }
+  return false;
+
+} // check_page_blocks ()
 // ==============================================================================
 
 
 
+// ==============================================================================
+/**
+ * Check a bounded slice of the heap:  the calling thread's partial page lists,
+ * which are few, and the next `check_slice` of its pages, resuming where its
+ * last check stopped.  With `THREAD_SAFE`, only the calling thread's pages are
+ * checked, since other threads change theirs without a lock.
+ *
+ * \return `true` if an error was found; `false` otherwise.
+ */
 bool
 check () {
 
+  if (start_addr == 0) {
+    return false;
+  }
+#if defined (THREAD_SAFE)
+  if (my_cache == NULL) {
+    return false;
+  }
+  class_lists_s* lists = &my_cache->lists;
+#else
+  class_lists_s* lists = &class_lists;
+#endif
+
   bool error = false;
   for (int i = MIN_SIZE_CLASS; i <= MAX_SIZE_CLASS; i += 1) {
-    if (free_lists[i] != NULL &&
-	(intptr_t)free_lists[i]->next < 0) {
+    page_header_s* page = lists->partial_pages[i];
+    if ((page != NULL) != ((lists->nonempty >> i) & 1) ||
+	(page != NULL && (page->size_class != i || GET_FREE(page) == NULL))) {
+      error = true;
+    }
+  }
+
+  intptr_t heap_end = __atomic_load_n(&free_addr, __ATOMIC_RELAXED);
+  if (heap_end > end_addr) {
+    heap_end = end_addr;
+  }
+  size_t pages = (heap_end - start_addr) / PAGE_SIZE;
+  for (size_t i = 0; i < check_slice && i < pages; i += 1) {
+    if (check_page >= pages) {
+      check_page = 0;
+    }
+    page_header_s* page = (page_header_s*)(start_addr + check_page * PAGE_SIZE);
+    check_page += 1;
+#if defined (THREAD_SAFE)
+    if (UNLINK(page->owner) != my_cache) {
+      continue;
+    }
+#endif
+    if (check_page_blocks(page)) {
       error = true;
     }
   }
 
   return error;
-  
-}
+
+} // check ()
+// ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * The initialization method.  If this is the first use of the heap, initialize it.
+ * Count a call to `malloc()` or `free()` by a checking variant, and check a
+ * slice of the heap every `check_interval` calls.
+ *
+ * \return `true` if a check found an error; `false` otherwise.
  */
+static bool check_tick () {
 
-void init () {
+  check_ops += 1;
+  if (check_ops < check_interval) {
+    return false;
+  }
+  check_ops = 0;
+  return check();
 
-  // Only do anything if there is no heap region (i.e., first time called).
-  if (start_addr == 0) {
+} // check_tick ()
+// ==============================================================================
 
-    DEBUG("Trying to initialize");
-    
-    // Allocate virtual address space in which the heap will reside. Make it
-    // un-shared and not backed by any file (_anonymous_ space).  A failure to
-    // map this space is fatal.
-    void* heap = mmap(NULL,                         // No particular location
-		      HEAP_SIZE,
-		      PROT_READ | PROT_WRITE,
-		      MAP_PRIVATE | MAP_ANONYMOUS,  // Not backed by a file
+
+
+// ==============================================================================
+/**
+ * Lock or unlock the pool of free pages, when there is a lock.
+ */
+#if defined (THREAD_SAFE)
+#define POOL_LOCK()   pthread_mutex_lock(&pool_lock)
+#define POOL_UNLOCK() pthread_mutex_unlock(&pool_lock)
+#else
+#define POOL_LOCK()
+#define POOL_UNLOCK()
+#endif
+// ==============================================================================
+
+
+
+#if defined (THREAD_SAFE)
+// ==============================================================================
+/**
+ * Mark a cache busy while its thread changes its pages, first waiting out any
+ * heap walk of them.  Only a heap walk contends with the cache's own thread,
+ * so the thread pays no fence:  the walk forces one on it with `membarrier()`
+ * instead, after which either the walk sees the cache busy, or the thread
+ * sees the walk.
+ *
+ * \param cache The calling thread's cache.
+ */
+static inline void cache_enter (thread_cache_s* cache) {
+
+  while (true) {
+    __atomic_store_n(&cache->busy, true, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&cache->walked, __ATOMIC_ACQUIRE)) {
+      return;
+    }
+    __atomic_store_n(&cache->busy, false, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&cache->walked, __ATOMIC_ACQUIRE)) {
+      sched_yield();
+    }
+  }
+
+} // cache_enter ()
+// ==============================================================================
+#endif
+
+
+
+// ==============================================================================
+/**
+ * Mark a cache busy, or no longer, while its thread changes its pages, when
+ * other threads may walk them.
+ */
+#if defined (THREAD_SAFE)
+#define CACHE_LOCK(cache)   cache_enter(cache)
+#define CACHE_UNLOCK(cache) __atomic_store_n(&(cache)->busy, false, __ATOMIC_RELEASE)
+#else
+#define CACHE_LOCK(cache)
+#define CACHE_UNLOCK(cache)
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return pooled pages to the OS, longest pooled first, until no more than a
+ * given number of pooled pages are still backed by memory.  The caller must
+ * hold the pool lock.
+ *
+ * \param retained The number of pooled pages to keep.
+ */
+static void release_pooled_pages (size_t retained) {
+
+  while (free_page_count - released_pages > retained) {
+    void* released = (void*)(start_addr + (intptr_t)free_pages[released_pages] * PAGE_SIZE);
+    madvise(released, PAGE_SIZE, MADV_DONTNEED);
+    released_pages += 1;
+  }
+
+} // release_pooled_pages ()
+// ==============================================================================
+
+
+
+#if defined (DECAY) || defined (MEMORY_PRESSURE)
+// ==============================================================================
+/** Return the time, in milliseconds, by the coarse (and cheapest) clock. */
+static uint64_t clock_ms () {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+} // clock_ms ()
+// ==============================================================================
+#endif
+
+
+
+#if defined (DECAY)
+// ==============================================================================
+/**
+ * Check the clock, and if a scavenging pass is due, return to the OS the pooled
+ * pages that have gone unused for `DECAY_MS`.  The pool is a stack, so the
+ * pages still backed by memory, from `released_pages` up, are ordered by the
+ * time that they were pooled, and the pass stops at the first that is too
+ * young.
+ */
+static void decay_tick () {
+
+  uint64_t now = clock_ms();
+  if (now < __atomic_load_n(&decay_next, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  POOL_LOCK();
+  if (now >= decay_next) {
+    decay_next = now + DECAY_INTERVAL_MS;
+    for (int purged = 0;
+	 purged < DECAY_PURGE_MAX && released_pages < free_page_count &&
+	   now - free_page_times[released_pages] >= DECAY_MS;
+	 purged += 1) {
+      void* released = (void*)(start_addr + (intptr_t)free_pages[released_pages] * PAGE_SIZE);
+      madvise(released, PAGE_SIZE, MADV_DONTNEED);
+      released_pages += 1;
+    }
+  }
+  POOL_UNLOCK();
+
+} // decay_tick ()
+// ==============================================================================
+#endif /* DECAY */
+
+
+
+// ==============================================================================
+/** Count a call, and now and then scavenge pooled pages that have decayed. */
+#if defined (DECAY)
+#define DECAY_TICK() if (++decay_ops % DECAY_TICK_OPS == 0) decay_tick()
+#else
+#define DECAY_TICK()
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Put a page, all of whose blocks are free, into the pool of free pages.  If
+ * the pool then holds more than `RETAINED_FREE_PAGES` pages still backed by
+ * memory (or, under memory pressure, any), return the longest pooled of them
+ * to the OS.
+ *
+ * \param page The page to pool.
+ */
+static void release_page (page_header_s* page) {
+
+  // A pooled page has neither free nor live blocks, nor an owner, as does one
+  // returned to the OS, which reads as zeroes.
+  page->free = LINK(NULL);
+#if defined (THREAD_SAFE)
+  page->owner = LINK(NULL);
+#endif
+  POOL_LOCK();
+  free_pages[free_page_count] = ((intptr_t)page - start_addr) / PAGE_SIZE;
+#if defined (DECAY)
+  free_page_times[free_page_count] = clock_ms();
+#endif
+  free_page_count += 1;
+#if defined (MEMORY_PRESSURE)
+  release_pooled_pages(under_pressure ? 0 : RETAINED_FREE_PAGES);
+#else
+  release_pooled_pages(RETAINED_FREE_PAGES);
+#endif
+  POOL_UNLOCK();
+
+} // release_page ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take the most recently pooled page from the pool of free pages.
+ *
+ * \return The address of the page, or 0 if the pool is empty.
+ */
+static intptr_t reuse_page () {
+
+  intptr_t page_addr = 0;
+  POOL_LOCK();
+  if (free_page_count > 0) {
+    free_page_count -= 1;
+    page_addr = start_addr + (intptr_t)free_pages[free_page_count] * PAGE_SIZE;
+    if (released_pages > free_page_count) {
+      released_pages = free_page_count;
+    }
+  }
+  POOL_UNLOCK();
+  return page_addr;
+
+} // reuse_page ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Take a page from the pool of free pages, or else from the heap region.
+ *
+ * \return The address of the new page, if successful; 0 if the heap is full.
+ */
+static intptr_t carve_page () {
+
+  // Reuse a page from the pool, the most recently freed first.
+  intptr_t reused_page_addr = reuse_page();
+  if (reused_page_addr != 0) {
+    return reused_page_addr;
+  }
+
+#if defined (THREAD_SAFE)
+  intptr_t new_page_addr = __atomic_fetch_add(&free_addr, PAGE_SIZE, __ATOMIC_RELAXED);
+  if (new_page_addr + PAGE_SIZE > end_addr) {
+    return 0;
+  }
+#else
+  if (free_addr >= end_addr) {
+    return 0;
+  }
+  intptr_t new_page_addr = free_addr;
+  free_addr += PAGE_SIZE;
+#endif
+
+  assert((new_page_addr & OFFSET_MASK) == 0);
+  return new_page_addr;
+
+} // carve_page ()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Put a page at the front of its size class's partial page list.
+ *
+ * \param lists The partial page lists.
+ * \param page  The page, which has a free block.
+ */
+static void partial_page_push (class_lists_s* lists, page_header_s* page) {
+
+  page_header_s* head = lists->partial_pages[page->size_class];
+  page->next_page = LINK(head);
+  page->prev_page = LINK(NULL);
+  if (head != NULL) {
+    head->prev_page = LINK(page);
+  }
+  lists->partial_pages[page->size_class] = page;
+  lists->nonempty |= (uint32_t)1 << page->size_class;
+
+} // partial_page_push ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Remove a page from its size class's partial page list.
+ *
+ * \param lists The partial page lists.
+ * \param page  The page, which is on the list.
+ */
+static void partial_page_unlink (class_lists_s* lists, page_header_s* page) {
+
+  page_header_s* next = GET_NEXT_PAGE(page);
+  page_header_s* prev = GET_PREV_PAGE(page);
+  if (next != NULL) {
+    next->prev_page = LINK(prev);
+  }
+  if (prev != NULL) {
+    prev->next_page = LINK(next);
+  } else {
+    lists->partial_pages[page->size_class] = next;
+    if (next == NULL) {
+      lists->nonempty &= ~((uint32_t)1 << page->size_class);
+    }
+  }
+
+} // partial_page_unlink ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Drop a sub-page, all of whose blocks are free, from its page's chain of
+ * carved blocks, so that it may be freed as a block of the page.
+ *
+ * \param subpage The sub-page.
+ */
+static void uncarve_block (page_header_s* subpage) {
+
+  page_header_s* page  = GET_PAGE_HEADER(subpage);
+  intptr_t       first = (intptr_t)page + page->first_block * 16;
+  uint8_t        link  = ((intptr_t)subpage - first) / CALC_CLASS_SIZE(page->size_class) + 1;
+  uint8_t*       next  = &page->carved;
+  while (*next != link) {
+    next = &carved_block(page, *next)->carved;
+  }
+  *next = subpage->carved;
+
+} // uncarve_block ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return a block to its page.  A page that was full goes back at the front of
+ * the partial page list, being nearly full.  A page whose blocks are now all
+ * free goes to the pool of free pages, unless it is the only partial page of
+ * its size class, which it keeps so that a class that allocates and frees a
+ * single block does not take and pool a page every time.  A sub-page whose
+ * blocks are all free is always returned to its page, as a block.
+ *
+ * \param lists The partial page lists of the page's owner.
+ * \param block The block to be freed.
+ */
+static void page_free_block (class_lists_s* lists, header_s* block) {
+
+  page_header_s* page     = block_page(block);
+  bool           was_full = (GET_FREE(page) == NULL);
+  block->next  = page->free;
+  page->free   = LINK(block);
+  page->live  -= 1;
+  if (was_full) {
+    partial_page_push(lists, page);
+  }
+  if (page->live == 0 && IS_SUBPAGE(page)) {
+    partial_page_unlink(lists, page);
+    uncarve_block(page);
+    page_free_block(lists, (header_s*)page);
+  } else if (page->live == 0 &&
+	     (lists->partial_pages[page->size_class] != page || GET_NEXT_PAGE(page) != NULL)) {
+    partial_page_unlink(lists, page);
+    release_page(page);
+  }
+
+} // page_free_block ()
+// ==============================================================================
+
+
+
+
+
+
+// ==============================================================================
+/**
+ * Divide a page or sub-page, wholly free, into blocks of a size class, and put
+ * it on that class's partial page list.  The caller records the page's owner,
+ * if any.
+ *
+ * \param lists        The partial page lists.
+ * \param page_addr    The address of the page or sub-page.
+ * \param page_end     The end of the page or sub-page.
+ * \param first_offset The offset of its first block.
+ * \param size_class   The size class of its blocks.
+ * \return The formatted page or sub-page.
+ */
+static page_header_s* format_blocks (class_lists_s* lists, intptr_t page_addr, intptr_t page_end,
+				     intptr_t first_offset, unsigned int size_class) {
+
+  size_t class_size = CALC_CLASS_SIZE(size_class);
+
+  // Record the size class of the blocks in this page in the header, in front of
+  // the first block.
+  page_header_s* page = (page_header_s*)page_addr;
+  page->size_class  = size_class;
+  page->live        = 0;
+  page->carved      = 0;
+  page->first_block = first_offset / 16;
+
+  // Loop through the remaining blocks of the page, chaining them together.
+  intptr_t current = page_addr + first_offset;
+  page->free       = LINK((header_s*)current);
+  while (current + class_size <= page_end) {
+
+    // Make this block point to the next one, unless we're at the last block,
+    // in which case mark the end of the list with a `NULL` next.
+    intptr_t next = current + class_size;
+    if (next + class_size <= page_end) {
+      SET_NEXT((header_s*)current, (header_s*)next);
+    } else {
+      SET_NEXT((header_s*)current, NULL);
+    }
+
+    // Move forward.
+    current = next;
+
+  }
+  partial_page_push(lists, page);
+  return page;
+
+} // format_blocks ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Divide a page, wholly free, into blocks of a size class, and put it on that
+ * class's partial page list.  The caller records the page's owner, if any.
+ *
+ * \param lists      The partial page lists.
+ * \param page_addr  The address of the page.
+ * \param size_class The size class of its blocks.
+ * \return The formatted page.
+ */
+static page_header_s* format_page (class_lists_s* lists, intptr_t page_addr,
+				   unsigned int size_class) {
+
+  size_t   class_size = CALC_CLASS_SIZE(size_class);
+  intptr_t page_end   = page_addr + PAGE_SIZE;
+
+  // The whole page is about to be written, so start pulling it in.
+  for (intptr_t line = page_addr; line < page_end; line += CACHE_LINE_SIZE) {
+    PREFETCH(line, 1);
+  }
+
+  // The first block follows the header space.  A colored page instead shifts it
+  // by a rotating number of cache lines.
+  intptr_t first_offset = FIRST_OFFSET(class_size);
+#if defined (CACHE_COLORING)
+  first_offset += COLOR_SHIFT(class_size, next_color);
+  next_color   += 1;
+#endif
+  return format_blocks(lists, page_addr, page_end, first_offset, size_class);
+
+} // format_page ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Carve the next free block of a page into a sub-page of a smaller size class,
+ * if the block holds at least two of its blocks, laid out as they would be in
+ * a page of their own, and the chain of carved blocks can reach it.
+ *
+ * \param lists      The partial page lists.
+ * \param page       The page, whose class is larger, and which has a free block.
+ * \param size_class The size class of the sub-page's blocks.
+ * \return The sub-page, or `NULL` if the block cannot be carved.
+ */
+static page_header_s* carve_block (class_lists_s* lists, page_header_s* page,
+				   unsigned int size_class) {
+
+  size_t    length       = CALC_CLASS_SIZE(page->size_class);
+  size_t    class_size   = CALC_CLASS_SIZE(size_class);
+  intptr_t  first_offset = FIRST_OFFSET(class_size);
+  header_s* block        = GET_FREE(page);
+  size_t    index        = ((intptr_t)block - ((intptr_t)page + page->first_block * 16)) / length;
+  if ((length - first_offset) / class_size < 2 || index >= UINT8_MAX ||
+      (class_size % CACHE_LINE_SIZE == 0 && ((intptr_t)block + first_offset) % CACHE_LINE_SIZE != 0)) {
+    return NULL;
+  }
+
+  // Take the block from its page, which counts it as live until the sub-page
+  // is returned, and put the sub-page at the front of the page's chain.
+  page->free  = block->next;
+  page->live += 1;
+  if (page->free == LINK(NULL)) {
+    partial_page_unlink(lists, page);
+  }
+  page_header_s* subpage = format_blocks(lists, (intptr_t)block, (intptr_t)block + length,
+					 first_offset, size_class);
+  subpage->carved = page->carved;
+  page->carved    = index + 1;
+#if defined (THREAD_SAFE)
+  subpage->owner  = page->owner;
+#endif
+  return subpage;
+
+} // carve_block ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Find a page to serve a request from the blocks that the size classes already
+ * have, once the heap can supply no more pages, or under memory pressure.  A
+ * size class keeps its last page even when all of the page's blocks are free,
+ * so first look for such a page in any class and divide it anew.  Otherwise,
+ * carve a free block of the smallest larger class that can be carved into a
+ * sub-page of the requested class.  Failing that, if allowed to, take the
+ * smallest larger class with a free block, whose blocks a request may use
+ * whole.
+ *
+ * \param lists      The partial page lists.
+ * \param size_class The size class requested.
+ * \param whole      Whether a request may use a larger block whole.
+ * \return A page or sub-page with a free block of at least the class size, or
+ *         `NULL` if there is none.
+ */
+static page_header_s* fallback_page (class_lists_s* lists, unsigned int size_class, bool whole) {
+
+  // A sub-page whose blocks are all free is returned to its page, so only a
+  // page is found wholly free.
+  for (uint32_t classes = lists->nonempty; classes != 0; classes &= classes - 1) {
+    page_header_s* page = lists->partial_pages[__builtin_ctz(classes)];
+    if (page->live == 0) {
+      DEBUG("malloc(): Reformatting the free page of size class", page->size_class);
+      partial_page_unlink(lists, page);
+      return format_page(lists, (intptr_t)page, size_class);
+    }
+  }
+
+  // A sub-page is not carved again, so that a block has at most two headers.
+  uint32_t larger = lists->nonempty & ~(((uint32_t)2 << size_class) - 1);
+  for (uint32_t classes = larger; classes != 0; classes &= classes - 1) {
+    page_header_s* page = lists->partial_pages[__builtin_ctz(classes)];
+    if (!IS_SUBPAGE(page)) {
+      page_header_s* subpage = carve_block(lists, page, size_class);
+      if (subpage != NULL) {
+	DEBUG("malloc(): Carved a block of larger size class", page->size_class);
+	return subpage;
+      }
+    }
+  }
+
+  if (!whole || larger == 0) {
+    return NULL;
+  }
+  DEBUG("malloc(): Borrowing from larger size class", __builtin_ctz(larger));
+  return lists->partial_pages[__builtin_ctz(larger)];
+
+} // fallback_page ()
+// ==============================================================================
+
+
+
+#if defined (THREAD_SAFE)
+// ==============================================================================
+/**
+ * Mark a cache as free for adoption.  Called as the thread that used it exits.
+ *
+ * \param cache The exiting thread's cache.
+ */
+static void release_cache (void* cache) {
+
+  __atomic_store_n(&((thread_cache_s*)cache)->in_use, false, __ATOMIC_RELEASE);
+
+} // release_cache ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Obtain the calling thread's cache.  On a thread's first allocation, adopt the
+ * cache of a thread that has exited, if there is one, or else carve a new one.
+ *
+ * \return The calling thread's cache, or `NULL` if the heap is full.
+ */
+static thread_cache_s* current_cache () {
+
+  if (my_cache != NULL) {
+    return my_cache;
+  }
+
+  // Adopt an abandoned cache, along with its free blocks and pages.
+  thread_cache_s* cache = __atomic_load_n(&all_caches, __ATOMIC_ACQUIRE);
+  while (cache != NULL) {
+    bool expected = false;
+    if (__atomic_compare_exchange_n(&cache->in_use, &expected, true, false,
+				    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+    cache = cache->next_cache;
+  }
+
+  // None to adopt, so give a new cache its own page and add it to the list.
+  if (cache == NULL) {
+    cache = (thread_cache_s*)carve_page();
+    if (cache == NULL) {
+      return NULL;
+    }
+    memset(cache, 0, sizeof(thread_cache_s));
+    cache->in_use     = true;
+    cache->next_cache = __atomic_load_n(&all_caches, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&all_caches, &cache->next_cache, cache, true,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+
+  // Set the cache before registering it, which may itself allocate.
+  my_cache = cache;
+  pthread_setspecific(cache_key, cache);
+  return cache;
+
+} // current_cache ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the blocks that other threads have freed to this cache to their
+ * pages.
+ *
+ * \param cache The calling thread's cache.
+ */
+static void drain_remote_frees (thread_cache_s* cache) {
+
+  header_s* current = __atomic_exchange_n(&cache->remote_frees, NULL, __ATOMIC_ACQUIRE);
+  while (current != NULL) {
+    header_s* next = GET_NEXT(current);
+    page_free_block(&cache->lists, current);
+    current = next;
+  }
+
+} // drain_remote_frees ()
+// ==============================================================================
+#endif /* THREAD_SAFE */
+
+
+
+#if defined (MEMORY_PRESSURE)
+// ==============================================================================
+/**
+ * Check the clock, and if a sample is due, sample the cgroup's memory pressure,
+ * returning every pooled page to the OS on entering pressure.  Under pressure,
+ * a thread also takes back the blocks that other threads have freed to it, so
+ * that the pages that they empty are released.
+ */
+static void pressure_tick () {
+
+  uint64_t now = clock_ms();
+  if (now >= __atomic_load_n(&pressure_next, __ATOMIC_RELAXED)) {
+    POOL_LOCK();
+    if (now >= pressure_next) {
+      pressure_next  = now + PRESSURE_INTERVAL_MS;
+      under_pressure = pressure_high();
+      if (under_pressure) {
+	release_pooled_pages(0);
+      }
+    }
+    POOL_UNLOCK();
+  }
+
+#if defined (THREAD_SAFE)
+  if (under_pressure && my_cache != NULL &&
+      __atomic_load_n(&my_cache->remote_frees, __ATOMIC_RELAXED) != NULL) {
+    CACHE_LOCK(my_cache);
+    drain_remote_frees(my_cache);
+    CACHE_UNLOCK(my_cache);
+  }
+#endif
+
+} // pressure_tick ()
+// ==============================================================================
+#endif /* MEMORY_PRESSURE */
+
+
+
+// ==============================================================================
+/** Count a call, and now and then sample the memory pressure. */
+#if defined (MEMORY_PRESSURE)
+#define PRESSURE_TICK() if (++pressure_ops % PRESSURE_TICK_OPS == 0) pressure_tick()
+#else
+#define PRESSURE_TICK()
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The initialization method.  If this is the first use of the heap, initialize it.
+ */
+
+void init () {
+
+  // Only do anything if there is no heap region (i.e., first time called).
+  if (start_addr == 0) {
+
+    DEBUG("Trying to initialize");
+    
+    // Allocate virtual address space in which the heap will reside. Make it
+    // un-shared and not backed by any file (_anonymous_ space).  A failure to
+    // map this space is fatal.  A tier of the hybrid allocator takes its part
+    // of the hybrid's region instead.
+#if defined (HYBRID_SMALL_TIER)
+    void* heap = hybrid_reserve(ALLOC_TIER_SMALL);
+#else
+    void* heap = mmap(NULL,                         // No particular location
+		      HEAP_SIZE,
+		      PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS,  // Not backed by a file
 		      -1,                           // ditto
 		      0);                           // ditto
     if (heap == MAP_FAILED) {
       ERROR("Could not mmap() heap region");
     }
+#endif
+
+#if !defined (HYBRID_SMALL_TIER)
+    // The checking variants keep a bitmap of allocated blocks for every page,
+    // mapped before the heap's bounds are set and any block is allocated.
+    if (dispatch_variant() != DISPATCH_FAST) {
+      allocated_bits = mmap(NULL, HEAP_SIZE / LINK_GRANULARITY / 8, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (allocated_bits == MAP_FAILED) {
+	ERROR("Could not mmap() allocated block bitmaps");
+      }
+    }
+#endif
 
     // Hold onto the boundaries of the heap as a whole.
     start_addr = (intptr_t)heap;
     end_addr   = start_addr + HEAP_SIZE;
     free_addr  = start_addr;
 
+    // Map the pool of free pages, with room for every page of the heap.
+    free_pages = mmap(NULL, HEAP_SIZE / PAGE_SIZE * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (free_pages == MAP_FAILED) {
+      ERROR("Could not mmap() free page pool");
+    }
+#if defined (DECAY)
+    free_page_times = mmap(NULL, HEAP_SIZE / PAGE_SIZE * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (free_page_times == MAP_FAILED) {
+      ERROR("Could not mmap() free page pool times");
+    }
+#endif
+
+#if defined (MEMORY_PRESSURE)
+    // Find the cgroup whose memory pressure to watch.
+    pressure_init();
+#endif
+
+#if defined (THREAD_SAFE)
+    // Let exiting threads give up their caches for new threads to adopt.
+    if (pthread_key_create(&cache_key, release_cache) != 0) {
+      ERROR("Could not create thread cache key");
+    }
+
+    // Let heap walks visit other threads' pages, if the kernel can force a
+    // barrier on those threads.
+    walk_others = (syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0);
+#endif
+
     // DEBUG: Emit a message to indicate that this allocator is being called.
     DEBUG("sf-alloc initialized");
 
@@ -158,132 +1535,240 @@ void init () {
 // ==============================================================================
 
 
+
+#if !defined (HYBRID_SMALL_TIER)
+// ==============================================================================
+/**
+ * Initialize the heap when the library is loaded, before the program's own
+ * code runs, so that allocation need not check for it.  (As a tier of the
+ * hybrid allocator, the heap is initialized by that allocator instead.)
+ */
+static void __attribute__((constructor)) init_at_load () {
+
+#if defined (THREAD_SAFE)
+  pthread_once(&init_once, init);
+#else
+  init();
+#endif
+
+} // init_at_load ()
+// ==============================================================================
+#endif
+
+
+
 // ==============================================================================
 /**
- * Allocate and return `size` bytes of heap space.  Specifically, search the
- * free list, choosing the _best fit_.  If no such block is available, expand
- * into the heap region via _pointer bumping_.
+ * Serve a request made before the heap is initialized:  from the bootstrap
+ * arena, laid out as a large block is, if it has room, or else by
+ * initializing the heap after all.
  *
  * \param size The number of bytes to allocate.
  * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
  */
-void* malloc (size_t size) {
+static void* malloc_uninitialized (size_t size) {
+
+  size_t length = LARGE_HEADER_SIZE + ((size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+  if (size <= BOOTSTRAP_SIZE) {
+    size_t offset = __atomic_fetch_add(&bootstrap_used, length, __ATOMIC_RELAXED);
+    if (offset + length <= BOOTSTRAP_SIZE) {
+      intptr_t block_addr = (intptr_t)bootstrap_arena + offset + LARGE_HEADER_SIZE;
+      LARGE_MAPPING_LENGTH(block_addr) = LARGE_HEADER_SIZE + size;
+      return (void*)block_addr;
+    }
+  }
 
-  check();
+#if defined (THREAD_SAFE)
+  pthread_once(&init_once, init);
+#else
   init();
+#endif
+  return malloc(size);
+
+} // malloc_uninitialized ()
+// ==============================================================================
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space, as a given variant of
+ * `malloc()` does.  Specifically, search the free list, choosing the _best
+ * fit_.  If no such block is available, expand into the heap region via
+ * _pointer bumping_.  Each variant inlines this with its own constant
+ * `variant`, so that the lean one carries no checks or traces.
+ *
+ * \param size    The number of bytes to allocate.
+ * \param variant The variant.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+static inline __attribute__((always_inline))
+void* malloc_variant (size_t size, dispatch_variant_t variant) {
+
+  CHECK(variant);
 
   // Cannot allocate an empty block.
   if (size == 0) {
     return NULL;
   }
+  DECAY_TICK();
+  PRESSURE_TICK();
 
   // Grab the size class, and determine how to handle the request.
   unsigned int size_class = CALC_SIZE_CLASS(size);
-  size_t       class_size = CALC_CLASS_SIZE(size_class);
-  DEBUG("malloc(): ", size, class_size, size_class);
+  TRACE(variant, "malloc(): ", size, size_class);
   if (size_class < MIN_SIZE_CLASS) {
 
     // Bump it the request size to the minimum that we handle.
     size_class = MIN_SIZE_CLASS;
-    class_size = CALC_CLASS_SIZE(size_class);
-    DEBUG("malloc(): Too small, bumped up size class", size_class);
+    TRACE(variant, "malloc(): Too small, bumped up size class", size_class);
 
   } else if (size_class > MAX_SIZE_CLASS) {
 
     // Handle this large allocation as an `mmap()`, separating it from the rest
-    // of the heap.
-    DEBUG("malloc(): Too large, mapping separately");
-    void* new_block_ptr = mmap(NULL,                         // No particular location
-			       sizeof(size_t) + size,        // A header + the block
-			       PROT_READ | PROT_WRITE,
-			       MAP_PRIVATE | MAP_ANONYMOUS,  // Not backed by a file
-			       -1,                           // ditto
-			       0);                           // ditto
-    if (new_block_ptr == MAP_FAILED) {
-      DEBUG("Could not mmap() large allocation", size);
+    // of the heap, unless its length with the header would overflow.
+    TRACE(variant, "malloc(): Too large, mapping separately");
+    if (size > PTRDIFF_MAX) {
+      TRACE(variant, "malloc(): Failing because too large to map");
+      return NULL;
+    }
+    size_t length  = LARGE_HEADER_SIZE + size;
+    void*  mapping = mmap(NULL,                         // No particular location
+			  length,                       // A header + the block
+			  PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS,  // Not backed by a file
+			  -1,                           // ditto
+			  0);                           // ditto
+    if (mapping == MAP_FAILED) {
+      TRACE(variant, "Could not mmap() large allocation", size);
       return NULL;
     }
 
-    size_t* header = new_block_ptr;
-    *header = class_size;
-    intptr_t block_addr = (intptr_t)header + sizeof(size_t);
-    DEBUG("malloc(): Returning large block", block_addr);
-    check();
+    intptr_t block_addr = (intptr_t)mapping + LARGE_HEADER_SIZE;
+    LARGE_MAPPING_LENGTH(block_addr) = length;
+    TRACE(variant, "malloc(): Returning large block", block_addr);
     return (void*)block_addr;
 
   }
 
-  // Do we have a free block in the needed size class?
-  if (free_lists[size_class] == NULL) {
-
-    // No blocks of this size.  Is there more heap space?
-    if (free_addr >= end_addr) {
-      DEBUG("malloc(): Failing because heap is full");
-      return NULL;
+#if defined (THREAD_SAFE)
+  // Allocate from this thread's own pages, first taking back any of its blocks
+  // that other threads have freed if it has no partial page of this class.
+  thread_cache_s* cache = current_cache();
+  if (cache == NULL) {
+    if (start_addr == 0) {
+      return malloc_uninitialized(size);
     }
+    TRACE(variant, "malloc(): Failing because heap is full");
+    return NULL;
+  }
+  class_lists_s* lists = &cache->lists;
+  CACHE_LOCK(cache);
+  if (lists->partial_pages[size_class] == NULL &&
+      __atomic_load_n(&cache->remote_frees, __ATOMIC_RELAXED) != NULL) {
+    drain_remote_frees(cache);
+  }
+#else
+  class_lists_s* lists = &class_lists;
+#endif
 
-    // Allocate a new page, making sure it is aligned.
-    DEBUG("malloc(): Size class free list empty, replenishing");
-    assert((free_addr & OFFSET_MASK) == 0);
-    intptr_t new_page_addr = free_addr;
-    free_addr += PAGE_SIZE;
-
-    // Record the size class of the blocks in this page within the first block's
-    // space (which won't be used).
-    *(unsigned int*)new_page_addr = size_class;
-
-    // Loop through the remaining blocks of the page, chaining them together.
-    intptr_t current       = new_page_addr + class_size;
-    free_lists[size_class] = (header_s*)current;
-    while (current < free_addr) {
-
-      // Make this block point to the next one, unless we're at the last block,
-      // in which case mark the end of the list with a `NULL` next.
-      intptr_t next = current + class_size;
-      if (next < free_addr) {
-	((header_s*)current)->next = (header_s*)next;
+  // Do we have a page with a free block in the needed size class?
+  page_header_s* page = lists->partial_pages[size_class];
+  if (page == NULL) {
+
+    // No blocks of this size.  Allocate a new page, if there is more heap space,
+    // or else fall back on the pages of other size classes.  Under memory
+    // pressure, fall back on them first.
+    TRACE(variant, "malloc(): Size class has no partial page, replenishing");
+#if defined (MEMORY_PRESSURE)
+    if (under_pressure) {
+      page = fallback_page(lists, size_class, false);
+    }
+#endif
+    if (page == NULL) {
+      intptr_t new_page_addr = carve_page();
+      if (new_page_addr != 0) {
+	page = format_page(lists, new_page_addr, size_class);
+#if defined (THREAD_SAFE)
+	page->owner = LINK(cache);
+#endif
       } else {
-	((header_s*)current)->next = NULL;
+	page = fallback_page(lists, size_class, true);
+	if (page == NULL) {
+	  CACHE_UNLOCK(cache);
+	  if (start_addr == 0) {
+	    return malloc_uninitialized(size);
+	  }
+	  TRACE(variant, "malloc(): Failing because heap is full");
+	  return NULL;
+	}
       }
-
-      // Move forward.
-      current = next;
-      
     }
 
   }
 
-  // There is now at least one block of this size class, so allocate the first
-  // available.
-  assert(free_lists[size_class] != NULL);
-  void* new_block_ptr = (void*)free_lists[size_class];
-  check();
-  free_lists[size_class] = free_lists[size_class]->next;
+  // There is now at least one block in this page, so allocate the first
+  // available, dropping the page from the partial list if that fills it.
+  assert(GET_FREE(page) != NULL);
+  header_s* new_block_ptr = GET_FREE(page);
+  page->free  = new_block_ptr->next;
+  page->live += 1;
+  if (page->free == LINK(NULL)) {
+    partial_page_unlink(lists, page);
+  }
+  CACHE_UNLOCK(cache);
+
+  // The new head will be popped next.  Its line was requested by the previous
+  // pop, so reading its link is cheap; request the block after it as well.
+  header_s* next = GET_FREE(page);
+  if (next != NULL) {
+    PREFETCH(next, 1);
+    PREFETCH(GET_NEXT(next), 1);
+  }
   
-  DEBUG("malloc() returning: ", (intptr_t)new_block_ptr);
-  check();
+  // The checking variants mark the block allocated, for free() to clear.
+  if (variant != DISPATCH_FAST) {
+    __atomic_fetch_or(ALLOCATED_WORD(new_block_ptr), ALLOCATED_BIT(new_block_ptr), __ATOMIC_RELAXED);
+  }
+
+  TRACE(variant, "malloc() returning: ", (intptr_t)new_block_ptr);
   return new_block_ptr;
 
-} // malloc()
+} // malloc_variant ()
+
+static void* malloc_fast (size_t size) {
+  return malloc_variant(size, DISPATCH_FAST);
+}
+
+#if !defined (HYBRID_SMALL_TIER)
+static void* malloc_check (size_t size) {
+  return malloc_variant(size, DISPATCH_CHECK);
+}
+
+static void* malloc_debug (size_t size) {
+  return malloc_variant(size, DISPATCH_DEBUG);
+}
+#endif
 // ==============================================================================
 
 
 
 // ==============================================================================
 /**
- * Deallocate a given block on the heap.  Add the given block (if any) to the
- * free list.
+ * Deallocate a given block on the heap, as a given variant of `free()` does.
+ * Add the given block (if any) to the free list.
  *
- * \param ptr A pointer to the block to be deallocated.
+ * \param ptr     A pointer to the block to be deallocated.
+ * \param variant The variant.
  */
-void free (void* ptr) {
+static inline __attribute__((always_inline))
+void free_variant (void* ptr, dispatch_variant_t variant) {
 
-  DEBUG("free(): ", (intptr_t)ptr);
-  check();
+  TRACE(variant, "free(): ", (intptr_t)ptr);
+  CHECK(variant);
 
   // This function is allowed to be passed a `NULL` pointer.  Do nothing.
   if (ptr == NULL) {
-    DEBUG("free(): Doing nothing for NULL block");
+    TRACE(variant, "free(): Doing nothing for NULL block");
     return;
   }
 
@@ -291,20 +1776,22 @@ void free (void* ptr) {
   intptr_t addr = (intptr_t)ptr;
   if ((addr < start_addr) || (end_addr < addr)) {
 
-    // Yes.  Walk back to its size header...
-    DEBUG("free(): Large block");
-    size_t* header = (size_t*)(addr - sizeof(size_t));
-    size_t  size   = *header;
-    assert(CALC_SIZE_CLASS(size) > MAX_SIZE_CLASS);
-    DEBUG("free(): Large block size = ", size);
+    // Yes, unless it is from the bootstrap arena, which is never reused.  Walk
+    // back to its header for the length of its mapping...
+    TRACE(variant, "free(): Large block");
+    if (IS_BOOTSTRAP(addr)) {
+      return;
+    }
+    size_t length = LARGE_MAPPING_LENGTH(addr);
+    assert(length > LARGE_HEADER_SIZE);
+    TRACE(variant, "free(): Large block mapping length = ", length);
 
     // ...and unmap the region.
-    int result = munmap((void*)header, size + sizeof(size_t));
+    int result = munmap((void*)(addr - LARGE_HEADER_SIZE), length);
     if (result == -1) {
       ERROR("Could not unmap large block", (intptr_t)ptr);
     }
 
-    check();
     return;
     
   }
@@ -312,14 +1799,122 @@ void free (void* ptr) {
   // Grab the size of this block from the top of the page.
   unsigned int size_class = GET_SIZE_CLASS(ptr);
   assert((MIN_SIZE_CLASS <= size_class) && (size_class <= MAX_SIZE_CLASS));
-  DEBUG("free(): Returning to size class free list", size_class);
+  TRACE(variant, "free(): Returning to its page", size_class);
+
+  // The checking variants find a double free, or a pointer that is not to an
+  // allocated block, as a clear bit.
+  if (variant != DISPATCH_FAST &&
+      !(__atomic_fetch_and(ALLOCATED_WORD(ptr), ~ALLOCATED_BIT(ptr), __ATOMIC_RELAXED) &
+	ALLOCATED_BIT(ptr))) {
+    ERROR("Double-free: ", (intptr_t)ptr);
+  }
+
+#if defined (THREAD_SAFE)
+  // A block from another thread's page goes back to that thread, so that its
+  // neighbours are never handed to a different thread.
+  thread_cache_s* owner = UNLINK(GET_PAGE_HEADER(ptr)->owner);
+  if (owner != my_cache) {
+    header_s* header = ptr;
+    header_s* head   = __atomic_load_n(&owner->remote_frees, __ATOMIC_RELAXED);
+    do {
+      SET_NEXT(header, head);
+    } while (!__atomic_compare_exchange_n(&owner->remote_frees, &head, header, true,
+					  __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return;
+  }
+  class_lists_s* lists = &owner->lists;
+#else
+  class_lists_s* lists = &class_lists;
+#endif
+
+  // Return it to its page.
+  CACHE_LOCK(owner);
+  page_free_block(lists, ptr);
+  CACHE_UNLOCK(owner);
+  DECAY_TICK();
+  PRESSURE_TICK();
+
+} // free_variant ()
+
+static void free_fast (void* ptr) {
+  free_variant(ptr, DISPATCH_FAST);
+}
+
+#if !defined (HYBRID_SMALL_TIER)
+static void free_check (void* ptr) {
+  free_variant(ptr, DISPATCH_CHECK);
+}
+
+static void free_debug (void* ptr) {
+  free_variant(ptr, DISPATCH_DEBUG);
+}
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Bind the variants of `malloc()` and `free()` named by `ALLOC_DISPATCH`, when
+ * the library is loaded, as bf-alloc does:  through `ifunc` symbols of their
+ * own, since the entry points are called by the C library, which is relocated
+ * first.  The hybrid allocator's small tier uses the lean variants only.
+ */
+typedef void* (*malloc_variant_f) (size_t size);
+typedef void  (*free_variant_f)   (void* ptr);
+
+#if defined (HYBRID_SMALL_TIER)
+#define malloc_dispatch malloc_fast
+#define free_dispatch   free_fast
+#else
+static malloc_variant_f malloc_resolve () {
+
+  check_interval = dispatch_tunable(CHECK_INTERVAL_ENV, CHECK_INTERVAL);
+  check_slice    = dispatch_tunable(CHECK_SLICE_ENV, CHECK_SLICE);
+  malloc_variant_f variants[DISPATCH_VARIANTS] = { malloc_fast, malloc_check, malloc_debug };
+  return variants[dispatch_variant()];
+
+} // malloc_resolve ()
+
+static free_variant_f free_resolve () {
+
+  free_variant_f variants[DISPATCH_VARIANTS] = { free_fast, free_check, free_debug };
+  return variants[dispatch_variant()];
+
+} // free_resolve ()
+
+static void* malloc_dispatch (size_t size) __attribute__((ifunc("malloc_resolve")));
+static void  free_dispatch   (void* ptr)   __attribute__((ifunc("free_resolve")));
+#endif
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Allocate and return `size` bytes of heap space.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* malloc (size_t size) {
+
+  return malloc_dispatch(size);
+
+} // malloc()
+// ==============================================================================
 
-  // Insert it at the head of its size class's free list.
-  header_s* header       = ptr;
-  header->next           = free_lists[size_class];
-  free_lists[size_class] = header;
 
-  check();
+
+// ==============================================================================
+/**
+ * Deallocate a given block on the heap.
+ *
+ * \param ptr A pointer to the block to be deallocated.
+ */
+void free (void* ptr) {
+
+  free_dispatch(ptr);
 
 } // free()
 // ==============================================================================
@@ -341,8 +1936,9 @@ void* calloc (size_t nmemb, size_t size) {
   size_t block_size    = nmemb * size;
   void*  new_block_ptr = malloc(block_size);
 
-  // If the allocation succeeded, clear the entire block.
-  if (new_block_ptr != NULL) {
+  // If the allocation succeeded, clear the entire block, unless it is a fresh
+  // large mapping, which is already zeroed.
+  if (new_block_ptr != NULL && CALC_SIZE_CLASS(block_size) <= MAX_SIZE_CLASS) {
     memset(new_block_ptr, 0, block_size);
   }
 
@@ -384,17 +1980,32 @@ void* realloc (void* ptr, size_t size) {
   intptr_t addr = (intptr_t)ptr;
   if ((addr < start_addr) || (end_addr <= addr)) {
 
-    // Yes.  Grab its size from its header.  Calculate the size of the new block
-    // with the header, and then let mremap() handle the situation,
-    void*  old_ptr  = (void*)(addr - sizeof(size_t)); 
-    size_t old_size = *(size_t*)old_ptr;
-    size_t new_size = size + sizeof(size_t);
+    // A block from the bootstrap arena cannot be remapped, so copy it.
+    if (IS_BOOTSTRAP(addr)) {
+      size_t old_size      = LARGE_MAPPING_LENGTH(addr) - LARGE_HEADER_SIZE;
+      void*  new_block_ptr = malloc(size);
+      if (new_block_ptr != NULL) {
+	memcpy(new_block_ptr, ptr, size < old_size ? size : old_size);
+      }
+      return new_block_ptr;
+    }
+
+    // Yes.  Grab its mapping length from its header.  Calculate the length of
+    // the new mapping with the header, unless that would overflow, and then
+    // let mremap() handle the situation.
+    if (size > PTRDIFF_MAX) {
+      return NULL;
+    }
+    void*  old_ptr  = (void*)(addr - LARGE_HEADER_SIZE);
+    size_t old_size = LARGE_MAPPING_LENGTH(addr);
+    size_t new_size = LARGE_HEADER_SIZE + size;
     void*  new_ptr  = mremap(old_ptr, old_size, new_size, MREMAP_MAYMOVE);
     if (new_ptr == MAP_FAILED) {
       DEBUG("realloc(): mremap() of large block failed", old_size, new_size);
       return NULL;
     }
-    void* new_block_ptr = (void*)((intptr_t)new_ptr + sizeof(size_t));
+    void* new_block_ptr = (void*)((intptr_t)new_ptr + LARGE_HEADER_SIZE);
+    LARGE_MAPPING_LENGTH(new_block_ptr) = new_size;
     return new_block_ptr;
     
   }
@@ -410,7 +2021,7 @@ void* realloc (void* ptr, size_t size) {
   // Allocate the new, larger block, copy the contents of the old into it, and
   // free the old.
   void*  new_block_ptr = malloc(size);
-  size_t old_size      = 1 << size_class;
+  size_t old_size      = CALC_CLASS_SIZE(size_class);
   if (new_block_ptr != NULL) {
     memcpy(new_block_ptr, ptr, old_size);
     free(ptr);
@@ -423,6 +2034,323 @@ void* realloc (void* ptr, size_t size) {
 
 
 
+// ==============================================================================
+/**
+ * Allocate a block that sits alone on its cache line(s).  Every size class of a
+ * cache line or more has line-aligned blocks that fill whole lines (colored
+ * pages shift blocks by whole lines), and large blocks follow a one-line
+ * header, so it suffices to ask for at least a line.
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the allocated block, if successful; `NULL` if unsuccessful.
+ */
+void* malloc_cacheline (size_t size) {
+
+#if defined (TUNED_SIZE_CLASSES)
+  // Only tuned classes of whole lines have line-aligned blocks, so round up to
+  // the next of those; the largest class is always one.
+  if (size < CACHE_LINE_SIZE) {
+    size = CACHE_LINE_SIZE;
+  }
+  unsigned int size_class = CALC_SIZE_CLASS(size);
+  while (size_class <= MAX_SIZE_CLASS && CALC_CLASS_SIZE(size_class) % CACHE_LINE_SIZE != 0) {
+    size_class += 1;
+  }
+  return malloc(size_class <= MAX_SIZE_CLASS ? CALC_CLASS_SIZE(size_class) : size);
+#else
+  return malloc(size < CACHE_LINE_SIZE ? CACHE_LINE_SIZE : size);
+#endif
+
+} // malloc_cacheline ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Return the number of bytes of pages carved for the size classes, less those
+ * returned to the OS.  Large blocks are mapped and unmapped whole, so they are
+ * not counted.
+ *
+ * \return The heap extent, in bytes.
+ */
+size_t alloc_heap_extent () {
+
+  if (start_addr == 0) {
+    return 0;
+  }
+  POOL_LOCK();
+  size_t released = released_pages * PAGE_SIZE;
+  POOL_UNLOCK();
+  return __atomic_load_n(&free_addr, __ATOMIC_RELAXED) - start_addr - released;
+
+} // alloc_heap_extent ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Visit the blocks of a page or sub-page, in address order, marking each block
+ * free or allocated from the page's free list.  The blocks of a page carved
+ * into sub-pages are visited in place of those blocks.
+ *
+ * \param page           The page or sub-page.
+ * \param page_end       The end of the page or sub-page.
+ * \param from           Visit only blocks at or above this address...
+ * \param to             ...and below this one.
+ * \param allocated_only Whether to visit only allocated blocks.
+ * \param callback       The function to call for each block visited.
+ * \param arg            The argument to pass to `callback`.
+ * \return The number of blocks visited.
+ */
+static size_t walk_blocks (page_header_s* page, intptr_t page_end, intptr_t from, intptr_t to,
+			   bool allocated_only, alloc_walk_f callback, void* arg) {
+
+  // Mark the free blocks, and those carved into sub-pages, by their indices
+  // within the page.
+  size_t   class_size = CALC_CLASS_SIZE(page->size_class);
+  intptr_t first      = (intptr_t)page + page->first_block * 16;
+  uint64_t free_map[PAGE_SIZE / 8 / 64 + 1];
+  uint64_t carved_map[PAGE_SIZE / 8 / 64 + 1];
+  memset(free_map, 0, sizeof(free_map));
+  memset(carved_map, 0, sizeof(carved_map));
+  for (header_s* block = GET_FREE(page); block != NULL; block = GET_NEXT(block)) {
+    size_t index = ((intptr_t)block - first) / class_size;
+    free_map[index / 64] |= (uint64_t)1 << (index % 64);
+  }
+  if (!IS_SUBPAGE(page)) {
+    for (uint8_t link = page->carved; link != 0; link = carved_block(page, link)->carved) {
+      carved_map[(link - 1) / 64] |= (uint64_t)1 << ((link - 1) % 64);
+    }
+  }
+
+  size_t visited = 0;
+  size_t index   = 0;
+  for (intptr_t block = first; block + class_size <= page_end;
+       block += class_size, index += 1) {
+    bool allocated = !((free_map[index / 64] >> (index % 64)) & 1);
+    if ((carved_map[index / 64] >> (index % 64)) & 1) {
+      visited += walk_blocks((page_header_s*)block, block + class_size, from, to,
+			     allocated_only, callback, arg);
+    } else if (block >= from && block < to && (allocated || !allocated_only)) {
+      callback((void*)block, class_size, allocated, arg);
+      visited += 1;
+    }
+  }
+  return visited;
+
+} // walk_blocks ()
+// ==============================================================================
+
+
+
+#if defined (THREAD_SAFE)
+// ==============================================================================
+/**
+ * Is a page one that holds a cache, and so has no page header?
+ *
+ * \param page_addr The page.
+ * \return Whether the page holds a cache.
+ */
+static bool is_cache_page (intptr_t page_addr) {
+
+  for (thread_cache_s* cache = __atomic_load_n(&all_caches, __ATOMIC_ACQUIRE);
+       cache != NULL; cache = cache->next_cache) {
+    if ((intptr_t)cache == page_addr) {
+      return true;
+    }
+  }
+  return false;
+
+} // is_cache_page ()
+// ==============================================================================
+#endif
+
+
+
+// ==============================================================================
+/**
+ * Visit the blocks of the size class pages owned by one cache, or all of them
+ * without `THREAD_SAFE`, page by page in address order, marking each block of a
+ * page free or allocated from the page's free list.  Pooled pages hold no
+ * blocks, and are skipped.
+ *
+ * \param owner          The cache whose pages to visit, held out of them.
+ * \param heap_end       The end of the carved pages.
+ * \param from           Visit only blocks at or above this address...
+ * \param to             ...and below this one.
+ * \param allocated_only Whether to visit only allocated blocks.
+ * \param callback       The function to call for each block visited.
+ * \param arg            The argument to pass to `callback`.
+ * \return The number of blocks visited.
+ */
+static size_t walk_owned_pages (void* owner, intptr_t heap_end, intptr_t from, intptr_t to,
+				bool allocated_only, alloc_walk_f callback, void* arg) {
+
+  size_t visited = 0;
+  for (intptr_t page_addr = start_addr; page_addr < heap_end && page_addr < to;
+       page_addr += PAGE_SIZE) {
+
+    page_header_s* page = (page_header_s*)page_addr;
+#if defined (THREAD_SAFE)
+    if (UNLINK(page->owner) != owner || is_cache_page(page_addr)) {
+      continue;
+    }
+#endif
+    if (page->live == 0 && GET_FREE(page) == NULL) {
+      continue;
+    }
+    visited += walk_blocks(page, page_addr + PAGE_SIZE, from, to, allocated_only, callback, arg);
+
+  }
+  return visited;
+
+} // walk_owned_pages ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Visit the blocks of the size class pages.  With `THREAD_SAFE`, visit those of
+ * each cache in turn, holding its thread out of them meanwhile; blocks that
+ * other threads have freed to a cache but that its thread has not yet taken
+ * back count as allocated.  Where the kernel lacks `membarrier()`, visit only
+ * the calling thread's pages.
+ *
+ * \param from           Visit only blocks at or above this address...
+ * \param to             ...and below this one.
+ * \param allocated_only Whether to visit only allocated blocks.
+ * \param callback       The function to call for each block visited.
+ * \param arg            The argument to pass to `callback`.
+ * \return The number of blocks visited.
+ */
+static size_t walk_pages (intptr_t from, intptr_t to, bool allocated_only,
+			  alloc_walk_f callback, void* arg) {
+
+  if (start_addr == 0) {
+    return 0;
+  }
+  intptr_t heap_end = __atomic_load_n(&free_addr, __ATOMIC_RELAXED);
+  if (heap_end > end_addr) {
+    heap_end = end_addr;
+  }
+
+#if defined (THREAD_SAFE)
+  size_t visited = 0;
+  pthread_mutex_lock(&walk_lock);
+  for (thread_cache_s* cache = __atomic_load_n(&all_caches, __ATOMIC_ACQUIRE);
+       cache != NULL; cache = cache->next_cache) {
+
+    // The calling thread's own pages cannot change while it walks them.
+    if (cache == my_cache) {
+      visited += walk_owned_pages(cache, heap_end, from, to, allocated_only, callback, arg);
+      continue;
+    }
+    if (!walk_others) {
+      continue;
+    }
+
+    // Mark the cache walked, force a barrier on its thread so that the two
+    // see each other's marks, and wait for the thread to leave its pages.
+    __atomic_store_n(&cache->walked, true, __ATOMIC_RELAXED);
+    syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    while (__atomic_load_n(&cache->busy, __ATOMIC_ACQUIRE)) {
+      sched_yield();
+    }
+    visited += walk_owned_pages(cache, heap_end, from, to, allocated_only, callback, arg);
+    __atomic_store_n(&cache->walked, false, __ATOMIC_RELEASE);
+
+  }
+  pthread_mutex_unlock(&walk_lock);
+  return visited;
+#else
+  return walk_owned_pages(NULL, heap_end, from, to, allocated_only, callback, arg);
+#endif
+
+} // walk_pages ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Visit every block of the size class pages, allocated or free.
+ *
+ * \param callback The function to call for each block.
+ * \param arg      The argument to pass to `callback`.
+ */
+void alloc_heap_walk (alloc_walk_f callback, void* arg) {
+
+  walk_pages(0, INTPTR_MAX, false, callback, arg);
+
+} // alloc_heap_walk ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Visit each allocated block of the size class pages that starts within a range
+ * of addresses.
+ *
+ * \param base     The start of the range.
+ * \param size     The size of the range, in bytes.
+ * \param callback The function to call for each block.
+ * \param arg      The argument to pass to `callback`.
+ * \return The number of blocks visited.
+ */
+size_t malloc_iterate (uintptr_t base, size_t size, alloc_walk_f callback, void* arg) {
+
+  uintptr_t end = (base + size < base ? UINTPTR_MAX : base + size);
+  return walk_pages(base, end > INTPTR_MAX ? INTPTR_MAX : end, true, callback, arg);
+
+} // malloc_iterate ()
+// ==============================================================================
+
+
+
+#if defined (HYBRID_SMALL_TIER)
+// ==============================================================================
+/**
+ * Return the number of bytes that a block may hold:  its class size, or, for a
+ * large block, the length of its mapping after the header.
+ *
+ * \param ptr A pointer to an allocated block.
+ * \return The usable size of the block, in bytes.
+ */
+size_t usable_size (void* ptr) {
+
+  intptr_t addr = (intptr_t)ptr;
+  if ((addr < start_addr) || (end_addr <= addr)) {
+    return LARGE_MAPPING_LENGTH(addr) - LARGE_HEADER_SIZE;
+  }
+  return CALC_CLASS_SIZE(GET_SIZE_CLASS(ptr));
+
+} // usable_size ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Is a block one from the bootstrap arena, which serves the requests made
+ * before the hybrid allocator's constructor initializes this tier?
+ *
+ * \param ptr A pointer to a block.
+ * \return `true` if the block is from the bootstrap arena; `false` otherwise.
+ */
+bool bootstrap_block (void* ptr) {
+
+  return IS_BOOTSTRAP(ptr);
+
+} // bootstrap_block ()
+// ==============================================================================
+#endif
+
+
+
 #if defined (ALLOC_MAIN)
 // ==============================================================================
 #define MIN_SIZE 16
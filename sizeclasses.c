@@ -0,0 +1,225 @@
+// ==============================================================================
+/**
+ * sizeclasses.c
+ *
+ * Fit sf-alloc's size classes to a program's allocation sizes.  Read a
+ * histogram of request sizes, choose at most a given number of classes that
+ * minimize the internal fragmentation of those requests, and write the classes
+ * as a header, `size-classes.h`, with which sf-alloc is built by
+ * `-DTUNED_SIZE_CLASSES`:
+ *
+ *   ./sizeclasses 12 site.trace > size-classes.h
+ *
+ * The input is a trace written by `bench gentrace` (lines `a <id> <size>
+ * <site>` and `f <id>`), or a histogram (lines `<size> <count>`), or a mix.
+ * Classes are multiples of 16 bytes, so that blocks stay aligned, and the
+ * largest is always 2048 bytes, the largest that sf-alloc keeps in pages;
+ * larger requests are mapped apart and are ignored here.
+ **/
+// ==============================================================================
+
+
+
+// ==============================================================================
+// INCLUDES
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// ==============================================================================
+
+
+
+// ==============================================================================
+// MACRO CONSTANTS AND FUNCTIONS
+
+/** The granularity of the classes, and the smallest class. */
+#define GRANULE 16
+
+/** The largest class. */
+#define LARGEST_CLASS 2048
+
+/** The number of candidate classes, one per granule. */
+#define BUCKETS (LARGEST_CLASS / GRANULE)
+
+/** The most classes sf-alloc can track, one bit each in a 32-bit bitmap. */
+#define MAX_CLASSES 32
+
+/** The bucket of a size:  the smallest candidate class that holds it. */
+#define BUCKET(size) (((size) + GRANULE - 1) / GRANULE)
+// ==============================================================================
+
+
+
+// ==============================================================================
+// GLOBALS
+
+/** The number of requests, and the sum of their sizes, per bucket, as prefix sums. */
+static uint64_t counts[BUCKETS + 1];
+static uint64_t bytes[BUCKETS + 1];
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * Read request sizes into the per-bucket counts, from a trace or histogram.
+ *
+ * \param input The trace or histogram.
+ * \return The number of requests read, of any size.
+ */
+static uint64_t read_sizes (FILE* input) {
+
+  uint64_t requests = 0;
+  char     line[256];
+  while (fgets(line, sizeof(line), input) != NULL) {
+
+    unsigned long long size  = 0;
+    unsigned long long count = 1;
+    long               id;
+    if (line[0] == 'a') {
+      if (sscanf(line, "a %ld %llu", &id, &size) != 2) {
+	continue;
+      }
+    } else if (sscanf(line, "%llu %llu", &size, &count) != 2) {
+      continue;
+    }
+
+    requests += count;
+    if (size == 0 || size > LARGEST_CLASS) {
+      continue;
+    }
+    counts[BUCKET(size)] += count;
+    bytes[BUCKET(size)]  += size * count;
+
+  }
+  return requests;
+
+} // read_sizes ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The bytes wasted by one class serving every request of the buckets after
+ * `first` up to and including `last`.  The counts must be prefix sums.
+ *
+ * \param first The bucket before the class's first.
+ * \param last  The class's bucket.
+ * \return The bytes wasted.
+ */
+static uint64_t waste (int first, int last) {
+
+  return (uint64_t)last * GRANULE * (counts[last] - counts[first]) -
+	 (bytes[last] - bytes[first]);
+
+} // waste ()
+// ==============================================================================
+
+
+
+// ==============================================================================
+/**
+ * The entry point.  Choose the classes by dynamic programming over the class
+ * boundaries, and write the header.
+ */
+int main (int argc, char** argv) {
+
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "USAGE: %s <max # classes> [<trace or histogram>]\n", argv[0]);
+    return 1;
+  }
+  int max_classes = atoi(argv[1]);
+  if (max_classes < 1 || max_classes > MAX_CLASSES) {
+    fprintf(stderr, "%s: between 1 and %d classes are supported\n", argv[0], MAX_CLASSES);
+    return 1;
+  }
+  FILE* input = stdin;
+  if (argc == 3 && (input = fopen(argv[2], "r")) == NULL) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  uint64_t requests = read_sizes(input);
+  for (int bucket = 1; bucket <= BUCKETS; bucket += 1) {
+    counts[bucket] += counts[bucket - 1];
+    bytes[bucket]  += bytes[bucket - 1];
+  }
+  if (counts[BUCKETS] == 0) {
+    fprintf(stderr, "%s: no requests of at most %d bytes\n", argv[0], LARGEST_CLASS);
+    return 1;
+  }
+
+  // best[m][k] is the least waste of m classes, the largest at bucket k, serving
+  // every bucket up to k; prev[m][k] is the bucket of the class before it.
+  static uint64_t best[MAX_CLASSES + 1][BUCKETS + 1];
+  static int      prev[MAX_CLASSES + 1][BUCKETS + 1];
+  for (int last = 1; last <= BUCKETS; last += 1) {
+    best[1][last] = waste(0, last);
+  }
+  for (int m = 2; m <= max_classes; m += 1) {
+    for (int last = m; last <= BUCKETS; last += 1) {
+      best[m][last] = UINT64_MAX;
+      for (int first = m - 1; first < last; first += 1) {
+	uint64_t total = best[m - 1][first] + waste(first, last);
+	if (total < best[m][last]) {
+	  best[m][last] = total;
+	  prev[m][last] = first;
+	}
+      }
+    }
+  }
+
+  // Walk back from the largest class, dropping classes that serve no request.
+  int classes = max_classes < BUCKETS ? max_classes : BUCKETS;
+  int chosen[MAX_CLASSES];
+  int count = 0;
+  for (int m = classes, last = BUCKETS; m >= 1; m -= 1) {
+    int first = m > 1 ? prev[m][last] : 0;
+    if (last == BUCKETS || counts[last] > counts[first]) {
+      chosen[count++] = last;
+    }
+    last = first;
+  }
+
+  // Compare with sf-alloc's power-of-2 classes.
+  uint64_t pow2_waste = 0;
+  for (int first = 0, last = 1; last <= BUCKETS; first = last, last *= 2) {
+    pow2_waste += waste(first, last);
+  }
+  fprintf(stderr, "%llu requests, %llu of at most %d bytes:  %.1f%% wasted by "
+	  "power-of-2 classes, %.1f%% by %d tuned classes\n",
+	  (unsigned long long)requests, (unsigned long long)counts[BUCKETS], LARGEST_CLASS,
+	  100.0 * pow2_waste / bytes[BUCKETS], 100.0 * best[classes][BUCKETS] / bytes[BUCKETS],
+	  count);
+
+  // Write the classes, smallest first, and the class of each bucket.
+  printf("// Generated by sizeclasses from %s; do not edit.\n\n",
+	 argc == 3 ? argv[2] : "standard input");
+  printf("/** The number of size classes, and the largest class size. */\n");
+  printf("#define TUNED_CLASS_COUNT %d\n", count);
+  printf("#define TUNED_MAX_CLASS_SIZE %d\n\n", LARGEST_CLASS);
+  printf("/** The size of each class. */\n");
+  printf("static const uint16_t tuned_class_sizes[TUNED_CLASS_COUNT] = {");
+  for (int i = count - 1; i >= 0; i -= 1) {
+    printf("%s%d", i == count - 1 ? " " : ", ", chosen[i] * GRANULE);
+  }
+  printf(" };\n\n");
+  printf("/** The class of each size, indexed by the size in %d-byte units, rounded up. */\n",
+	 GRANULE);
+  printf("static const uint8_t tuned_size_classes[TUNED_MAX_CLASS_SIZE / %d + 1] = {", GRANULE);
+  int size_class = 0;
+  for (int bucket = 0; bucket <= BUCKETS; bucket += 1) {
+    while (chosen[count - 1 - size_class] < bucket) {
+      size_class += 1;
+    }
+    printf("%s%s%d", bucket == 0 ? "" : ",", bucket % 16 == 0 ? "\n  " : " ", size_class);
+  }
+  printf("\n};\n");
+
+  return 0;
+
+} // main ()
+// ==============================================================================